@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/common.h"
+#include "../src/register.h"
+#include "../src/vm.h"
+
+/*
+    Stack vm vs register vm (--register)
+    - runs the same lox programs once on each vm and compares wall time and how many instructions got dispatched.
+    - instruction counts need the counter compiled in (-DDEBUG_COUNT_INSTRUCTIONS), so make bench builds this twice:
+      register_vm_count.out prints the counts, register_vm.out (without the counter) the times.
+
+    build and run with: make bench
+*/
+
+// the vm-module expects these flags (normally defined in main.c)
+#ifdef DEBUG_PRINT_CODE
+bool FLAG_PRINT_CODE = false;
+#endif
+
+#ifdef DEBUG_TRACE_EXECUTION
+bool FLAG_TRACE_EXECUTION = false;
+#endif
+
+#ifdef DEBUG_LOG_GC
+bool FLAG_LOG_GC = false;
+#endif
+
+typedef struct {
+    const char* name;
+    const char* source;
+} Program;
+
+static Program programs[] = {
+    {"fib(27)",
+        "fun fib(n) { if (n < 2) return n; return fib(n - 2) + fib(n - 1); }\n"
+        "var result = fib(27);\n"},
+    {"loop 3M",
+        "fun loop() { var sum = 0; for (var i = 0; i < 3000000; i = i + 1) { sum = sum + i % 7; } return sum; }\n"
+        "var result = loop();\n"},
+    {"nested loops",
+        "fun grid(n) { var count = 0; for (var x = 0; x < n; x = x + 1) { for (var y = 0; y < n; y = y + 1) {\n"
+        "    if (x * y % 3 == 0 and x != y) count = count + 1; } } return count; }\n"
+        "var result = grid(1200);\n"},
+    {"closures",
+        "fun counter() { var c = 0; fun inc() { c = c + 1; return c; } return inc; }\n"
+        "fun run() { var inc = counter(); var last; for (var i = 0; i < 1000000; i = i + 1) last = inc(); return last; }\n"
+        "var result = run();\n"},
+    {"strings",
+        "fun build() { var s = \"\"; for (var i = 0; i < 20000; i = i + 1) { if (len(s) > 64) s = \"\"; s = s + \"ab\"; } return s; }\n"
+        "var result = build();\n"},
+    {"methods (stack)",
+        "class Point { init(x) { this.x = x; } move(d) { this.x = this.x + d; } }\n"
+        "fun run() { var p = Point(0); for (var i = 0; i < 500000; i = i + 1) p.move(1); return p.x; }\n"
+        "var result = run();\n"},
+};
+
+// runs the program on a fresh vm, returns the time it took in seconds
+static double runProgram(Program* program, bool registers, long* instructions) {
+    FLAG_REGISTER_VM = registers;
+    initVM();
+    clock_t start = clock();
+    InterpretResult result = interpret(program->source, strlen(program->source));
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    if (result != INTERPRET_OK) printf("%s failed!\n", program->name);
+    #ifdef DEBUG_COUNT_INSTRUCTIONS
+    *instructions = vm.instructionCount;
+    #else
+    *instructions = 0;
+    #endif
+    freeVM();
+    return seconds;
+}
+
+int main() {
+    #ifdef DEBUG_COUNT_INSTRUCTIONS
+    printf("%-16s %14s %14s %8s\n", "program", "stack instrs", "register instrs", "ratio");
+    #else
+    printf("%-16s %10s %10s %8s\n", "program", "stack s", "register s", "speedup");
+    #endif
+    for (int i = 0; i < (int)(sizeof(programs) / sizeof(programs[0])); i++) {
+        long stackCount, registerCount;
+        double stackTime = runProgram(&programs[i], false, &stackCount);
+        double registerTime = runProgram(&programs[i], true, &registerCount);
+        #ifdef DEBUG_COUNT_INSTRUCTIONS
+        printf("%-16s %14ld %14ld %8.2f\n", programs[i].name, stackCount, registerCount, (double)registerCount / stackCount);
+        #else
+        printf("%-16s %10.3f %10.3f %7.2fx\n", programs[i].name, stackTime, registerTime, stackTime / registerTime);
+        #endif
+    }
+    return 0;
+}
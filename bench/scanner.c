@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/common.h"
+#include "../src/scanner.h"
+
+/*
+    Throughput benchmark for the scanner (scanner.c) - only scanToken(), no compiling.
+    - generates a few MB of lox source that looks like generated code: indented blocks, // comments, string literals,
+      identifiers, keywords and numbers. Then scans it ROUNDS times and reports MB/s and tokens/s.
+
+    build and run with: make bench
+*/
+
+// the modules expect these flags (normally defined in main.c)
+#ifdef DEBUG_PRINT_CODE
+bool FLAG_PRINT_CODE = false;
+#endif
+
+#ifdef DEBUG_TRACE_EXECUTION
+bool FLAG_TRACE_EXECUTION = false;
+#endif
+
+#ifdef DEBUG_LOG_GC
+bool FLAG_LOG_GC = false;
+#endif
+
+#define SOURCE_BYTES (8 * 1024 * 1024)
+#define ROUNDS 10
+
+static long nanoseconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000000000L + time.tv_nsec;
+}
+
+// one generated function, the i makes names and numbers differ
+static int writeFunction(char* at, int i) {
+    return sprintf(at,
+        "// ------------------------------------------------------------------\n"
+        "// generated helper nr. %d - computes something that nobody ever reads\n"
+        "// ------------------------------------------------------------------\n"
+        "fun generated_%d(first, second) {\n"
+        "    var total_%d = first * %d.5 + second;           // mixed arithmetic\n"
+        "    var label = \"this is a longer string literal for function %d\";\n"
+        "    for (var i = 0; i < %d; i = i + 1) {\n"
+        "        if (total_%d > 1000 and !(i == 3) or false) {\n"
+        "            total_%d = total_%d - i %% 7;\n"
+        "        } else {\n"
+        "            print label;                            // just printing\n"
+        "        }\n"
+        "    }\n"
+        "    return total_%d;\n"
+        "}\n\n",
+        i, i, i, i, i, i % 100, i, i, i, i);
+}
+
+int main() {
+    char* source = malloc(SOURCE_BYTES + 1024);
+    int length = 0;
+    for (int i = 0; length < SOURCE_BYTES; i++) length += writeFunction(source + length, i);
+    source[length] = '\0';
+
+    Scanner scanner;
+    long best = 0;
+    long tokens = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        long start = nanoseconds();
+        initScanner(&scanner, source, length);
+        tokens = 0;
+        for (;;) {
+            Token token = scanToken(&scanner);
+            tokens++;
+            if (token.type == TOKEN_EOF) break;
+            if (token.type == TOKEN_ERROR) {
+                fprintf(stderr, "scan error in line %d: %.*s\n", token.line, token.length, token.start);
+                return 1;
+            }
+        }
+        long took = nanoseconds() - start;
+        if (best == 0 || took < best) best = took;
+    }
+    double seconds = best / 1e9;
+    printf("scanner: bytes=%d tokens=%ld best-of-%d=%.2fms throughput=%.0fMB/s %.1fM tokens/s\n",
+        length, tokens, ROUNDS, best / 1e6, length / seconds / (1024 * 1024), tokens / seconds / 1e6);
+    free(source);
+    return 0;
+}
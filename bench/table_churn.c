@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "../src/common.h"
+#include "../src/memory.h"
+#include "../src/object.h"
+#include "../src/table.h"
+#include "../src/vm.h"
+
+/*
+    Churn benchmark for the HashMap (table.c)
+    - simulates a long running cache: keeps a window of WINDOW live keys, every round adds one new key and deletes the oldest one.
+    - every REPORT_EVERY rounds we print how the table looks: probe lengths should stay flat and capacity/memory bounded.
+    - at the end we delete everything to check the table shrinks back down.
+
+    build and run with: make bench
+*/
+
+// the vm-module expects these flags (normally defined in main.c)
+#ifdef DEBUG_PRINT_CODE
+bool FLAG_PRINT_CODE = false;
+#endif
+
+#ifdef DEBUG_TRACE_EXECUTION
+bool FLAG_TRACE_EXECUTION = false;
+#endif
+
+#ifdef DEBUG_LOG_GC
+bool FLAG_LOG_GC = false;
+#endif
+
+#define WINDOW 10000
+#define ROUNDS 2000000
+#define REPORT_EVERY 250000
+
+// helper - interned string for key number i
+static ObjString* keyFor(int i) {
+    char buffer[32];
+    int length = snprintf(buffer, sizeof(buffer), "key%d", i);
+    return copyString(buffer, length);
+}
+
+// average and max number of buckets a lookup of a live key has to look at
+static void probeStats(Table* table, double* average, int* max) {
+    long total = 0;
+    int live = 0;
+    *max = 0;
+    for (int i = 0; i < table->capacity; i++) {
+        ObjString* key = table->entries[i].key;
+        if (key == NULL) continue;
+        int probes = ((i - (int)(key->hash & (table->capacity - 1))) & (table->capacity - 1)) + 1;
+        total += probes;
+        live++;
+        if (probes > *max) *max = probes;
+    }
+    *average = live == 0 ? 0 : (double)total / live;
+}
+
+static void report(const char* label, Table* table, double seconds) {
+    double average;
+    int max;
+    probeStats(table, &average, &max);
+    printf("%-14s live=%-7d tombstones=%-7d capacity=%-8d avg-probe=%-6.2f max-probe=%-4d heap=%-9zu ops/s=%.0f\n",
+        label, table->count - table->tombstones, table->tombstones, table->capacity,
+        average, max, vm.bytesAllocated, seconds > 0 ? 2.0 * REPORT_EVERY / seconds : 0);
+}
+
+int main() {
+    initVM();
+    // the map lives in a global, so the GC sees it (and its keys) as reachable
+    ObjMap* map = newMap();
+    push(OBJ_VAL(map));
+    tableSet(&vm.globals, copyString("cache", 5), OBJ_VAL(map));
+    pop();
+    Table* table = &map->table;
+
+    for (int i = 0; i < WINDOW; i++) {
+        ObjString* key = keyFor(i);
+        push(OBJ_VAL(key));
+        tableSet(table, key, NUMBER_VAL(i));
+        pop();
+    }
+    report("filled", table, 0);
+
+    clock_t start = clock();
+    for (int round = WINDOW; round < WINDOW + ROUNDS; round++) {
+        ObjString* key = keyFor(round);
+        push(OBJ_VAL(key));
+        tableSet(table, key, NUMBER_VAL(round));
+        pop();
+        tableDelete(table, keyFor(round - WINDOW));
+        if ((round - WINDOW + 1) % REPORT_EVERY == 0) {
+            char label[32];
+            snprintf(label, sizeof(label), "round %d", round - WINDOW + 1);
+            double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+            collectGarbage();           // so heap only counts what is still reachable
+            report(label, table, seconds);
+            start = clock();
+        }
+    }
+
+    for (int i = ROUNDS; i < WINDOW + ROUNDS; i++) {
+        tableDelete(table, keyFor(i));
+    }
+    collectGarbage();
+    report("emptied", table, 0);
+
+    freeVM();
+    return 0;
+}
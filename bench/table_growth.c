@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "../src/common.h"
+#include "../src/memory.h"
+#include "../src/object.h"
+#include "../src/table.h"
+#include "../src/vm.h"
+
+/*
+    Growth benchmark for the HashMap (table.c)
+    - inserts KEYS new keys into one map and times every single tableSet().
+    - a resize that rehashes everything at once shows up as a latency spike, the incremental resize should keep the max low.
+
+    build and run with: make bench
+*/
+
+// the vm-module expects these flags (normally defined in main.c)
+#ifdef DEBUG_PRINT_CODE
+bool FLAG_PRINT_CODE = false;
+#endif
+
+#ifdef DEBUG_TRACE_EXECUTION
+bool FLAG_TRACE_EXECUTION = false;
+#endif
+
+#ifdef DEBUG_LOG_GC
+bool FLAG_LOG_GC = false;
+#endif
+
+#define KEYS 4000000
+#define SLOW_OP_NS 100000       // ops slower than 0.1ms count as a spike
+
+static long nanoseconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000000000L + time.tv_nsec;
+}
+
+int main() {
+    initVM();
+    // the map lives in a global, so the GC sees it (and its keys) as reachable
+    ObjMap* map = newMap();
+    push(OBJ_VAL(map));
+    tableSet(&vm.globals, copyString("map", 3), OBJ_VAL(map));
+    pop();
+    vm.nextGC = (size_t)-1;         // we time the table, not the GC
+
+    long total = 0;
+    long max = 0;
+    int slowOps = 0;
+    for (int i = 0; i < KEYS; i++) {
+        char buffer[32];
+        int length = snprintf(buffer, sizeof(buffer), "key%d", i);
+        ObjString* key = copyString(buffer, length);    // (interning the key also grows the string-pool)
+        long start = nanoseconds();
+        tableSet(&map->table, key, NUMBER_VAL(i));
+        long took = nanoseconds() - start;
+        total += took;
+        if (took > max) max = took;
+        if (took > SLOW_OP_NS) slowOps++;
+    }
+    printf("keys=%d capacity=%d avg-set=%.0fns max-set=%.3fms sets>%.1fms=%d\n",
+        KEYS, map->table.capacity, (double)total / KEYS, max / 1e6, SLOW_OP_NS / 1e6, slowOps);
+
+    freeVM();
+    return 0;
+}
@@ -1,35 +1,154 @@
+#include <string.h>
+
+#include "array.h"
 #include "object.h"
 #include "value.h"
 #include "memory.h"
+#include "vm.h"
+
+/*
+    Lox-Arrays are a growable ring buffer:
+    - head is the slot index 0 lives in. Counting up from head (wrapping arround at capacity) we find all items.
+    - this way we can add/remove at both ends without moving any other item. (queues, work-lists, BFS...)
+    - inserting/deleting in the middle only moves the items on the shorter side of the index.
+
+    The buffer lives in a ref-counted ArrayStore:
+    - slice() hands out a view that points into the same store (no copy of the items at all)
+    - the first write to ANY array that shares its store (view or original) copies its own items to a new store first.
+*/
+
+// helper - allocates a store for capacity values that only the caller uses so far
+static ArrayStore* allocateStore(int capacity) {
+    ArrayStore* store = (ArrayStore*)reallocate(NULL, 0, sizeof(ArrayStore) + sizeof(Value) * capacity);
+    store->refCount = 1;
+    return store;
+}
+
+// lets go of the store. The last array to let go frees it.
+void arrayReleaseStore(ObjArray* array) {
+    if (array->store == NULL) return;
+    array->store->refCount--;
+    if (array->store->refCount == 0) {
+        reallocate(array->store, sizeof(ArrayStore) + sizeof(Value) * array->capacity, 0);
+    }
+    array->store = NULL;
+    array->items = NULL;
+}
+
+// helper - moves the items into a new store of given capacity.
+// - we copy the items over in order, so in the new store head starts at 0 again
+static void moveToStore(ObjArray* array, int capacity) {
+    ArrayStore* store = allocateStore(capacity);    // might trigger GC, but the array is still intact till we swap below
+    for (int i = 0; i < array->count; i++) {
+        store->values[i] = ARRAY_SLOT(array, i);
+    }
+    arrayReleaseStore(array);
+    array->store = store;
+    array->items = store->values;
+    array->capacity = capacity;
+    array->head = 0;
+    array->parent = NULL;               // we dont share anything with the array we got sliced from anymore
+}
+
+// helper - doubles the capacity of the ring buffer.
+static void growArray(ObjArray* array) {
+    moveToStore(array, GROW_CAPACITY(array->capacity));
+}
+
+// helper - copy on write: call this before ANY write to the array.
+// - if some other array still reads from our store we take a private copy of our items (sized for our count)
+static void ensureOwnStore(ObjArray* array) {
+    if (array->store == NULL) return;
+    if (array->store->refCount > 1) {
+        int capacity = GROW_CAPACITY(0);
+        while (capacity < array->count + 1) capacity *= 2;
+        moveToStore(array, capacity);
+    } else {
+        array->parent = NULL;           // everyone else already let go of the store
+    }
+}
 
 // Lox-Arrays can take in anything considered a value (so other arrays aswell)
 // - grows if necessary. Similar to valueArray or chunk
 void arrayAppendAtEnd(ObjArray* array, Value value) {
+    ensureOwnStore(array);
     if (array->capacity < array->count + 1) {
-        int oldCapacity = array->capacity;
-        array->capacity = GROW_CAPACITY(oldCapacity);
-        array->items = GROW_ARRAY(Value, array->items, oldCapacity, array->capacity);
+        growArray(array);
     }
-    array->items[array->count] = value;
+    ARRAY_SLOT(array, array->count) = value;
     array->count++;
 }
 
+// adds value in front of idx=0 - we just move the head one slot back (wrapping arround)
+void arrayPrepend(ObjArray* array, Value value) {
+    ensureOwnStore(array);
+    if (array->capacity < array->count + 1) {
+        growArray(array);
+    }
+    array->head = (array->head - 1) & (array->capacity - 1);
+    array->items[array->head] = value;
+    array->count++;
+}
+
+// inserts value at index (0 <= index <= count) - everything from index on moves one up
+// - we move the items in front of index back instead, if thats the shorter side
+void arrayInsertAt(ObjArray* array, int index, Value value) {
+    ensureOwnStore(array);
+    if (array->capacity < array->count + 1) {
+        growArray(array);
+    }
+    if (index < array->count / 2) {
+        array->head = (array->head - 1) & (array->capacity - 1);
+        array->count++;
+        for (int i = 0; i < index; i++) {
+            ARRAY_SLOT(array, i) = ARRAY_SLOT(array, i + 1);
+        }
+    } else {
+        for (int i = array->count; i > index; i--) {
+            ARRAY_SLOT(array, i) = ARRAY_SLOT(array, i - 1);
+        }
+        array->count++;
+    }
+    ARRAY_SLOT(array, index) = value;
+}
+
 void arrayWriteTo(ObjArray* array, int index, Value value) {
-    array->items[index] = value;
+    ensureOwnStore(array);
+    ARRAY_SLOT(array, index) = value;
 }
 
 Value arrayReadFromIdx(ObjArray* array, int index) {
-    return array->items[index];
+    return ARRAY_SLOT(array, index);
 }
 
+// removes the item at index - we close the gap from the side that has less items to move
 void arrayDeleteFrom(ObjArray* array, int index) {
-    for (int i = index; i < array->count -1; i++) {
-        array->items[i] = array->items[i+1];
+    ensureOwnStore(array);
+    if (index < array->count / 2) {
+        for (int i = index; i > 0; i--) {
+            ARRAY_SLOT(array, i) = ARRAY_SLOT(array, i - 1);
+        }
+        array->items[array->head] = NIL_VAL;
+        array->head = (array->head + 1) & (array->capacity - 1);
+    } else {
+        for (int i = index; i < array->count -1; i++) {
+            ARRAY_SLOT(array, i) = ARRAY_SLOT(array, i + 1);
+        }
+        ARRAY_SLOT(array, array->count - 1) = NIL_VAL;
     }
-    array->items[array->count-1] = NIL_VAL;
     array->count--;
 }
 
+// removes and returns the first item (array must not be empty)
+Value arrayShift(ObjArray* array) {
+    ensureOwnStore(array);
+    Value value = array->items[array->head];
+    array->items[array->head] = NIL_VAL;
+    array->head = (array->head + 1) & (array->capacity - 1);
+    array->count--;
+    return value;
+}
+
 bool arrayIsValidIndex(ObjArray* array, int index) {
     return (index >= 0 && index < array->count);
 }
@@ -37,3 +156,281 @@ bool arrayIsValidIndex(ObjArray* array, int index) {
 int arrayGetLength(ObjArray* array) {
     return array->count;
 }
+
+// creates a view of the items [start, end) - shares the store, so no items get copied till someone writes.
+// - (0 <= start <= end <= count)
+ObjArray* arraySlice(ObjArray* array, int start, int end) {
+    ObjArray* slice = newArray();
+    if (start == end) return slice;
+    slice->store = array->store;
+    slice->store->refCount++;
+    slice->items = array->items;
+    slice->capacity = array->capacity;
+    slice->head = (array->head + start) & (array->capacity - 1);
+    slice->count = end - start;
+    slice->parent = array;
+    return slice;
+}
+
+// creates an array of count items all set to init
+// - allocates the store once (smallest power of 2 that fits) so no growing happens while filling it up
+ObjArray* arrayCreate(int count, Value init) {
+    ObjArray* array = newArray();
+    if (count == 0) return array;
+    int capacity = GROW_CAPACITY(0);
+    while (capacity < count) capacity *= 2;
+    push(OBJ_VAL(array));               // nothing references the new array yet -> GC could collect it while we allocate the store
+    array->store = allocateStore(capacity);
+    pop();
+    array->items = array->store->values;
+    array->capacity = capacity;
+    array->count = count;
+    for (int i = 0; i < count; i++) {
+        array->items[i] = init;
+    }
+    return array;
+}
+
+// reverses the order of the items in place
+void arrayReverse(ObjArray* array) {
+    ensureOwnStore(array);
+    for (int i = 0, j = array->count - 1; i < j; i++, j--) {
+        Value temp = ARRAY_SLOT(array, i);
+        ARRAY_SLOT(array, i) = ARRAY_SLOT(array, j);
+        ARRAY_SLOT(array, j) = temp;
+    }
+}
+
+// overwrites every item with value
+void arrayFill(ObjArray* array, Value value) {
+    ensureOwnStore(array);
+    for (int i = 0; i < array->count; i++) {
+        ARRAY_SLOT(array, i) = value;
+    }
+}
+
+// returns index of the first item equal to value or -1 if not found
+int arrayIndexOf(ObjArray* array, Value value) {
+    for (int i = 0; i < array->count; i++) {
+        if (valuesEqual(ARRAY_SLOT(array, i), value)) return i;
+    }
+    return -1;
+}
+
+/*
+    Sorting:
+    - the sorts work on a plain Value* so we first make sure the items dont wrap arround the end of the ring buffer.
+    - introsort: quicksort (median of 3 pivot), that falls back to heapsort if it recurses too deep (no O(n^2) worst case)
+      and uses insertion sort for the small partitions.
+    - arrays of only numbers get radix sorted instead (no compares at all).
+    - all algorithms only ever swap items, so every value stays in the array (reachable for the GC) even when less() calls back into lox.
+*/
+
+#define INSERTION_SORT_MAX 16           // partitions this small are faster to insertion-sort
+#define RADIX_SORT_MIN 64               // below this the counting overhead of radix sort does not pay off
+
+// helper - returns the items as one continuous block. Unwraps the ring buffer if necessary.
+static Value* continuousItems(ObjArray* array) {
+    ensureOwnStore(array);
+    if (array->head + array->count > array->capacity) {
+        moveToStore(array, array->capacity);
+    }
+    return array->items + array->head;
+}
+
+static void swapValues(Value* a, Value* b) {
+    Value temp = *a;
+    *a = *b;
+    *b = temp;
+}
+
+// the sort helpers all return false as soon as less() failed (ex. runtime error in the lox compare function)
+static bool insertionSort(Value* items, int count, ArrayLessFn less, void* context) {
+    for (int i = 1; i < count; i++) {
+        for (int j = i; j > 0; j--) {
+            bool isLess;
+            if (!less(context, items[j], items[j - 1], &isLess)) return false;
+            if (!isLess) break;
+            swapValues(&items[j], &items[j - 1]);
+        }
+    }
+    return true;
+}
+
+// helper for heapSort() - moves items[root] down till both children are smaller
+static bool siftDown(Value* items, int root, int count, ArrayLessFn less, void* context) {
+    for (;;) {
+        int child = 2 * root + 1;
+        if (child >= count) return true;
+        bool isLess;
+        if (child + 1 < count) {
+            if (!less(context, items[child], items[child + 1], &isLess)) return false;
+            if (isLess) child++;
+        }
+        if (!less(context, items[root], items[child], &isLess)) return false;
+        if (!isLess) return true;
+        swapValues(&items[root], &items[child]);
+        root = child;
+    }
+}
+
+static bool heapSort(Value* items, int count, ArrayLessFn less, void* context) {
+    for (int i = count / 2 - 1; i >= 0; i--) {
+        if (!siftDown(items, i, count, less, context)) return false;
+    }
+    for (int end = count - 1; end > 0; end--) {
+        swapValues(&items[0], &items[end]);
+        if (!siftDown(items, 0, end, less, context)) return false;
+    }
+    return true;
+}
+
+static bool introSort(Value* items, int count, int depthLimit, ArrayLessFn less, void* context) {
+    while (count > INSERTION_SORT_MAX) {
+        if (depthLimit == 0) return heapSort(items, count, less, context);
+        depthLimit--;
+
+        // median of 3: order first, middle and last. Then move the median (our pivot) to the front.
+        bool isLess;
+        int mid = count / 2;
+        if (!less(context, items[mid], items[0], &isLess)) return false;
+        if (isLess) swapValues(&items[mid], &items[0]);
+        if (!less(context, items[count - 1], items[mid], &isLess)) return false;
+        if (isLess) {
+            swapValues(&items[count - 1], &items[mid]);
+            if (!less(context, items[mid], items[0], &isLess)) return false;
+            if (isLess) swapValues(&items[mid], &items[0]);
+        }
+        swapValues(&items[0], &items[mid]);
+
+        // hoare partition arround items[0]. The bounds checks only matter for compare functions that contradict themselves.
+        int i = 0;
+        int j = count;
+        for (;;) {
+            do {
+                i++;
+                if (!less(context, items[i], items[0], &isLess)) return false;
+            } while (isLess && i < count - 1);
+            do {
+                j--;
+                if (!less(context, items[0], items[j], &isLess)) return false;
+            } while (isLess && j > 0);
+            if (i >= j) break;
+            swapValues(&items[i], &items[j]);
+        }
+        swapValues(&items[0], &items[j]);   // pivot into its final place
+
+        // recurse into the smaller side, loop on the bigger one -> recursion depth stays O(log n)
+        int leftCount = j;
+        int rightCount = count - j - 1;
+        if (leftCount < rightCount) {
+            if (!introSort(items, leftCount, depthLimit, less, context)) return false;
+            items += j + 1;
+            count = rightCount;
+        } else {
+            if (!introSort(items + j + 1, rightCount, depthLimit, less, context)) return false;
+            count = leftCount;
+        }
+    }
+    return insertionSort(items, count, less, context);
+}
+
+// sorts the array using less() to compare. Returns false if less() failed, the array is partly sorted then.
+bool arraySort(ObjArray* array, ArrayLessFn less, void* context) {
+    if (array->count < 2) return true;
+    Value* items = continuousItems(array);
+    int depthLimit = 0;
+    for (int n = array->count; n > 1; n >>= 1) depthLimit += 2;
+    return introSort(items, array->count, depthLimit, less, context);
+}
+
+static bool lessNumber(void* context, Value a, Value b, bool* isLess) {
+    (void)context;
+    *isLess = AS_NUMBER(a) < AS_NUMBER(b);
+    return true;
+}
+
+// strings get ordered bytewise, on equal prefix the shorter string comes first
+static bool lessString(void* context, Value a, Value b, bool* isLess) {
+    (void)context;
+    ObjString* left = AS_STRING(a);
+    ObjString* right = AS_STRING(b);
+    int minLength = left->length < right->length ? left->length : right->length;
+    int cmp = memcmp(left->chars, right->chars, minLength);
+    *isLess = cmp < 0 || (cmp == 0 && left->length < right->length);
+    return true;
+}
+
+// helper for radixSortNumbers() - maps a double to an uint64_t that sorts the same way as unsigned int
+// - positive: flip the sign bit so they come after the negatives
+// - negative: flip all bits so bigger magnitudes come first
+static uint64_t numberToKey(double number) {
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    return (bits >> 63) ? ~bits : bits | ((uint64_t)1 << 63);
+}
+
+static double keyToNumber(uint64_t key) {
+    uint64_t bits = (key >> 63) ? key & ~((uint64_t)1 << 63) : ~key;
+    double number;
+    memcpy(&number, &bits, sizeof(number));
+    return number;
+}
+
+// LSD radix sort over the 8 bytes of the keys. All 8 histograms get counted in a single pass.
+static void radixSortNumbers(Value* items, int count) {
+    uint64_t* keys = ALLOCATE(uint64_t, count);
+    uint64_t* buffer = ALLOCATE(uint64_t, count);
+    int histograms[8][256];
+    memset(histograms, 0, sizeof(histograms));
+    for (int i = 0; i < count; i++) {
+        keys[i] = numberToKey(AS_NUMBER(items[i]));
+        for (int byte = 0; byte < 8; byte++) {
+            histograms[byte][(keys[i] >> (byte * 8)) & 0xff]++;
+        }
+    }
+    for (int byte = 0; byte < 8; byte++) {
+        int* counts = histograms[byte];
+        int shift = byte * 8;
+        // all keys share this byte -> the pass would not move anything (ex. the high bytes of small integers)
+        if (counts[(keys[0] >> shift) & 0xff] == count) continue;
+        int offset = 0;
+        for (int digit = 0; digit < 256; digit++) {
+            int digitCount = counts[digit];
+            counts[digit] = offset;
+            offset += digitCount;
+        }
+        for (int i = 0; i < count; i++) {
+            buffer[counts[(keys[i] >> shift) & 0xff]++] = keys[i];
+        }
+        uint64_t* temp = keys;
+        keys = buffer;
+        buffer = temp;
+    }
+    for (int i = 0; i < count; i++) {
+        items[i] = NUMBER_VAL(keyToNumber(keys[i]));
+    }
+    FREE_ARRAY(uint64_t, keys, count);
+    FREE_ARRAY(uint64_t, buffer, count);
+}
+
+// sorts arrays of only numbers (ascending) or only strings (bytewise).
+// - returns false (and does not touch the array) for any other mix of types
+bool arraySortDefault(ObjArray* array) {
+    if (array->count < 2) return true;
+    bool allNumbers = true;
+    bool allStrings = true;
+    for (int i = 0; i < array->count; i++) {
+        Value value = ARRAY_SLOT(array, i);
+        allNumbers = allNumbers && IS_NUMBER(value);
+        allStrings = allStrings && IS_STRING(value);
+    }
+    if (!allNumbers && !allStrings) return false;
+
+    if (allStrings) return arraySort(array, lessString, NULL);
+    if (array->count >= RADIX_SORT_MIN) {
+        radixSortNumbers(continuousItems(array), array->count);
+        return true;
+    }
+    return arraySort(array, lessNumber, NULL);
+}
@@ -5,11 +5,31 @@
 #include "value.h"
 #include "object.h"
 
+// maps an index of the array to its slot in the ring buffer. (capacity is always a power of 2 -> mask instead of modulo)
+#define ARRAY_SLOT(array, index) \
+    ((array)->items[((array)->head + (index)) & ((array)->capacity - 1)])
+
+#define ARRAY_MAX_COUNT (1 << 28)       // biggest array that array(n, init) will create
+
+// compare function for arraySort(): sets isLess if a belongs in front of b. Returns false on error (that aborts the sort)
+typedef bool (*ArrayLessFn)(void* context, Value a, Value b, bool* isLess);
+
 void arrayAppendAtEnd(ObjArray* array, Value value);
+void arrayPrepend(ObjArray* array, Value value);
+void arrayInsertAt(ObjArray* array, int index, Value value);
 void arrayWriteTo(ObjArray* array, int index, Value value);
-Value arrayReadFromIdx (ObjArray* array, int index); 
+Value arrayReadFromIdx (ObjArray* array, int index);
 void arrayDeleteFrom(ObjArray* array, int index);
+Value arrayShift(ObjArray* array);
 bool arrayIsValidIndex(ObjArray* array, int index);
 int arrayGetLength(ObjArray* array);
+ObjArray* arraySlice(ObjArray* array, int start, int end);
+void arrayReleaseStore(ObjArray* array);
+ObjArray* arrayCreate(int count, Value init);
+void arrayReverse(ObjArray* array);
+void arrayFill(ObjArray* array, Value value);
+int arrayIndexOf(ObjArray* array, Value value);
+bool arraySort(ObjArray* array, ArrayLessFn less, void* context);
+bool arraySortDefault(ObjArray* array);
 
 #endif
\ No newline at end of file
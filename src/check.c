@@ -0,0 +1,152 @@
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "compiler.h"
+#include "memory.h"
+#include "module.h"
+#include "vm.h"
+
+// the scripts to check, in the order the threads take them
+typedef struct {
+    char** paths;
+    int count;
+    int capacity;
+    atomic_int next;            // the next script a thread takes
+    atomic_int failed;          // scripts that could not be read or did not compile
+    atomic_int unreadable;      // ... of those the ones that could not be read
+} ScriptList;
+
+// one thread of checkScripts()
+typedef struct {
+    pthread_t thread;
+    ScriptList* scripts;
+    Heap heap;
+} Checker;
+
+// helper for findScripts() - adds a copy of path to the list
+static void addScript(ScriptList* scripts, const char* path) {
+    if (scripts->count == scripts->capacity) {
+        scripts->capacity = scripts->capacity < 8 ? 8 : scripts->capacity * 2;
+        scripts->paths = realloc(scripts->paths, sizeof(char*) * scripts->capacity);
+        if (scripts->paths == NULL) exit(1);
+    }
+    scripts->paths[scripts->count] = strdup(path);
+    if (scripts->paths[scripts->count] == NULL) exit(1);
+    scripts->count++;
+}
+
+// helper for findScripts() - true if path ends with ".lox"
+static bool isScript(const char* path) {
+    size_t length = strlen(path);
+    return length >= 4 && strcmp(path + length - 4, ".lox") == 0;
+}
+
+// collects the .lox files in the directory at path and all directories below it (or path itself if it is a file)
+// - false if path does not exist
+static bool findScripts(ScriptList* scripts, const char* path) {
+    struct stat info;
+    if (stat(path, &info) != 0) return false;
+    if (!S_ISDIR(info.st_mode)) {
+        addScript(scripts, path);
+        return true;
+    }
+    DIR* directory = opendir(path);
+    if (directory == NULL) return false;
+    struct dirent* entry;
+    while ((entry = readdir(directory)) != NULL) {
+        if (entry->d_name[0] == '.') continue;      // ".", ".." and hidden files
+        char child[PATH_MAX];
+        const char* separator = path[strlen(path) - 1] == '/' ? "" : "/";
+        if (snprintf(child, sizeof(child), "%s%s%s", path, separator, entry->d_name) >= (int)sizeof(child)) continue;
+        if (stat(child, &info) != 0) continue;
+        if (S_ISDIR(info.st_mode)) {
+            findScripts(scripts, child);
+        } else if (isScript(child)) {
+            addScript(scripts, child);
+        }
+    }
+    closedir(directory);
+    return true;
+}
+
+// helper for qsort() in checkScripts()
+static int comparePaths(const void* a, const void* b) {
+    return strcmp(*(const char**)a, *(const char**)b);
+}
+
+// a thread of checkScripts() - keeps taking the next script till there are none left. Everything it compiles lives on its heap
+static void* runChecker(void* argument) {
+    Checker* checker = (Checker*)argument;
+    ScriptList* scripts = checker->scripts;
+    useHeap(&checker->heap);
+    for (;;) {
+        int i = atomic_fetch_add(&scripts->next, 1);
+        if (i >= scripts->count) break;
+        size_t length;
+        bool mapped;
+        char* source = readSource(scripts->paths[i], &length, &mapped);
+        if (source == NULL) {
+            fprintf(stderr, "Could not open file \"%s\".\n", scripts->paths[i]);
+            atomic_fetch_add(&scripts->failed, 1);
+            atomic_fetch_add(&scripts->unreadable, 1);
+            continue;
+        }
+        if (compileScript(source, length, scripts->paths[i]) == NULL) atomic_fetch_add(&scripts->failed, 1);
+        freeSource(source, length, mapped);
+    }
+    useHeap(NULL);
+    return NULL;
+}
+
+// --check path: compiles all scripts in path at once, one thread per core. Returns the exit code:
+// 0 if all of them compiled, 65 if some had compile errors, 74 if some could not be read (or path does not exist)
+int checkScripts(const char* path) {
+    ScriptList scripts = {0};
+    if (!findScripts(&scripts, path)) {
+        fprintf(stderr, "Could not open \"%s\".\n", path);
+        return 74;
+    }
+    qsort(scripts.paths, scripts.count, sizeof(char*), comparePaths);
+    atomic_init(&scripts.next, 0);
+    atomic_init(&scripts.failed, 0);
+    atomic_init(&scripts.unreadable, 0);
+    FLAG_LAZY = false;          // checking means compiling every function body
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int threadCount = cores < 1 ? 1 : (int)cores;
+    if (threadCount > scripts.count) threadCount = scripts.count > 0 ? scripts.count : 1;
+    Checker* checkers = calloc(threadCount, sizeof(Checker));
+    if (checkers == NULL) exit(1);
+    int started = 0;
+    for (int i = 0; i < threadCount; i++) {
+        checkers[i].scripts = &scripts;
+        initHeap(&checkers[i].heap);
+        if (pthread_create(&checkers[i].thread, NULL, runChecker, &checkers[i]) != 0) break;
+        started++;
+    }
+    if (started == 0) {         // no threads to be had -> this thread checks them all on its own
+        runChecker(&checkers[0]);
+        started = 1;
+    } else {
+        for (int i = 0; i < started; i++) pthread_join(checkers[i].thread, NULL);
+    }
+
+    // what they compiled becomes the vm's (nothing holds on to it, so the next gc frees it again)
+    for (int i = 0; i < started; i++) mergeHeap(&checkers[i].heap);
+
+    int failed = atomic_load(&scripts.failed);
+    printf("checked %d scripts on %d threads: %d compiled, %d failed\n", scripts.count, started, scripts.count - failed, failed);
+    for (int i = 0; i < scripts.count; i++) free(scripts.paths[i]);
+    free(scripts.paths);
+    free(checkers);
+    if (atomic_load(&scripts.unreadable) > 0) return 74;
+    return failed > 0 ? 65 : 0;
+}
@@ -0,0 +1,13 @@
+#ifndef clox_check_h
+#define clox_check_h
+
+/*
+    --check path: compiles every .lox script in path (a directory, searched recursively, or a single script) without
+    running any of them. Reports the compile errors of every script, prefixed with its path.
+    - the scripts get compiled on all cores at once. Each thread compiles on a heap of its own (see useHeap()),
+      when all are done those get merged into the vm (see mergeHeap()).
+*/
+
+int checkScripts(const char* path);
+
+#endif
@@ -1,6 +1,9 @@
+#include <limits.h>
 #include <stdlib.h>
+#include <string.h>
 #include "chunk.h"
 #include "memory.h"
+#include "object.h"
 #include "vm.h"
 
 // initialize a new Chunk. with Default size 0 /empty
@@ -9,35 +12,388 @@ void initChunk(Chunk* chunk) {
     chunk->capacity = 0;
     chunk->code = NULL;    
     chunk->lines = NULL;
+    chunk->lineCount = 0;
+    chunk->lineCapacity = 0;
+    chunk->lastOffset = 0;
+    chunk->lastLine = 0;
+    chunk->lastColumn = 0;
+    chunk->inlined = NULL;
+    chunk->inlinedCount = 0;
+    chunk->inlinedCapacity = 0;
+    chunk->constantIndex = NULL;
+    chunk->constantIndexCapacity = 0;
+    chunk->mapped = false;
+    chunk->frozen = false;
     initValueArray(&chunk->constants);
 }
 
 // reset the Chunk to its default state of 0 length 
 // and deallocate all its previously used space
 void freeChunk(Chunk* chunk) {
-    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);  // We deallocate all of the memory
-    FREE_ARRAY(int, chunk->lines, chunk->capacity);     // free our lines array
+    if (chunk->frozen) {
+        FREE_ARRAY(uint8_t, chunk->code, chunk->capacity + chunk->lineCapacity);    // lines live in the same block
+    } else if (!chunk->mapped) {
+        FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);  // We deallocate all of the memory
+        FREE_ARRAY(uint8_t, chunk->lines, chunk->lineCapacity);    // free our line table
+    }
+    FREE_ARRAY(InlinedCall, chunk->inlined, chunk->inlinedCapacity);
+    freeConstantIndex(chunk);
     freeValueArray(&chunk->constants);  // we also free our custom pool of constants.
     initChunk(chunk);   // and then zero out the fields -> leaving the chunk in a reset "empty-state"
 }
 
+// the compiler finished the chunk: code and line table move into one block of exactly their size, the constants and
+// inlined calls shrink to fit. Growing by doubling leaves up to half of each array unused otherwise.
+// - nothing may write to a frozen chunk anymore (quickening only rewrites instructions in place, that is fine)
+void freezeChunk(Chunk* chunk) {
+    if (chunk->mapped || chunk->frozen || chunk->count == 0) return;
+    uint8_t* segment = ALLOCATE(uint8_t, chunk->count + chunk->lineCount);
+    memcpy(segment, chunk->code, chunk->count);
+    memcpy(segment + chunk->count, chunk->lines, chunk->lineCount);
+    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+    FREE_ARRAY(uint8_t, chunk->lines, chunk->lineCapacity);
+    chunk->code = segment;
+    chunk->capacity = chunk->count;
+    chunk->lines = segment + chunk->count;
+    chunk->lineCapacity = chunk->lineCount;
+    chunk->frozen = true;
+
+    ValueArray* constants = &chunk->constants;
+    constants->values = GROW_ARRAY(Value, constants->values, constants->capacity, constants->count);
+    constants->capacity = constants->count;
+    chunk->inlined = GROW_ARRAY(InlinedCall, chunk->inlined, chunk->inlinedCapacity, chunk->inlinedCount);
+    chunk->inlinedCapacity = chunk->inlinedCount;
+}
+
 // if we have capacity (pre-allocated space) left we write to it, if not we reallocate with a bigger capacity
-void writeChunk(Chunk* chunk, uint8_t byte, int line) {
+void writeChunk(Chunk* chunk, uint8_t byte, int line, int column) {
     if (chunk->capacity < chunk->count + 1) {
         int oldCapacity = chunk->capacity;
         chunk->capacity = GROW_CAPACITY(oldCapacity);
         chunk->code = GROW_ARRAY(uint8_t, chunk->code, oldCapacity, chunk->capacity);
-        chunk->lines = GROW_ARRAY(int, chunk->lines, oldCapacity, chunk->capacity);
     }
+    setLine(chunk, chunk->count, line, column);
     chunk->code[chunk->count] = byte;
-    chunk->lines[chunk->count] = line;
     chunk->count++;
 }
 
+/*
+*
+*       The line table
+*
+*/
+
+// helper for writeVarint()
+static void writeLineByte(Chunk* chunk, uint8_t byte) {
+    if (chunk->lineCapacity < chunk->lineCount + 1) {
+        int oldCapacity = chunk->lineCapacity;
+        chunk->lineCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->lines = GROW_ARRAY(uint8_t, chunk->lines, oldCapacity, chunk->lineCapacity);
+    }
+    chunk->lines[chunk->lineCount++] = byte;
+}
+
+// writes 7 bits per byte, the highest bit is set if more follow. (so most values take a single byte)
+static void writeVarint(Chunk* chunk, unsigned int value) {
+    while (value >= 0x80) {
+        writeLineByte(chunk, (value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    writeLineByte(chunk, value);
+}
+
+static unsigned int readVarint(Chunk* chunk, int* at) {
+    unsigned int value = 0;
+    int shift = 0;
+    uint8_t byte;
+    do {
+        byte = chunk->lines[(*at)++];
+        value |= (unsigned int)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return value;
+}
+
+// the code from offset on came from line and column. Offsets have to go up from call to call.
+// - consecutive bytes from the same token (an instruction and its operands) share one entry
+// - lines can go down aswell (ex. inlined code) so we store the change zigzag encoded: 0, -1, 1, -2... -> 0, 1, 2, 3...
+void setLine(Chunk* chunk, int offset, int line, int column) {
+    if (chunk->lineCount > 0 && line == chunk->lastLine && column == chunk->lastColumn) return;
+    int delta = line - chunk->lastLine;
+    writeVarint(chunk, offset - chunk->lastOffset);
+    writeVarint(chunk, ((unsigned int)delta << 1) ^ (unsigned int)(delta >> 31));
+    writeVarint(chunk, column);
+    chunk->lastOffset = offset;
+    chunk->lastLine = line;
+    chunk->lastColumn = column;
+}
+
+// drops the line table (the optimizer writes a new one for the code it encodes)
+void resetLines(Chunk* chunk) {
+    chunk->lineCount = 0;
+    chunk->lastOffset = 0;
+    chunk->lastLine = 0;
+    chunk->lastColumn = 0;
+}
+
+// helper for the LineReader - decodes the entry after the current one
+static void readNextEntry(LineReader* reader) {
+    if (reader->at >= reader->chunk->lineCount) {
+        reader->nextOffset = INT_MAX;
+        return;
+    }
+    reader->nextOffset += readVarint(reader->chunk, &reader->at);
+    unsigned int delta = readVarint(reader->chunk, &reader->at);
+    reader->nextLine += (int)(delta >> 1) ^ -(int)(delta & 1);
+    reader->nextColumn = readVarint(reader->chunk, &reader->at);
+}
+
+void initLineReader(LineReader* reader, Chunk* chunk) {
+    reader->chunk = chunk;
+    reader->at = 0;
+    reader->line = 0;
+    reader->column = 0;
+    reader->nextOffset = 0;
+    reader->nextLine = 0;
+    reader->nextColumn = 0;
+    readNextEntry(reader);
+}
+
+// moves the reader to the entry that offset falls into -> reader->line and reader->column
+void readLine(LineReader* reader, int offset) {
+    while (offset >= reader->nextOffset) {
+        reader->line = reader->nextLine;
+        reader->column = reader->nextColumn;
+        readNextEntry(reader);
+    }
+}
+
+int getLine(Chunk* chunk, int offset) {
+    LineReader reader;
+    initLineReader(&reader, chunk);
+    readLine(&reader, offset);
+    return reader.line;
+}
+
+int getColumn(Chunk* chunk, int offset) {
+    LineReader reader;
+    initLineReader(&reader, chunk);
+    readLine(&reader, offset);
+    return reader.column;
+}
+
 // convenient function to add a new constant to the constants-pool
 int addConstant(Chunk* chunk, Value value) {
-    push(value);                        // push it to the stack to make it save from GC removing it
+    pushRoot(value);                    // push it to the stack to make it save from GC removing it
     writeValueArray(&chunk->constants, value);
-    pop();                              // we only pushed it on the stack for GC savety so we pop it again
+    popRoot();                          // we only pushed it on the stack for GC savety so we pop it again
     return chunk->constants.count - 1;  // returns idx to current last element
 }
+
+// helper for internConstant() - two constants are the same if numbers have the same bits (so 0 and -0 stay apart) or objects
+// are the same object (strings are interned, so equal strings are the same object)
+static bool sameConstant(Value a, Value b) {
+    if (a.type != b.type) return false;
+    switch (a.type) {
+        case VAL_NUMBER: return memcmp(&a.as.number, &b.as.number, sizeof(double)) == 0;
+        case VAL_OBJ:    return AS_OBJ(a) == AS_OBJ(b);
+        case VAL_BOOL:   return AS_BOOL(a) == AS_BOOL(b);
+        default:         return true;
+    }
+}
+
+// helper for internConstant()
+static uint32_t hashConstant(Value value) {
+    uint64_t bits = 0;
+    if (IS_NUMBER(value)) memcpy(&bits, &value.as.number, sizeof(double));
+    else if (IS_OBJ(value)) bits = (uint64_t)(uintptr_t)AS_OBJ(value);
+    else if (IS_BOOL(value)) bits = AS_BOOL(value);
+    bits ^= bits >> 33;                 // mix the bits, pointers and small numbers only differ in a few of them
+    bits *= 0xff51afd7ed558ccdULL;
+    bits ^= bits >> 33;
+    return (uint32_t)bits ^ value.type;
+}
+
+// helper for internConstant() - the bucket that holds value or the empty one it would go into
+static int* findConstantBucket(Chunk* chunk, Value value) {
+    uint32_t index = hashConstant(value) & (chunk->constantIndexCapacity - 1);
+    for (;;) {
+        int* bucket = &chunk->constantIndex[index];
+        if (*bucket == -1 || sameConstant(chunk->constants.values[*bucket], value)) return bucket;
+        index = (index + 1) & (chunk->constantIndexCapacity - 1);
+    }
+}
+
+// like addConstant() but reuses the constant if the chunk already has it. (ex. a global that gets mentioned 200 times takes one slot)
+int internConstant(Chunk* chunk, Value value) {
+    if (chunk->constantIndexCapacity > 0) {
+        int* bucket = findConstantBucket(chunk, value);
+        if (*bucket != -1) return *bucket;
+    }
+    int constant = addConstant(chunk, value);
+    // keep the index at most 3/4 full, when growing it we just index all constants again
+    if ((chunk->constants.count) * 4 > chunk->constantIndexCapacity * 3) {
+        FREE_ARRAY(int, chunk->constantIndex, chunk->constantIndexCapacity);
+        chunk->constantIndexCapacity = chunk->constantIndexCapacity < 16 ? 16 : chunk->constantIndexCapacity * 2;
+        // an index that got freed (capacity 0) has to hold all constants the chunk already has
+        while (chunk->constants.count * 4 > chunk->constantIndexCapacity * 3) chunk->constantIndexCapacity *= 2;
+        chunk->constantIndex = ALLOCATE(int, chunk->constantIndexCapacity);
+        for (int i = 0; i < chunk->constantIndexCapacity; i++) chunk->constantIndex[i] = -1;
+        for (int i = 0; i < chunk->constants.count; i++) {
+            int* bucket = findConstantBucket(chunk, chunk->constants.values[i]);
+            if (*bucket == -1) *bucket = i;
+        }
+    } else {
+        *findConstantBucket(chunk, value) = constant;
+    }
+    return constant;
+}
+
+// takes back the last constant (ex. the constant folding does not need its operands anymore)
+void removeLastConstant(Chunk* chunk) {
+    chunk->constants.count--;
+    if (chunk->constantIndexCapacity == 0) return;
+    int* bucket = findConstantBucket(chunk, chunk->constants.values[chunk->constants.count]);
+    if (*bucket != chunk->constants.count) return;
+    *bucket = -1;
+    // the constants after it in the same run of buckets might have probed past it, so we insert them again
+    int index = (int)(bucket - chunk->constantIndex);
+    for (;;) {
+        index = (index + 1) & (chunk->constantIndexCapacity - 1);
+        int constant = chunk->constantIndex[index];
+        if (constant == -1) break;
+        chunk->constantIndex[index] = -1;
+        *findConstantBucket(chunk, chunk->constants.values[constant]) = constant;
+    }
+}
+
+void freeConstantIndex(Chunk* chunk) {
+    FREE_ARRAY(int, chunk->constantIndex, chunk->constantIndexCapacity);
+    chunk->constantIndex = NULL;
+    chunk->constantIndexCapacity = 0;
+}
+
+// records that the code in [start, end) got inlined from the function name, called at line
+void addInlinedCall(Chunk* chunk, int start, int end, int line, ObjString* name) {
+    if (chunk->inlinedCapacity < chunk->inlinedCount + 1) {
+        int oldCapacity = chunk->inlinedCapacity;
+        chunk->inlinedCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->inlined = GROW_ARRAY(InlinedCall, chunk->inlined, oldCapacity, chunk->inlinedCapacity);
+    }
+    chunk->inlined[chunk->inlinedCount++] = (InlinedCall){start, end, line, name};
+}
+
+// the inlined call the instruction at offset belongs to (NULL if none). Only runtime errors look this up.
+InlinedCall* findInlinedCall(Chunk* chunk, int offset) {
+    for (int i = 0; i < chunk->inlinedCount; i++) {
+        InlinedCall* inlined = &chunk->inlined[i];
+        if (offset < inlined->start) break;
+        if (offset < inlined->end) return inlined;
+    }
+    return NULL;
+}
+
+// byte offset the jump instruction (OP_JUMP, OP_LOOP, OP_JUMP_IF_...) at offset lands on
+int jumpDestination(Chunk* chunk, int offset) {
+    int jump = (chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+    return chunk->code[offset] == OP_LOOP ? offset + 3 - jump : offset + 3 + jump;
+}
+
+// how many bytes the instruction at offset takes up (opcode + its operands)
+int instructionLength(Chunk* chunk, int offset) {
+    switch (chunk->code[offset]) {
+        case OP_CONSTANT:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_SET_LOCAL_POP:
+        case OP_POP_BELOW:
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_GET_PROPERTY:
+        case OP_GET_FIELD:
+        case OP_SET_PROPERTY:
+        case OP_CLASS:
+        case OP_GET_SUPER:
+        case OP_METHOD:
+        case OP_ARRAY_BUILD:
+        case OP_MAP_BUILD:
+        case OP_IMPORT:
+            return 2;
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_LOOP:
+        case OP_INVOKE:
+        case OP_SUPER_INVOKE:
+            return 3;
+        case OP_CLOSURE: {
+            // followed by the function-constant, then 2 bytes (isLocal, index) for each upvalue
+            ObjFunction* function = AS_FUNCTION(chunk->constants.values[chunk->code[offset + 1]]);
+            return 2 + 2 * function->upvalueCount;
+        }
+        default:
+            return 1;
+    }
+}
+
+// how many values the instruction at offset leaves on the stack compared to before it ran (the depth of the stack after it - before it)
+int stackEffect(Chunk* chunk, int offset) {
+    uint8_t* code = &chunk->code[offset];
+    switch (code[0]) {
+        case OP_CONSTANT:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_GET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_CLOSURE:
+        case OP_CLASS:
+            return 1;
+        case OP_POP:
+        case OP_SET_LOCAL_POP:
+        case OP_DEFINE_GLOBAL:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_ADD_NUM_NUM:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_MODULO:
+        case OP_PRINT:
+        case OP_CLOSE_UPVALUE:
+        case OP_SET_PROPERTY:
+        case OP_INHERIT:
+        case OP_GET_SUPER:
+        case OP_METHOD:
+        case OP_LISTS_READ_IDX:
+        case OP_INDEX_ARRAY_NUM:
+        case OP_INDEX_MAP_STR:
+            return -1;
+        case OP_LISTS_WRITE_IDX:
+        case OP_STORE_ARRAY_NUM:
+        case OP_STORE_MAP_STR:
+            return -2;
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_POP_BELOW:
+            return -code[1];
+        case OP_INVOKE:
+            return -code[2];
+        case OP_SUPER_INVOKE:
+            return -code[2] - 1;                // the superclass gets popped aswell
+        case OP_ARRAY_BUILD:
+            return 1 - code[1];
+        case OP_MAP_BUILD:
+            return 1 - 2 * code[1];
+        default:
+            return 0;       // jumps, returns and everything that replaces the value on top (OP_SET_LOCAL, OP_NOT, OP_GET_PROPERTY...)
+    }
+}
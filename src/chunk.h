@@ -46,6 +46,7 @@ typedef enum {
     OP_JUMP_IF_FALSE,   // used to skipp execution of the statement, for ex:  "if(expr) statement"
     OP_LOOP,            // unconditionally jumps back to the 16-bit offset that follows in 2 8bit chunks afterwards
     OP_CALL,            // a function call
+    OP_TAIL_CALL,       // a function call in tail position "return f(x);" -> reuses the CallFrame of the current function
     OP_INVOKE,          // method call - get their own OpCode for optimisation (since they happen often and need to be fast)
     OP_CLOSURE,         // each OP_CLOSURE is followed by the series of bytes that specify the upvalues the ObjClosure should own.
     OP_CLOSE_UPVALUE,   // (when local goes out of scope and an upvalue still needs it) it takes ownership of it (the value on the stack)
@@ -65,22 +66,82 @@ typedef enum {
     OP_LISTS_WRITE_IDX,     // takes operand [array, idx, value]
     OP_MODULO,          // binary-operation: % Modulo (divies and takes leftovers)
     OP_MAP_BUILD,       // takes operand [count, key1, val1, ...keyN, vallN, map] to initialize a Map
+    OP_IMPORT,          // 'import "path";' - runs the module (the first time) and copies its globals into ours. Operand: the path constant
+    /* only emitted by the optimizer (peephole pass) */
+    OP_JUMP_IF_TRUE,    // like OP_JUMP_IF_FALSE but jumps if the value on the stack is truthy. replaces "OP_NOT, OP_JUMP_IF_FALSE"
+    OP_SET_LOCAL_POP,   // writes the top of the stack to the local-variable and pops it. replaces "OP_SET_LOCAL, OP_POP"
+    OP_POP_BELOW,       // removes the n values below the top of the stack. Ends an inlined call: [callee, args..., result] -> [result]
+    /* quickened instructions: the vm rewrites the generic instruction into these at runtime, once it saw the operand types */
+    OP_ADD_NUM_NUM,     // OP_ADD of two numbers
+    OP_INDEX_ARRAY_NUM, // OP_LISTS_READ_IDX of an array with a number
+    OP_INDEX_MAP_STR,   // OP_LISTS_READ_IDX of a map with a string
+    OP_STORE_ARRAY_NUM, // OP_LISTS_WRITE_IDX into an array with a number
+    OP_STORE_MAP_STR,   // OP_LISTS_WRITE_IDX into a map with a string
+    OP_GET_FIELD,       // OP_GET_PROPERTY that found a field (not a method) on an instance
 
 } OpCode;
 
+// code the optimizer inlined from another function. Runtime errors in [start, end) still show a frame for that function.
+typedef struct {
+    int start;
+    int end;
+    int line;                   // line of the call that got replaced
+    ObjString* name;            // name of the inlined function
+} InlinedCall;
+
 // holds the instructions (dynamic-array of bytes)
 typedef struct {
     int count; 
     int capacity;
     uint8_t* code;              // stores op_codes in an array
-    int* lines;                 // add info about original line-nr for debugging/for each op_code
+    // where in the source the code came from (for runtime errors and the disassembler). Run-length encoded: a new entry only
+    // when line or column change, each is 3 varints: bytes since the last entry, change of line, column. (see setLine())
+    uint8_t* lines;
+    int lineCount;              // bytes used in lines
+    int lineCapacity;
+    int lastOffset;             // the last entry, the next one is relative to it
+    int lastLine;
+    int lastColumn;
     ValueArray constants;       // each chunk of bytecod instructions gets data attached of used static constats etc... (x=4;)
+    int* constantIndex;         // hash index into constants (-1 = empty bucket), so the compiler can reuse them. Freed once its done
+    int constantIndexCapacity;
+    bool mapped;                // code and lines point into a mapped .loxc image (see image.c), not ours to free
+    bool frozen;                // the compiler is done: code and lines share one block of exactly their size (see freezeChunk())
+    InlinedCall* inlined;       // sorted by start
+    int inlinedCount;
+    int inlinedCapacity;
 } Chunk;
 
+// reads the line table of a chunk front to back. Cheaper than getLine() for every instruction when walking over all the code
+typedef struct {
+    Chunk* chunk;
+    int at;                     // next byte in chunk->lines
+    int line;                   // the entry the last offset we read fell into
+    int column;
+    int nextOffset;             // where the entry after it starts (INT_MAX if there is none)
+    int nextLine;
+    int nextColumn;
+} LineReader;
+
 void initChunk(Chunk* chunk);
 void freeChunk(Chunk* chunk);
-void writeChunk(Chunk* chunk, uint8_t byte, int line);
+void freezeChunk(Chunk* chunk);
+void writeChunk(Chunk* chunk, uint8_t byte, int line, int column);
+void setLine(Chunk* chunk, int offset, int line, int column);
+void resetLines(Chunk* chunk);
+void initLineReader(LineReader* reader, Chunk* chunk);
+void readLine(LineReader* reader, int offset);
+int getLine(Chunk* chunk, int offset);
+int getColumn(Chunk* chunk, int offset);
 int addConstant(Chunk* chunk, Value value);
+int internConstant(Chunk* chunk, Value value);
+void removeLastConstant(Chunk* chunk);
+void freeConstantIndex(Chunk* chunk);
+int instructionLength(Chunk* chunk, int offset);
+int jumpDestination(Chunk* chunk, int offset);
+int stackEffect(Chunk* chunk, int offset);
+void addInlinedCall(Chunk* chunk, int start, int end, int line, ObjString* name);
+InlinedCall* findInlinedCall(Chunk* chunk, int offset);
 
 #endif
 
@@ -5,6 +5,8 @@
 #include "common.h"
 #include "compiler.h"
 #include "memory.h"
+#include "optimizer.h"
+#include "register.h"
 #include "scanner.h"
 
 #ifdef DEBUG_PRINT_CODE
@@ -23,6 +25,7 @@ statement       -> exprStmt
                 | ifStmt
                 | printStmt
                 | returnStmt
+                | importStmt
                 | whileStmt
                 | block;
 
@@ -39,14 +42,8 @@ declaration     -> classDecl
 */
 
 
-// State of our Parser. We only know about the current and previous Token for context.
-typedef struct {
-    Token current;
-    Token previous;
-    
-    bool hadError;      // Flag that gets set after parser ran into an error (but we still continue by parsing afterwards)
-    bool panicMode;     // Flag helps avoid spewing out 100s of cascading errors, after encountering a first error.
-} Parser;
+// State of one compile, see struct Parser below. Every ParseFn and helper gets it passed in (nothing global)
+typedef struct Parser Parser;
 
 // First has highest Precedence -> it gets executed first
 typedef enum {
@@ -67,7 +64,7 @@ typedef enum {
 
 // used in ParseRule - simple typedef for a function type that takes no arguments and returns nothing.
 // used to map TOKEN_ADDITION -> ParseFn implemention for addition.
-typedef void (*ParseFn) (bool canAssign);
+typedef void (*ParseFn) (Parser* parser, bool canAssign);
 
 // Parse Rules Map from the Token to rules that hold precedence(priority) and functions that execute before and after the Token
 typedef struct {
@@ -81,6 +78,8 @@ typedef struct {
     Token name;
     int depth;
     bool isCaptured;            // take notice when we need to enclose it when leaving scope (Upvalue took reference to it)
+    bool isAssigned;            // something besides its declaration writes to it
+    ObjFunction* function;      // set for "fun square(x) {...}" in a local scope -> calls to it might get inlined
 } Local;
 
 // We use Upvalues to resolve in Closures captured outer Variables and reslove them to the memory where the actual x=1 is stored.
@@ -107,6 +106,21 @@ typedef struct Compiler {
     int localCount;             // current count
     Upvalue upvalues[UINT8_COUNT];  // array that stores Upvalues (we use them to link enclosed variables in Closures to the actual memory used)
     int scopeDepth;             // how many {} deep are we
+
+    // for constant folding:
+    int exprStart;              // code offset where the left operand of the infix-expression currently getting parsed starts
+    int numericEnd;             // code offset right after the last instruction that surely left a number on the stack (-1 if none)
+    int callEnd;                // code offset right after the last OP_CALL (-1 if none) -> "return f(x);" becomes a tail call
+    int constantAddedAt[UINT8_COUNT];   // code offset where each constant got added. Folding only releases constants no earlier code reuses
+
+    // for inlining:
+    int localGetEnd;            // code offset right after the last OP_GET_LOCAL (-1 if none)
+    int localGet;               // the local it read
+    InlineSite inlineSites[UINT8_COUNT];    // calls of local functions (function NULL once we know the local did not always hold it)
+    int inlineLocals[UINT8_COUNT];          // for each site: the local it calls, till that goes out of scope (-1 after)
+    int inlineSiteCount;
+
+    LazyFunction* lazy;         // set while compiling the body of a lazy function (--lazy): its enclosing compilers are long gone
 } Compiler;
 
 // we need knowledge (at compile time) about nearest enclosing class. this struct provides that
@@ -115,16 +129,29 @@ typedef struct ClassCompiler {
     bool hasSuperclass;                 // if we deal with a superclass (inherit from another class) -> we need a local scope -> we have to clean that up
 } ClassCompiler;
 
-// global Parser instance we can pass arround
-Parser parser;
-// global Compiler instance - used to keep track where on the stack local variables are currently
-Compiler* current = NULL;
-// global ClassCompiler Instance - we need knowledge (at compile time) about nearest enclosing class. this provides
-ClassCompiler* currentClass = NULL;
+// --lazy: fun declarations only get skipped over, their bodies get compiled on the first call (see compileLazy())
+bool FLAG_LAZY = false;
+
+// State of our Parser. We only know about the current and previous Token for context.
+// - holds everything one compile needs, so several threads can compile at once (--check), each with its own Parser
+struct Parser {
+    Scanner scanner;
+    Token current;
+    Token previous;
+
+    bool hadError;      // Flag that gets set after parser ran into an error (but we still continue by parsing afterwards)
+    bool panicMode;     // Flag helps avoid spewing out 100s of cascading errors, after encountering a first error.
+    const char* path;   // script the errors get reported for (NULL -> errors only show the line)
+    bool quiet;         // errors only set hadError, they dont get printed (compileQuietly())
+
+    Compiler* compiler;             // used to keep track where on the stack local variables are currently (innermost function)
+    ClassCompiler* currentClass;    // we need knowledge (at compile time) about nearest enclosing class. this provides
+    Arena arena;                    // the work arrays of optimizeFunction() and compileRegisters(), freed after each function
+};
 
 // emits the chunk we compiled our bytecode-instructions to. (so basically all instructions we just 'compiled')
-static Chunk* currentChunk() {
-    return &current->function->chunk;
+static Chunk* currentChunk(Parser* parser) {
+    return &parser->compiler->function->chunk;
 }
 
 /*
@@ -134,68 +161,71 @@ static Chunk* currentChunk() {
 */
 
 // This function logs Errors (so the user can see them)
-// - first we print the error ocurred and line were in
+// - first we print the error ocurred and line were in (after the script, if the parser knows it)
 // - then we show the lexeme if readable
 // - then we print the error message itself.
 // - afterwards we set the hadError - FLAG
-static void errorAtToken(Token* token, const char* message) {
-    if (parser.panicMode) return;       // to avoid spamming 100s of cascading Errors we only report the first error
-    parser.panicMode = true;
-    fprintf(stderr, "[line %d] Error", token->line);
+// each error gets written with a single fprintf(), so errors of threads compiling at the same time (--check) dont get mixed up
+static void errorAtToken(Parser* parser, Token* token, const char* message) {
+    if (parser->panicMode) return;       // to avoid spamming 100s of cascading Errors we only report the first error
+    parser->panicMode = true;
+    parser->hadError = true;
+    if (parser->quiet) return;
+    const char* path = parser->path == NULL ? "" : parser->path;
+    const char* separator = parser->path == NULL ? "" : ": ";
 
     if (token->type == TOKEN_EOF) {
-        fprintf(stderr, " at end");
+        fprintf(stderr, "%s%s[line %d] Error at end: %s\n", path, separator, token->line, message);
     } else if (token->type == TOKEN_ERROR) {
-        // DO NOTHING (not human readable?)  TODO: check what this would print out?
+        // the message already says what the scanner could not read
+        fprintf(stderr, "%s%s[line %d] Error: %s\n", path, separator, token->line, message);
     } else {
-        fprintf(stderr, " at '%.*s'", token->length, token->start);
+        fprintf(stderr, "%s%s[line %d] Error at '%.*s': %s\n", path, separator, token->line, token->length, token->start, message);
     }
-    fprintf(stderr, ": %s\n", message);
-    parser.hadError = true;
 }
 
 // helper               - forwards previousToken and Error-message to errorAtToken()
-static void error(const char* message) {
-    errorAtToken(&parser.previous, message);
+static void error(Parser* parser, const char* message) {
+    errorAtToken(parser, &parser->previous, message);
 }
 
 // helper for advance() - forwards  currentToken and Error-message to errorAtToken()
-static void errorAtCurrent(const char* message) {
-    errorAtToken(&parser.current, message);
+static void errorAtCurrent(Parser* parser, const char* message) {
+    errorAtToken(parser, &parser->current, message);
 }
 
 // helper for compile() - keeps advancing till we hit a non-error
-static void advance() {
-    parser.previous = parser.current;   // save previous-used-Token in parser.previous
+static void advance(Parser* parser) {
+    parser->previous = parser->current; // save previous-used-Token in parser.previous
 
     // we keep looping, reading tokens and reporting the errors upstream 
     for (;;) {
-        parser.current = scanToken();
-        if (parser.current.type != TOKEN_ERROR) break;
-        errorAtCurrent(parser.current.start);
+        parser->current = scanToken(&parser->scanner);
+        if (parser->current.type != TOKEN_ERROR) break;
+        errorAtCurrent(parser, parser->current.start);
     }
     // untill we hit an non-error then we continue
 }
 
 // helper for compile() - reads the next token & advances. 
 // - next Type MUST be provided type otherwise ERRORS
-static void consume(TokenType type, const char* message) {
-    if (parser.current.type == type) {
-        advance();
+static void consume(Parser* parser, TokenType type, const char* message) {
+    if (parser->current.type == type) {
+        advance(parser);
         return;
     }
-    errorAtCurrent(message);
+    errorAtCurrent(parser, message);
 }
 
 // helper - if the current token has the given type we return true.
-static bool check(TokenType type) {
-    return parser.current.type == type;
+static bool check(Parser* parser, TokenType type) {
+    return parser->current.type == type;
 }
 
 // helper - if the current token has the given type we consume it and return true.
-static bool match(TokenType type) {
-    if (!check(type)) return false;
-    advance();
+static bool match(Parser* parser, TokenType type) {
+    if (!check(parser, type)) return false;
+    advance(parser);
     return true;
 }
 
@@ -207,97 +237,121 @@ static bool match(TokenType type) {
 */
 
 // helper - writes given byte and adds it to the chunk of bytecode-instructions
-static void emitByte(uint8_t byte) {
-    writeChunk(currentChunk(), byte, parser.previous.line);
+static void emitByte(Parser* parser, uint8_t byte) {
+    writeChunk(currentChunk(parser), byte, parser->previous.line, parser->previous.column);
 }
 
-static void emitBytes(uint8_t byte1, uint8_t byte2) {
-    emitByte(byte1);
-    emitByte(byte2);
+static void emitBytes(Parser* parser, uint8_t byte1, uint8_t byte2) {
+    emitByte(parser, byte1);
+    emitByte(parser, byte2);
 }
 
 // helper for whileStatement() - 
 // - emits a new loop instruction that unconditionally jumps backwards by a given offset(16bit). 
 //      (pushed to stack afterwadrds in 2 8bit chunks)
 // - 
-static void emitLoop(int loopStart) {
-    emitByte(OP_LOOP);
-    int offset = currentChunk()->count - loopStart + 2; // +2 is because of OP_JUMP 2 bytes for offset's length
-    if (offset > UINT16_MAX) error("Loop body too large.");
-    emitByte((offset >> 8) & 0xff);     // the two 8bit of the 16bit int we use to jump
-    emitByte(offset & 0xff);
+static void emitLoop(Parser* parser, int loopStart) {
+    emitByte(parser, OP_LOOP);
+    int offset = currentChunk(parser)->count - loopStart + 2; // +2 is because of OP_JUMP 2 bytes for offset's length
+    if (offset > UINT16_MAX) error(parser, "Loop body too large.");
+    emitByte(parser, (offset >> 8) & 0xff); // the two 8bit of the 16bit int we use to jump
+    emitByte(parser, offset & 0xff);
 }
 
 // helper for patchJump() - emits the input Jump-Instruction then a 2-byte long offset
 // - emits a bytecode instruction and writes a placeholder operand for the jump offset
 // - we use 2 bytes for the jump offset -> so 65535 bytes of code is our max jump length.
-static int emitJump(uint8_t instruction) {
-    emitByte(instruction);
-    emitByte(0xff);
-    emitByte(0xff);
-    return currentChunk()->count -2;
+static int emitJump(Parser* parser, uint8_t instruction) {
+    emitByte(parser, instruction);
+    emitByte(parser, 0xff);
+    emitByte(parser, 0xff);
+    return currentChunk(parser)->count -2;
 }
 
 // helper for endCompiler() - function returns explicit (a value) or implicit by reaching } -> it returns nil
-static void emitReturn() {
-    if (current->type == TYPE_INITIALIZER) {
-        emitBytes(OP_GET_LOCAL, 0);     // init() always must return a new instance of the class.
+static void emitReturn(Parser* parser) {
+    if (parser->compiler->type == TYPE_INITIALIZER) {
+        emitBytes(parser, OP_GET_LOCAL, 0); // init() always must return a new instance of the class.
         // So we push the zero slot -> that we know contains the instance when handling methods.
     } else {
-        emitByte(OP_NIL);               // normal functions return implicit nil
+        emitByte(parser, OP_NIL);       // normal functions return implicit nil
+    }
+    emitByte(parser, OP_RETURN);        // temporaly  - write the OP_RETURN Byte to our Chunk 
+}
+
+// helper for endScope() and endCompiler() - the local goes out of scope, so now we know if it always held the same function.
+// Calls to it only stay inline sites if it never got reassigned or captured (a closure could reassign it)
+static void resolveInlineSites(Parser* parser, int local) {
+    for (int i = 0; i < parser->compiler->inlineSiteCount; i++) {
+        if (parser->compiler->inlineLocals[i] != local) continue;
+        if (parser->compiler->locals[local].isAssigned || parser->compiler->locals[local].isCaptured) {
+            parser->compiler->inlineSites[i].function = NULL;
+        }
+        parser->compiler->inlineLocals[i] = -1;
     }
-    emitByte(OP_RETURN);                // temporaly  - write the OP_RETURN Byte to our Chunk 
 }
 
 // helper - we call this function when we exit a new local scope with "}"...
-static void endScope() {
-    current->scopeDepth--;
+static void endScope(Parser* parser) {
+    parser->compiler->scopeDepth--;
     // remove all Local-Variables that went out of scope:
-    while (current->localCount > 0 &&
-            current->locals[current->localCount - 1].depth > current->scopeDepth) {
-        if (current->locals[current->localCount -1].isCaptured) {
-            emitByte(OP_CLOSE_UPVALUE);         // if a upvalue closed over the value it takes ownership of it
+    while (parser->compiler->localCount > 0 &&
+            parser->compiler->locals[parser->compiler->localCount - 1].depth > parser->compiler->scopeDepth) {
+        if (parser->compiler->locals[parser->compiler->localCount -1].isCaptured) {
+            emitByte(parser, OP_CLOSE_UPVALUE); // if a upvalue closed over the value it takes ownership of it
         } else {
-            emitByte(OP_POP);                   // if not we can remove it forever
+            emitByte(parser, OP_POP);           // if not we can remove it forever
         }
-        current->localCount--;
+        resolveInlineSites(parser, parser->compiler->localCount - 1);
+        parser->compiler->localCount--;
     }
 
 }
 
 // helper - we call this function when we enter a new local scope with "{"...
-static void beginScope() {
-        current->scopeDepth++;
+static void beginScope(Parser* parser) {
+        parser->compiler->scopeDepth++;
 }
 
 // helper for emitConstant() - pushes the value on the runtime stack.
-static uint8_t makeConstant(Value value) {
-    int constant = addConstant(currentChunk(), value);
+static uint8_t makeConstant(Parser* parser, Value value) {
+    int before = currentChunk(parser)->constants.count;
+    int constant = internConstant(currentChunk(parser), value); // reuses the constant if the chunk already has it
+    if (constant >= before && constant < UINT8_COUNT) parser->compiler->constantAddedAt[constant] = currentChunk(parser)->count;
     if (constant > UINT8_MAX) {
-        error("Too many constants in one chunk.");      // at the moment 256 limit of constants per chunk
+        error(parser, "Too many constants in one chunk."); // at the moment 256 limit of constants per chunk
         return 0;
     }
     return (uint8_t)constant;
 }
 
 // init a new Compiler - we use this every time we need a new Chunk/Call-Stack, in ex.: if we hit a new function
-static void initCompiler(Compiler* compiler, FunctionType type) {
-    compiler->enclosing = current;          // capture previous current compiler and write it to be this one's-enclosing/'parent'
+static void initCompiler(Parser* parser, Compiler* compiler, FunctionType type) {
+    compiler->enclosing = parser->compiler; // capture previous current compiler and write it to be this one's-enclosing/'parent'
     compiler->function = NULL;
     compiler->type = type;
     compiler->localCount = 0;
     compiler->scopeDepth = 0;
+    compiler->exprStart = 0;
+    compiler->numericEnd = -1;
+    compiler->callEnd = -1;
+    compiler->localGetEnd = -1;
+    compiler->localGet = 0;
+    compiler->inlineSiteCount = 0;
+    compiler->lazy = NULL;
     compiler->function = newFunction();     // create a new ObjFunction -> we compile our code into it's chunk.
-    current = compiler;
+    parser->compiler = compiler;
     if (type != TYPE_SCRIPT) {              // if not a top-scope function we store its function-name (copy because of lifetimes)
-        current->function->name = copyString(parser.previous.start, parser.previous.length);
+        parser->compiler->function->name = copyString(parser->previous.start, parser->previous.length);
     }
 
     // compiler uses the 0 slot of locals for internal use:
     // - name "" so no one else can write to it (with how our maps work)
-    Local* local = &current->locals[current->localCount++];
+    Local* local = &parser->compiler->locals[parser->compiler->localCount++];
     local->depth = 0;
     local->isCaptured = false;
+    local->isAssigned = false;
+    local->function = NULL;
 
     // compiler sets stack slot zero - Used for special purpose
     if (type != TYPE_FUNCTION) {
@@ -310,39 +364,56 @@ static void initCompiler(Compiler* compiler, FunctionType type) {
 }
 
 // emits the Instrucitons to add one constant to our Cunk (like in var x=3.65 -> we would add const 3.65)
-static void emitConstant(Value value) {
-    emitBytes(OP_CONSTANT, makeConstant(value));
+static void emitConstant(Parser* parser, Value value) {
+    emitBytes(parser, OP_CONSTANT, makeConstant(parser, value));
 }
 
 // helper for ifStatement() - spaws the placeholder offset for the real offset.
 // - goes back into the bytecode and replaces the calculated jump offset. 
 //   (ex. now we know how long (how many bytecode-instructions) the doStatment after a if(expression)doStatment; was)
-static void patchJump(int offset) {
+static void patchJump(Parser* parser, int offset) {
     //
-    int jump = currentChunk()->count - offset -2;
+    int jump = currentChunk(parser)->count - offset -2;
     if (jump > UINT16_MAX) {
-        error("Too much code to jump over.");   // max of 65535bytes of code (2 8 bit blocks)
+        error(parser, "Too much code to jump over."); // max of 65535bytes of code (2 8 bit blocks)
     }
-    currentChunk()->code[offset] = (jump >> 8) & 0xff;
-    currentChunk()->code[offset +1] = jump & 0xff;
+    currentChunk(parser)->code[offset] = (jump >> 8) & 0xff;
+    currentChunk(parser)->code[offset +1] = jump & 0xff;
+    parser->compiler->numericEnd = -1; // something else might land here now (ex. "a and -b" can leave a non-number on the stack)
 }
 
 // helper for compile() - For now we just add a Return at the end
-static ObjFunction* endCompiler() {
-    emitReturn();
-    ObjFunction* function = current->function;   // grab the pointer to the current function
+static ObjFunction* endCompiler(Parser* parser) {
+    emitReturn(parser);
+    ObjFunction* function = parser->compiler->function; // grab the pointer to the current function
+    // the locals still in scope are gone now aswell -> we know which calls always call the same function
+    for (int i = 0; i < parser->compiler->localCount; i++) resolveInlineSites(parser, i);
+    int siteCount = 0;
+    for (int i = 0; i < parser->compiler->inlineSiteCount; i++) {
+        if (parser->compiler->inlineSites[i].function != NULL) parser->compiler->inlineSites[siteCount++] = parser->compiler->inlineSites[i];
+    }
+    ArenaMark mark = arenaMark(&parser->arena);
+    if (!parser->hadError) optimizeFunction(&parser->arena, function, parser->compiler->inlineSites, siteCount);
+    if (!parser->hadError && FLAG_REGISTER_VM) compileRegisters(&parser->arena, function);  // (if it can) the function runs on the register vm
+    arenaRelease(&parser->arena, mark);
+    freeConstantIndex(currentChunk(parser));    // nothing adds constants anymore
+    freezeChunk(&function->chunk);              // or grows: the code shrinks to fit (quickening only rewrites it in place)
+    freezeChunk(&function->regChunk);
 
     // Flag that enables dumping out chunks once the compiler finishes
     #ifdef DEBUG_PRINT_CODE
     if (FLAG_PRINT_CODE) {
-        if (!parser.hadError) {
+        if (!parser->hadError) {
             // user define functions have a name, the toplevel one is NULL:
-            disassembleChunk(currentChunk(), function->name != NULL ? function->name->chars : "<script>");
+            disassembleChunk(currentChunk(parser), function->name != NULL ? function->name->chars : "<script>");
+            if (IS_REGISTER_FUNCTION(function)) {
+                disassembleRegisterChunk(function, function->name != NULL ? function->name->chars : "<script>");
+            }
         }
     }
     #endif
 
-    current = current->enclosing;               // put the this one's enclosing/'parent'-compiler as the current, when we close the this recent one
+    parser->compiler = parser->compiler->enclosing; // put the this one's enclosing/'parent'-compiler as the current, when we close the this recent one
     return function;
 }
 
@@ -352,11 +423,11 @@ static ObjFunction* endCompiler() {
 *       - needed to resolve recursive dependencies among those functions. (because c)
 */
 
-static void expression();
-static void statement();                    // recursive with declaration()
-static void declaration();                  // recursive with statment()
+static void expression(Parser* parser);
+static void statement(Parser* parser);      // recursive with declaration()
+static void declaration(Parser* parser);    // recursive with statment()
 static ParseRule* getRule(TokenType type);
-static void parsePrecedence(Precedence precedence);
+static void parsePrecedence(Parser* parser, Precedence precedence);
 
 /*
 *
@@ -365,8 +436,8 @@ static void parsePrecedence(Precedence precedence);
 */
 
 // helper - adds lexeme to constant-table. returns idx to it
-static uint8_t identifierConstant(Token* name) {
-    return makeConstant(OBJ_VAL(copyString(name->start, name->length)));
+static uint8_t identifierConstant(Parser* parser, Token* name) {
+    return makeConstant(parser, OBJ_VAL(copyString(name->start, name->length)));
 }
 
 // helper for declareVariable - cecks if 2 identifiers are the same. (ex. then a and b point to the same variable )
@@ -379,12 +450,12 @@ static bool identifiersEqual(Token* a, Token* b) {
 // - loop the list of ccurrently in scope local variables. 
 //    - backwards because thats top of our stack. This way inner variables get found first! (like shadowed variables)
 // - If identifiers match -> return index to it
-static int resolveLocal(Compiler* compiler, Token* name) {
+static int resolveLocal(Parser* parser, Compiler* compiler, Token* name) {
     for (int i = compiler->localCount - 1; i>=0; i--) {     
         Local* local = &compiler->locals[i];
         if (identifiersEqual(name, &local->name)) {
             if (local->depth == -1) {
-                error("Can't read local variable in its own initializer.");
+                error(parser, "Can't read local variable in its own initializer.");
             }
             return i;   // found the variable
         }
@@ -393,7 +464,7 @@ static int resolveLocal(Compiler* compiler, Token* name) {
 }
 
 // adds a new upvalue (used to resolve Closure-captured variables) to the upvalue-array
-static int addUpvalue(Compiler* compiler, uint8_t index, bool isLocal) {
+static int addUpvalue(Parser* parser, Compiler* compiler, uint8_t index, bool isLocal) {
     int upvalueCount = compiler->function->upvalueCount;
 
     // check we find matching Upvalue we reuse it and return it's index
@@ -404,7 +475,7 @@ static int addUpvalue(Compiler* compiler, uint8_t index, bool isLocal) {
         }
     }
     if (upvalueCount == UINT8_COUNT) {
-        error("Too many closure variables in function.");
+        error(parser, "Too many closure variables in function.");
         return 0;
     }
     // otherwise we add it at the end of the upvalue-array:
@@ -415,95 +486,104 @@ static int addUpvalue(Compiler* compiler, uint8_t index, bool isLocal) {
 
 // after failing to reslove a local variable this gets called
 // - and will start looking trough the Upvalues
-static int resolveUpvalue(Compiler* compiler, Token* name) {
+static int resolveUpvalue(Parser* parser, Compiler* compiler, Token* name) {
+    if (compiler->lazy != NULL) {                               // a lazy function only knows its upvalues by name
+        for (int i = 0; i < compiler->lazy->upvalueCount; i++) {
+            ObjString* upvalueName = compiler->lazy->upvalueNames[i];
+            if (upvalueName->length == name->length && memcmp(upvalueName->chars, name->start, name->length) == 0) return i;
+        }
+        return -1;
+    }
     if (compiler->enclosing == NULL) return -1;                 // its global scope
-    int local = resolveLocal(compiler->enclosing, name);
+    int local = resolveLocal(parser, compiler->enclosing, name);
     if (local != -1) {
         compiler->enclosing->locals[local].isCaptured = true;   // we note in the local-variable that an upvalue referenced it
-        return addUpvalue(compiler, (uint8_t)local, true);
+        return addUpvalue(parser, compiler, (uint8_t)local, true);
     }
     // it can recursively chain Upvalue->Upvalue->Upvalue->local x=1
-    int upvalue = resolveUpvalue(compiler->enclosing, name);
+    int upvalue = resolveUpvalue(parser, compiler->enclosing, name);
     if (upvalue != -1) {
-        return addUpvalue(compiler, (uint8_t)upvalue, false);
+        return addUpvalue(parser, compiler, (uint8_t)upvalue, false);
     }
     return -1;
 }
 
 
 // helper - Adds Local variable to our Compiler-Struct that keeps track of active local-variables on the stack.
-static void addLocal(Token name) {
-    if (current->localCount ==UINT8_COUNT) {
-        error("Too many local variables in function.");         // Scope is hard capped by array size
+static void addLocal(Parser* parser, Token name) {
+    if (parser->compiler->localCount ==UINT8_COUNT) {
+        error(parser, "Too many local variables in function."); // Scope is hard capped by array size
         return;
     }
-    Local* local = &current->locals[current->localCount++];     // initialize the next available local(next element in array)
+    Local* local = &parser->compiler->locals[parser->compiler->localCount++]; // initialize the next available local(next element in array)
     local->name = name;                                         // stores variables Identity
     local->depth = -1;                                          // -1 WE USE to signal an UNITIALIZED VARIABLE
     local->isCaptured = false;
+    local->isAssigned = false;
+    local->function = NULL;
 }
 
 // helper for parseVariable() - take The Identifiert and pass it down
-static void declareVariable() {
-    if(current->scopeDepth == 0) return;                        // this happens only for locals, so for globals we return early
-    Token* name = &parser.previous;
+static void declareVariable(Parser* parser) {
+    if(parser->compiler->scopeDepth == 0) return;               // this happens only for locals, so for globals we return early
+    Token* name = &parser->previous;
 
     // We have to manually check if were trying to redeclare a local (NOT ALLOWED): like "var x = 1; var x =2;" only "x=2;"" would be
-    for (int i = current->localCount-1; i>=0; i--) {
-        Local* local = &current->locals[i];
-        if (local->depth != -1 && local->depth < current->scopeDepth) {
+    for (int i = parser->compiler->localCount-1; i>=0; i--) {
+        Local* local = &parser->compiler->locals[i];
+        if (local->depth != -1 && local->depth < parser->compiler->scopeDepth) {
             break;
         }
         if (identifiersEqual(name, &local->name)) {
-            error("Already a variable with this name in this scope.");
+            error(parser, "Already a variable with this name in this scope.");
         }
     }
 
-    addLocal(*name);
+    addLocal(parser, *name);
 }
 
 
 // helper working with variables and identifiers - consumes next Token=IDENTIFIER
-static uint8_t parseVariable(const char* errorMessage) {
-    consume(TOKEN_IDENTIFIER, errorMessage);
-    declareVariable();
-    if (current->scopeDepth > 0) return 0;          // if were in a scope its a local-var so we dont need to shove it down the constant-Table
+static uint8_t parseVariable(Parser* parser, const char* errorMessage) {
+    consume(parser, TOKEN_IDENTIFIER, errorMessage);
+    declareVariable(parser);
+    if (parser->compiler->scopeDepth > 0) return 0; // if were in a scope its a local-var so we dont need to shove it down the constant-Table
     
-    return identifierConstant(&parser.previous);    // were defining a global -> so we shove it down the constant-Lookup-Table
+    return identifierConstant(parser, &parser->previous); // were defining a global -> so we shove it down the constant-Lookup-Table
 }
 
 // helper for defineVariable - utility to get current scopeDepth
 //  - used this way to handle the special case of declaring:         var x=9; { var x = x; }
-static void markInitialized() {
+static void markInitialized(Parser* parser) {
     // since Function Declarations use this, we return early if global scope -> able to 'use' that function in itself (recursion):
-    if (current->scopeDepth == 0) return;       
-    current->locals[current->localCount - 1].depth = current->scopeDepth;
+    if (parser->compiler->scopeDepth == 0) return;       
+    parser->compiler->locals[parser->compiler->localCount - 1].depth = parser->compiler->scopeDepth;
 }
 
 // helper for varDeclaration() - 
 //  - previously the value of our variable got poped to the stack
 //  - so now we can just emit this instruction afterwards -> takes that value and stores it 
-static void defineVariable(uint8_t global) {
-    if (current->scopeDepth > 0) {
-        markInitialized();
+static void defineVariable(Parser* parser, uint8_t global) {
+    if (parser->compiler->scopeDepth > 0) {
+        markInitialized(parser);
         return;                             // we hit a local, no need to do the global thing (value is already on top of the stack)
     }
-    emitBytes(OP_DEFINE_GLOBAL, global);    // this would remove the value from the stack then write it to our lookup-Table
+    emitBytes(parser, OP_DEFINE_GLOBAL, global); // this would remove the value from the stack then write it to our lookup-Table
 }
 
 // helper for call() - compile the arguments (of a funciton-call)  ex: doThings(arg1, 99, "Bond James")
-static uint8_t argumentList() {
+static uint8_t argumentList(Parser* parser) {
     uint8_t argCount = 0;
-    if (!check(TOKEN_RIGHT_PAREN)) {
+    if (!check(parser, TOKEN_RIGHT_PAREN)) {
         do {
-            expression();
+            expression(parser);
             if(argCount == 255) {
-                error("Can't have more than 255 arguments.");
+                error(parser, "Can't have more than 255 arguments.");
             }
             argCount++;
-        } while (match(TOKEN_COMMA));
+        } while (match(parser, TOKEN_COMMA));
     }
-    consume(TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
     return argCount;
 }
 
@@ -518,112 +598,253 @@ static uint8_t argumentList() {
 // at the point this is called the left side of AND is evaluated and on top of stack
 //  -> if this is already false we skip everything right of AND with a jump.
 //     (since "true AND neverRanFunction()" short circuits - we have to use Jumps)
-static void and_(bool canAssign) {
-    int endJump = emitJump(OP_JUMP_IF_FALSE);
-    emitByte(OP_POP);                           // cleanup the evaluated left side expr from stack
-    parsePrecedence(PREC_AND);                  // continue to eval right side of AND
-    patchJump(endJump);
+static void and_(Parser* parser, bool canAssign) {
+    int endJump = emitJump(parser, OP_JUMP_IF_FALSE);
+    emitByte(parser, OP_POP);                   // cleanup the evaluated left side expr from stack
+    parsePrecedence(parser, PREC_AND);          // continue to eval right side of AND
+    patchJump(parser, endJump);
+}
+
+/*
+    Constant folding:
+    - after compiling the operand(s) of an unary/binary expression we check if the code for each operand is just one constant-load.
+    - if so we compute the result right here, throw away the operand code (and their constants) and load the result instead.
+        ex: "60 * 60 * 24" -> OP_CONSTANT 86400   or   "!true" -> OP_FALSE
+    - anything the vm would throw a runtime error for ("a" - 1) does not get folded, so the error still happens at runtime.
+*/
+
+// helper for the constant folding - if the code in [start, end) is exactly one instruction that loads a constant, we write that to value
+static bool isConstantLoad(Parser* parser, int start, int end, Value* value) {
+    Chunk* chunk = currentChunk(parser);
+    if (end - start == 1) {
+        switch (chunk->code[start]) {
+            case OP_NIL:        *value = NIL_VAL; return true;
+            case OP_TRUE:       *value = BOOL_VAL(true); return true;
+            case OP_FALSE:      *value = BOOL_VAL(false); return true;
+            default:            return false;
+        }
+    }
+    if (end - start == 2 && chunk->code[start] == OP_CONSTANT) {
+        *value = chunk->constants.values[chunk->code[start + 1]];
+        return true;
+    }
+    return false;
+}
+
+// helper for the constant folding - removes the constant-loads in [start, count) we just folded.
+// - the constants they used get released aswell (if they are the last ones in the constant-pool and nothing before reuses them)
+static void discardConstantLoads(Parser* parser, int start) {
+    Chunk* chunk = currentChunk(parser);
+    int released[2];                    // we never fold more than 2 loads at once
+    int releasedCount = 0;
+    for (int offset = start; offset < chunk->count; offset++) {
+        if (chunk->code[offset] == OP_CONSTANT) {
+            released[releasedCount++] = chunk->code[++offset];
+        }
+    }
+    for (int i = releasedCount - 1; i >= 0; i--) {
+        if (released[i] == chunk->constants.count - 1 && parser->compiler->constantAddedAt[released[i]] >= start) {
+            removeLastConstant(chunk);
+        }
+    }
+    chunk->count = start;
+    if (parser->compiler->numericEnd > start) parser->compiler->numericEnd = -1;
+}
+
+// helper for the constant folding - emits the cheapest instruction that loads value
+static void emitValue(Parser* parser, Value value) {
+    if (IS_NIL(value)) {
+        emitByte(parser, OP_NIL);
+    } else if (IS_BOOL(value)) {
+        emitByte(parser, AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+    } else {
+        emitConstant(parser, value);
+        if (IS_NUMBER(value)) parser->compiler->numericEnd = currentChunk(parser)->count;
+    }
+}
+
+// helper for binary() - computes "a op b" at compile time exactly like the vm would at runtime.
+// - returns false if the vm would throw a runtime error for it
+static bool foldBinary(TokenType operatorType, Value a, Value b, Value* result) {
+    // ==, != work on any two values:
+    if (operatorType == TOKEN_EQUAL_EQUAL) { *result = BOOL_VAL(valuesEqual(a, b)); return true; }
+    if (operatorType == TOKEN_BANG_EQUAL)  { *result = BOOL_VAL(!valuesEqual(a, b)); return true; }
+    // + also concatenates two strings:
+    if (operatorType == TOKEN_PLUS && IS_STRING(a) && IS_STRING(b)) {
+        ObjString* left = AS_STRING(a);
+        ObjString* right = AS_STRING(b);
+        int length = left->length + right->length;
+        char* chars = ALLOCATE(char, length + 1);       // (a and b are still in the constant-pool, so GC keeps them alive)
+        memcpy(chars, left->chars, left->length);
+        memcpy(chars + left->length, right->chars, right->length);
+        chars[length] = '\0';
+        *result = OBJ_VAL(takeString(chars, length));
+        return true;
+    }
+    // everything else only works on 2 numbers:
+    if (!IS_NUMBER(a) || !IS_NUMBER(b)) return false;
+    double x = AS_NUMBER(a);
+    double y = AS_NUMBER(b);
+    switch (operatorType) {
+        case TOKEN_GREATER:         *result = BOOL_VAL(x > y); return true;
+        case TOKEN_GREATER_EQUAL:   *result = BOOL_VAL(!(x < y)); return true;     // same as the OP_LESS, OP_NOT the vm would run
+        case TOKEN_LESS:            *result = BOOL_VAL(x < y); return true;
+        case TOKEN_LESS_EQUAL:      *result = BOOL_VAL(!(x > y)); return true;
+        case TOKEN_PLUS:            *result = NUMBER_VAL(x + y); return true;
+        case TOKEN_MINUS:           *result = NUMBER_VAL(x - y); return true;
+        case TOKEN_STAR:            *result = NUMBER_VAL(x * y); return true;
+        case TOKEN_SLASH:           *result = NUMBER_VAL(x / y); return true;
+        case TOKEN_MODULO:          *result = NUMBER_VAL(myFloatModulo(x, y)); return true;
+        default:                    return false;
+    }
+}
+
+// helper for binary() - algebraic identities "x * 1", "x / 1", "x - 0" -> "x"
+// - only if we know x is a number (otherwise "a" * 1 would not throw its runtime error anymore).
+// - "x + 0" is NOT the same as x (-0 + 0 = +0) so that one stays.
+static bool isIdentity(TokenType operatorType, Value right) {
+    if (!IS_NUMBER(right)) return false;
+    switch (operatorType) {
+        case TOKEN_STAR:
+        case TOKEN_SLASH:       return AS_NUMBER(right) == 1;
+        case TOKEN_MINUS:       return AS_NUMBER(right) == 0;
+        default:                return false;
+    }
 }
 
 // parsing function for TOKEN_PLUS, TOKEN_MINUS, TOKEN_START, TOKEN_SLASH
 // - when this gets called the left side of the expression has already been parsed and is pop'd on the stack
 // - the operand-Symbol is consumed aswell.
 // so we just compile the right-side-expression and pop it on the stack, then emit the Bytecode for the Addition.
-static void binary(bool _canAssign) {
-    TokenType operatorType = parser.previous.type;
+static void binary(Parser* parser, bool _canAssign) {
+    TokenType operatorType = parser->previous.type;
+    int leftStart = parser->compiler->exprStart;            // the left operand sits in [leftStart, rightStart)
+    int rightStart = currentChunk(parser)->count;
+    bool leftIsNumber = parser->compiler->numericEnd == rightStart;
     ParseRule* rule = getRule(operatorType);                // we need to be able to compare precedence to stop at 3 for (2*3+4) and not get the whole 2*7
-    parsePrecedence((Precedence)(rule->precedence + 1));
+    parsePrecedence(parser, (Precedence)(rule->precedence + 1));
+
+    Value left, right, result;
+    if (isConstantLoad(parser, rightStart, currentChunk(parser)->count, &right)) {
+        if (isConstantLoad(parser, leftStart, rightStart, &left) && foldBinary(operatorType, left, right, &result)) {
+            discardConstantLoads(parser, leftStart);        // (a new string-result is safe, no GC while compiling)
+            emitValue(parser, result);
+            return;
+        }
+        if (leftIsNumber && isIdentity(operatorType, right)) {
+            discardConstantLoads(parser, rightStart);
+            parser->compiler->numericEnd = rightStart;
+            return;
+        }
+    }
 
     switch (operatorType) {
         // equality/comparison
-        case TOKEN_BANG_EQUAL:      emitBytes(OP_EQUAL, OP_NOT); break;     //(a!=)
-        case TOKEN_EQUAL_EQUAL:     emitByte(OP_EQUAL); break;       
-        case TOKEN_GREATER:         emitByte(OP_GREATER); break;
-        case TOKEN_GREATER_EQUAL:   emitBytes(OP_LESS, OP_NOT); break;      // a>=b == !(a<b)
-        case TOKEN_LESS:            emitByte(OP_LESS); break;
-        case TOKEN_LESS_EQUAL:      emitBytes(OP_GREATER, OP_NOT); break;   // a<=b == !(a>b)
+        case TOKEN_BANG_EQUAL:      emitBytes(parser, OP_EQUAL, OP_NOT); break; //(a!=)
+        case TOKEN_EQUAL_EQUAL:     emitByte(parser, OP_EQUAL); break;       
+        case TOKEN_GREATER:         emitByte(parser, OP_GREATER); break;
+        case TOKEN_GREATER_EQUAL:   emitBytes(parser, OP_LESS, OP_NOT); break; // a>=b == !(a<b)
+        case TOKEN_LESS:            emitByte(parser, OP_LESS); break;
+        case TOKEN_LESS_EQUAL:      emitBytes(parser, OP_GREATER, OP_NOT); break; // a<=b == !(a>b)
         // arithmetic
-        case TOKEN_PLUS:            emitByte(OP_ADD); break;
-        case TOKEN_MINUS:           emitByte(OP_SUBTRACT); break;
-        case TOKEN_STAR:            emitByte(OP_MULTIPLY); break;
-        case TOKEN_SLASH:           emitByte(OP_DIVIDE); break;
+        case TOKEN_PLUS:            emitByte(parser, OP_ADD); break;
+        case TOKEN_MINUS:           emitByte(parser, OP_SUBTRACT); break;
+        case TOKEN_STAR:            emitByte(parser, OP_MULTIPLY); break;
+        case TOKEN_SLASH:           emitByte(parser, OP_DIVIDE); break;
         // CUSTOM token:
-        case TOKEN_MODULO:          emitByte(OP_MODULO); break;
+        case TOKEN_MODULO:          emitByte(parser, OP_MODULO); break;
         default: return;            // Unreachable
     }
+    // if these did not throw a runtime error the result is a number (OP_ADD could also be a string)
+    if (operatorType == TOKEN_MINUS || operatorType == TOKEN_STAR || operatorType == TOKEN_SLASH || operatorType == TOKEN_MODULO) {
+        parser->compiler->numericEnd = currentChunk(parser)->count;
+    }
 }
 
 // when hitting an opening '(' followed by an expression (ex, function call)
-static void call(bool canAssign) {
-    uint8_t argCount = argumentList();      // compiles all Function Arguments
-    emitBytes(OP_CALL, argCount);           // invoke the function, using the argument count as operand
+static void call(Parser* parser, bool canAssign) {
+    // calling a local function "square(3)" -> we remember the call, the optimizer might inline it
+    Chunk* chunk = currentChunk(parser);
+    int local = -1;
+    if (parser->compiler->localGetEnd == chunk->count && chunk->code[chunk->count - 2] == OP_GET_LOCAL
+        && chunk->code[chunk->count - 1] == parser->compiler->localGet && parser->compiler->locals[parser->compiler->localGet].function != NULL) {
+        local = parser->compiler->localGet;
+    }
+    uint8_t argCount = argumentList(parser); // compiles all Function Arguments
+    emitBytes(parser, OP_CALL, argCount);   // invoke the function, using the argument count as operand
+    parser->compiler->callEnd = currentChunk(parser)->count;
+    if (local != -1 && parser->compiler->inlineSiteCount < UINT8_COUNT) {
+        int site = parser->compiler->inlineSiteCount++;
+        parser->compiler->inlineSites[site] = (InlineSite){currentChunk(parser)->count - 2, parser->previous.line, parser->compiler->locals[local].function};
+        parser->compiler->inlineLocals[site] = local;
+    }
 }
 
 // parsing function for dot-syntax as in "SomeClass.someField=true; SomeClass.doSomeMethod();"
-static void dot(bool canAssign) {
-    consume(TOKEN_IDENTIFIER, "Expect property name after '.'.");
-    uint8_t name = identifierConstant(&parser.previous);
-    if(canAssign && match(TOKEN_EQUAL)) {
-        expression();
-        emitBytes(OP_SET_PROPERTY, name);    // "Preaches.isTasty = false" sets isTasty field
-    } else if (match(TOKEN_LEFT_PAREN))  {
-        uint8_t argCount = argumentList();
-        emitBytes(OP_INVOKE, name);         // Method calls get its own OP-Code for optimisation
-        emitByte(argCount);
+static void dot(Parser* parser, bool canAssign) {
+    consume(parser, TOKEN_IDENTIFIER, "Expect property name after '.'.");
+    uint8_t name = identifierConstant(parser, &parser->previous);
+    if(canAssign && match(parser, TOKEN_EQUAL)) {
+        expression(parser);
+        emitBytes(parser, OP_SET_PROPERTY, name); // "Preaches.isTasty = false" sets isTasty field
+    } else if (match(parser, TOKEN_LEFT_PAREN))  {
+        uint8_t argCount = argumentList(parser);
+        emitBytes(parser, OP_INVOKE, name); // Method calls get its own OP-Code for optimisation
+        emitByte(parser, argCount);
     } else {
-        emitBytes(OP_GET_PROPERTY, name);   // "print Peaches.isTasty" -> prints true
+        emitBytes(parser, OP_GET_PROPERTY, name); // "print Peaches.isTasty" -> prints true
     }
 }
 
 // when hitting a OP_TRUE OP_FALSE OP_NIL we just push the corresponding value on the stackexpect
 // this is done as optimisation-strategy (no casting from C-true -> struct and back) 
-static void literal(bool _canAssign) {
-    switch (parser.previous.type) {
-        case TOKEN_FALSE:       emitByte(OP_FALSE); break;
-        case TOKEN_NIL:         emitByte(OP_NIL); break;
-        case TOKEN_TRUE:        emitByte(OP_TRUE); break;
+static void literal(Parser* parser, bool _canAssign) {
+    switch (parser->previous.type) {
+        case TOKEN_FALSE:       emitByte(parser, OP_FALSE); break;
+        case TOKEN_NIL:         emitByte(parser, OP_NIL); break;
+        case TOKEN_TRUE:        emitByte(parser, OP_TRUE); break;
         default: return;        // unreachable
     }
 }
 
 // parsing function for an expression type - like a recursive descent parser.
-static void grouping(bool _canAssign) {
-    expression();
-    consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
+static void grouping(Parser* parser, bool _canAssign) {
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
 }
 
 // we map TOKEN_NUMBER -> to this function
-static void number(bool _canAssign) {
-    double value = strtod(parser.previous.start, NULL);
-    emitConstant(NUMBER_VAL(value));
+static void number(Parser* parser, bool _canAssign) {
+    double value = strtod(parser->previous.start, NULL);
+    emitConstant(parser, NUMBER_VAL(value));
 }
 
 // parsing function for logical OR
 // - control flowy. In this example the right side is not reached: "false OR isNotReached()" -> we use Jumps
 // NOTE: this could be made in a new OP_CODE skipp -> less instructions needed -> faster
-static void or_(bool _canAssign) {
-    int elseJump = emitJump(OP_JUMP_IF_FALSE);  // if left-side is falsey -> tiny jump over next statement
-    int endJump = emitJump(OP_JUMP);            // (else) if left side is true -> big jump to end
-    patchJump(elseJump);                        // ->tiny jump
-    emitByte(OP_POP);                           // cleanup the evaluated left side expr from stack
-    parsePrecedence(PREC_OR);                   // parse the right side expression after OR
-    patchJump(endJump);                         // ->jump to end
+static void or_(Parser* parser, bool _canAssign) {
+    int elseJump = emitJump(parser, OP_JUMP_IF_FALSE); // if left-side is falsey -> tiny jump over next statement
+    int endJump = emitJump(parser, OP_JUMP);    // (else) if left side is true -> big jump to end
+    patchJump(parser, elseJump);                // ->tiny jump
+    emitByte(parser, OP_POP);                   // cleanup the evaluated left side expr from stack
+    parsePrecedence(parser, PREC_OR);           // parse the right side expression after OR
+    patchJump(parser, endJump);                 // ->jump to end
 }
 
 // parsing function for strings
 // - the start+1 and end-2 and length-2 trim the leading: '"' and closing: '"'
 // - then wrap that string in an Object, wrap that in a Value then push that to the constant-table.
-static void string(bool _canAssign) {
+static void string(Parser* parser, bool _canAssign) {
     // we support escaping with '\' so we handle that here:
-    int origLength = parser.previous.length - 2;    // -2 because we ignore opening and closing quotes:'"'
+    int origLength = parser->previous.length - 2;   // -2 because we ignore opening and closing quotes:'"'
     int escapedLength = 0;
     char* escapedStr = ALLOCATE(char, origLength);  // will only shrink
     // loop all chars and combine '\'+'n' -> '\n' char, adjust total length:
     for (int i = 1; i < origLength + 1; ++i) {
-        char c = parser.previous.start[i];
+        char c = parser->previous.start[i];
         // Loop every char and combine
         if (i < origLength && c == '\\') {
-            char nextChar = parser.previous.start[++i];
+            char nextChar = parser->previous.start[++i];
             switch (nextChar) {
                 case '\n':
                     break;
@@ -644,32 +865,37 @@ static void string(bool _canAssign) {
         }
         escapedStr[escapedLength++] = c;
     }
-    emitConstant(OBJ_VAL(copyString(escapedStr, escapedLength)));
+    emitConstant(parser, OBJ_VAL(copyString(escapedStr, escapedLength)));
     FREE(char, escapedStr);  // we manually free our string we used to create the escaped string
 }
 
 // helper function for variable()
-static void namedVariable(Token name, bool canAssign) {
+static void namedVariable(Parser* parser, Token name, bool canAssign) {
     // Depending if were dealing with a local (arg !=-1) or a global we set OP_COMMANDS accordingly
     uint8_t getOp, setOp;
-    int arg = resolveLocal(current, &name);
+    int arg = resolveLocal(parser, parser->compiler, &name);
     if (arg != -1) {
         getOp = OP_GET_LOCAL;               // "... x + 99;""
         setOp = OP_SET_LOCAL;               // "x = 123;";
-    } else if((arg = resolveUpvalue(current, &name)) != -1) {   // check outer-'local'-scopes
+    } else if((arg = resolveUpvalue(parser, parser->compiler, &name)) != -1) { // check outer-'local'-scopes
         getOp = OP_GET_UPVALUE;
         setOp = OP_SET_UPVALUE;
     } else {
-        arg = identifierConstant(&name);    // get the idx to the value in globals-table
+        arg = identifierConstant(parser, &name); // get the idx to the value in globals-table
         getOp = OP_GET_GLOBAL;              // this will get global from table and push() it
         setOp = OP_SET_GLOBAL;              // this will set/assign the value from the expr to the existing global in the global-table
     }
     // then we do either the assignment (if '=' following), or just get the current value
-    if (canAssign && match(TOKEN_EQUAL)) {
-        expression();
-        emitBytes(setOp, (uint8_t)arg);     
+    if (canAssign && match(parser, TOKEN_EQUAL)) {
+        expression(parser);
+        emitBytes(parser, setOp, (uint8_t)arg);     
+        if (setOp == OP_SET_LOCAL) parser->compiler->locals[arg].isAssigned = true;
     } else {
-        emitBytes(getOp, (uint8_t)arg);     
+        emitBytes(parser, getOp, (uint8_t)arg);     
+        if (getOp == OP_GET_LOCAL) {
+            parser->compiler->localGetEnd = currentChunk(parser)->count;
+            parser->compiler->localGet = arg;
+        }
     }
 }
 
@@ -682,59 +908,78 @@ static Token syntheticToken(const char* text) {
 }
 
 // parsing function for super-method calls - ex. "var method = super.someInheritedMethod;"
-static void super_(bool canAssign) {
-    if (currentClass == NULL) {
-        error("Can't use 'super' outside of a class.");
-    } else if(!currentClass->hasSuperclass) {
-        error("Can't use 'super' in a class with no superclass.");
+static void super_(Parser* parser, bool canAssign) {
+    if (parser->currentClass == NULL) {
+        error(parser, "Can't use 'super' outside of a class.");
+    } else if(!parser->currentClass->hasSuperclass) {
+        error(parser, "Can't use 'super' in a class with no superclass.");
     }
 
-    consume(TOKEN_DOT, "Expect '.' after 'super'.");
-    consume(TOKEN_IDENTIFIER, "Expect superclass method name.");
-    uint8_t name = identifierConstant(&parser.previous);    // last token was the identifier so we read that out
+    consume(parser, TOKEN_DOT, "Expect '.' after 'super'.");
+    consume(parser, TOKEN_IDENTIFIER, "Expect superclass method name.");
+    uint8_t name = identifierConstant(parser, &parser->previous); // last token was the identifier so we read that out
 
-    namedVariable(syntheticToken("this"), false);
+    namedVariable(parser, syntheticToken("this"), false);
     //
-    if (match(TOKEN_LEFT_PAREN)) {
+    if (match(parser, TOKEN_LEFT_PAREN)) {
         // to speed up method calls (That use super) we introduce a custom OP_SUPER_INVOKE
-        uint8_t argCount = argumentList();
-        namedVariable(syntheticToken("super"), false);
-        emitBytes(OP_SUPER_INVOKE, name);
-        emitByte(argCount);
+        uint8_t argCount = argumentList(parser);
+        namedVariable(parser, syntheticToken("super"), false);
+        emitBytes(parser, OP_SUPER_INVOKE, name);
+        emitByte(parser, argCount);
     } else {
         // and fail back to the slow away (that can reslove var = fncall()) else
-        namedVariable(syntheticToken("super"), false);
-        emitBytes(OP_GET_SUPER, name);      // OP_GET_SUPER expects superclass on top of stack and below the receiver.
+        namedVariable(parser, syntheticToken("super"), false);
+        emitBytes(parser, OP_GET_SUPER, name); // OP_GET_SUPER expects superclass on top of stack and below the receiver.
     }
 }
 
 // parsing function for resolving variables to their current value at runtime
 // - the only time we allow an assignment is when parsing an assignment expression or top-level expression.
 //      the canAssign FLAG makes it's way down to this lowest precedence expression (where we need it)
-static void variable(bool canAssign) {
-    namedVariable(parser.previous, canAssign);
+static void variable(Parser* parser, bool canAssign) {
+    namedVariable(parser, parser->previous, canAssign);
 }
 
 // parsing function for this keyword - used in bound-methods to access class-fields variables.
 // - we treat this as a lexically scoped local variable. (that needs not initialization)
-static void this_(bool canAssign) {
-    if (currentClass == NULL) {
-        error("Can't use 'this' outside of a class.");   // cant use this at top level
+static void this_(Parser* parser, bool canAssign) {
+    if (parser->currentClass == NULL) {
+        error(parser, "Can't use 'this' outside of a class."); // cant use this at top level
         return;
     }
-    variable(false);    // assigning to this is not possible (this = 12) so we pass canAssign=false
+    variable(parser, false); // assigning to this is not possible (this = 12) so we pass canAssign=false
     // variable() treats "this" as if it were the variable identifier
 }
 
 // parsing function for an unary negation (-10 or !true)
-static void unary(bool _canAssign) {
-    TokenType operatorType = parser.previous.type;      // we need to differentiate between ! and -
-    parsePrecedence(PREC_UNARY);                        // compiles the operand (ex: 10)
+// - constant operands get folded: "-1" -> OP_CONSTANT -1 and "!nil" -> OP_TRUE ("-nil" stays for its runtime error)
+static void unary(Parser* parser, bool _canAssign) {
+    TokenType operatorType = parser->previous.type;     // we need to differentiate between ! and -
+    int operandStart = currentChunk(parser)->count;
+    parsePrecedence(parser, PREC_UNARY);                // compiles the operand (ex: 10)
+
+    Value operand;
+    if (isConstantLoad(parser, operandStart, currentChunk(parser)->count, &operand)) {
+        if (operatorType == TOKEN_BANG) {
+            discardConstantLoads(parser, operandStart);
+            emitValue(parser, BOOL_VAL(IS_NIL(operand) || (IS_BOOL(operand) && !AS_BOOL(operand)))); // same as isFalsey() in the vm
+            return;
+        }
+        if (operatorType == TOKEN_MINUS && IS_NUMBER(operand)) {
+            discardConstantLoads(parser, operandStart);
+            emitValue(parser, NUMBER_VAL(-AS_NUMBER(operand)));
+            return;
+        }
+    }
 
     // Emit the operator instruction (depending on ! or -)
     switch (operatorType) {
-        case TOKEN_BANG:        emitByte(OP_NOT); break;
-        case TOKEN_MINUS:       emitByte(OP_NEGATE); break;
+        case TOKEN_BANG:        emitByte(parser, OP_NOT); break;
+        case TOKEN_MINUS:       
+            emitByte(parser, OP_NEGATE);
+            parser->compiler->numericEnd = currentChunk(parser)->count; // if OP_NEGATE did not throw, its a number
+            break;
         default: return;                                // Unreachable
     }
 }
@@ -744,65 +989,65 @@ static void unary(bool _canAssign) {
 // parsing function for array initializations
 // - we just parse everything separated by ',' push those values on stack
 // - then we push the OpCode to build the array then the count 
-static void arrayInit(bool canAssign) {
+static void arrayInit(Parser* parser, bool canAssign) {
     int itemCount = 0;
-    if (!check(TOKEN_RIGHT_BRACKET)) {
+    if (!check(parser, TOKEN_RIGHT_BRACKET)) {
         do {
-            if (check(TOKEN_RIGHT_BRACKET)){
+            if (check(parser, TOKEN_RIGHT_BRACKET)){
                 break;  // hit a trailing comma
             }
-            parsePrecedence(PREC_OR);   // parses things between ','s and push values on stack
+            parsePrecedence(parser, PREC_OR); // parses things between ','s and push values on stack
             if (itemCount == UINT8_COUNT) {
-                error("Can't start Array with more than 256 entries.");
+                error(parser, "Can't start Array with more than 256 entries.");
             }
             itemCount ++;
-        } while (match(TOKEN_COMMA));
+        } while (match(parser, TOKEN_COMMA));
     }
-    consume (TOKEN_RIGHT_BRACKET, "Expect ']' after array initialisation");
-    emitByte(OP_ARRAY_BUILD);
-    emitByte(itemCount);
+    consume(parser, TOKEN_RIGHT_BRACKET, "Expect ']' after array initialisation");
+    emitByte(parser, OP_ARRAY_BUILD);
+    emitByte(parser, itemCount);
 }
 
 // parsing function for array insertArr[idx] or assigning assignArr[idx] = true;
-static void arrayEdit(bool canAssign) {
-    parsePrecedence(PREC_OR);   // opening '[' already consumed so we expect the index next.
-    consume(TOKEN_RIGHT_BRACKET, "Expect ']' after index.");
-    if (canAssign & match(TOKEN_EQUAL)) {
-        expression();                   // need to push the value that we gonna insert on the stack
-        emitByte(OP_LISTS_WRITE_IDX);       // were writing into the array ex: 'someArr[10] = true'
+static void arrayEdit(Parser* parser, bool canAssign) {
+    parsePrecedence(parser, PREC_OR); // opening '[' already consumed so we expect the index next.
+    consume(parser, TOKEN_RIGHT_BRACKET, "Expect ']' after index.");
+    if (canAssign & match(parser, TOKEN_EQUAL)) {
+        expression(parser);             // need to push the value that we gonna insert on the stack
+        emitByte(parser, OP_LISTS_WRITE_IDX); // were writing into the array ex: 'someArr[10] = true'
     } else {
-        emitByte(OP_LISTS_READ_IDX);    // were reading the value ex: 'someArr[10]'
+        emitByte(parser, OP_LISTS_READ_IDX); // were reading the value ex: 'someArr[10]'
     }
 }
 
 
 // parsing function for Map initialisation:
-static void mapInit(bool canAssign) {
+static void mapInit(Parser* parser, bool canAssign) {
     int pairsCount = 0; // we count 1key and 1 value pair as 1.
-    if (!check(TOKEN_RIGHT_BRACE)) {
+    if (!check(parser, TOKEN_RIGHT_BRACE)) {
         do {
-            if(check(TOKEN_RIGHT_BRACE)) {
+            if(check(parser, TOKEN_RIGHT_BRACE)) {
                 break; // we hit a trailing comma
             }
             // key
-            if (! check(TOKEN_STRING)) {
-                error("Expect key string next inside Map.");
+            if (! check(parser, TOKEN_STRING)) {
+                error(parser, "Expect key string next inside Map.");
             }
-            consume(TOKEN_STRING, "Expect key string inside Map");
-            string(true);      //TODO: check but canAssign=false seems right
+            consume(parser, TOKEN_STRING, "Expect key string inside Map");
+            string(parser, true); //TODO: check but canAssign=false seems right
 
-            consume(TOKEN_COLON, "Expect ':' between key and value of a Map.");
+            consume(parser, TOKEN_COLON, "Expect ':' between key and value of a Map.");
             // value:
-            parsePrecedence(PREC_OR);
+            parsePrecedence(parser, PREC_OR);
             if (pairsCount == UINT8_COUNT) {
-                error("Can't start Map with more than 256 entries.");
+                error(parser, "Can't start Map with more than 256 entries.");
             }
             pairsCount ++;
-        } while(match(TOKEN_COMMA));
+        } while(match(parser, TOKEN_COMMA));
     }
-    consume(TOKEN_RIGHT_BRACE, "Expect '}' after map initialisaton");
-    emitByte(OP_MAP_BUILD);
-    emitByte(pairsCount);
+    consume(parser, TOKEN_RIGHT_BRACE, "Expect '}' after map initialisaton");
+    emitByte(parser, OP_MAP_BUILD);
+    emitByte(parser, pairsCount);
 }
 
 
@@ -858,34 +1103,37 @@ ParseRule rules[] = {
     [TOKEN_TRUE]          = {literal,     NULL,      PREC_NONE},
     [TOKEN_VAR]           = {NULL,        NULL,      PREC_NONE},
     [TOKEN_WHILE]         = {NULL,        NULL,      PREC_NONE},
+    [TOKEN_IMPORT]        = {NULL,        NULL,      PREC_NONE},
     [TOKEN_ERROR]         = {NULL,        NULL,      PREC_NONE},
     [TOKEN_EOF]           = {NULL,        NULL,      PREC_NONE},
 };
 
 // we need explicit precedence. Otherwise  -a.b + c could be compiled to: - (a.b + c) with how it is written
-static void parsePrecedence(Precedence precedence) {
-    advance();                                                  // we read the next token
-    ParseFn prefixRule = getRule(parser.previous.type)->prefix; // then loop up the corresponding Parse Rule
+static void parsePrecedence(Parser* parser, Precedence precedence) {
+    advance(parser);                                            // we read the next token
+    ParseFn prefixRule = getRule(parser->previous.type)->prefix; // then loop up the corresponding Parse Rule
     // if there is no prefix parser then the token must be a syntax error:
     if (prefixRule == NULL) {
-        error("Expect expression.");                            
+        error(parser, "Expect expression.");                            
         return;
     }
     bool canAssign = precedence <= PREC_ASSIGNMENT;             // need to pass this flag down to variable()
-    prefixRule(canAssign);   // otherwise we call the Prefix-ParseFunction
+    int start = currentChunk(parser)->count;                    // where the code of this (sub-)expression starts
+    prefixRule(parser, canAssign); // otherwise we call the Prefix-ParseFunction
     // that call will compile the rest of the prefix expression consuming any other tokens it needs
 
     // if the next token is too low precedence or isnt an infix operator were done.
     // otherwise  we consume the operand and off control to the infix parser we found ( to get the right side compiled)
-    while (precedence <= getRule(parser.current.type)->precedence) {
-        advance();
-        ParseFn infixRule = getRule(parser.previous.type)->infix;
-        infixRule(canAssign);
+    while (precedence <= getRule(parser->current.type)->precedence) {
+        advance(parser);
+        ParseFn infixRule = getRule(parser->previous.type)->infix;
+        parser->compiler->exprStart = start;                    // binary() needs to know where its left operand starts (constant folding)
+        infixRule(parser, canAssign);
     }
 
     // we failed to match the left side of the `=` as valid assignment target:
-    if (canAssign && match(TOKEN_EQUAL)) {
-        error("Invalid assignment target.");        // ex: x*y=22;
+    if (canAssign && match(parser, TOKEN_EQUAL)) {
+        error(parser, "Invalid assignment target."); // ex: x*y=22;
     }
 }
 
@@ -905,246 +1153,344 @@ static ParseRule* getRule(TokenType type) {
 // - Expressions always evaluate to a Value like 1+2->3 || True == "james"->False 
 // - Implemented are so far: 
 //      []Number-literals, []parentheses, []unary nengation, []Arithmetics: + - * /
-static void expression() {
-    parsePrecedence(PREC_ASSIGNMENT);
+static void expression(Parser* parser) {
+    parsePrecedence(parser, PREC_ASSIGNMENT);
 }
 
 // helper for statement() - inner block enclosed by 2 curly-brackets   "{" block "}"
-static void block() {
-    while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
-        declaration();
+static void block(Parser* parser) {
+    while (!check(parser, TOKEN_RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
+        declaration(parser);
     }
-    consume(TOKEN_RIGHT_BRACE, "Expect '}' after block.");      // Brackets must be closed again.
+    consume(parser, TOKEN_RIGHT_BRACE, "Expect '}' after block."); // Brackets must be closed again.
 }
 
-// helper for statement() - compiles a function "fun x() {print"hello"}"
-static void function(FunctionType type) {
-    Compiler compiler;
-    initCompiler(&compiler, type);                              // we set a new Compiler that compiles (only) this function
-    beginScope();
+// helper for function() and compileLazy() - compiles parameters and body of a function into a new Compiler
+static ObjFunction* functionBody(Parser* parser, Compiler* compiler, FunctionType type, LazyFunction* lazy) {
+    initCompiler(parser, compiler, type);                       // we set a new Compiler that compiles (only) this function
+    compiler->lazy = lazy;
+    beginScope(parser);
 
-    consume(TOKEN_LEFT_PAREN, "Expect '(' after function name.");
-    if (!check(TOKEN_RIGHT_PAREN)) {
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after function name.");
+    if (!check(parser, TOKEN_RIGHT_PAREN)) {
         // parameters is simply a local variable declared in the outermost lexical scope of a function body
         do {
-            current->function->arity++; // we keep track of nr of parameters since we only max of 256
-            if (current->function->arity > 255) {
-                errorAtCurrent("Can't have more than 255 parameters.");
+            parser->compiler->function->arity++; // we keep track of nr of parameters since we only max of 256
+            if (parser->compiler->function->arity > 255) {
+                errorAtCurrent(parser, "Can't have more than 255 parameters.");
             }
-            uint8_t constant = parseVariable("Expect parameter name.");
-            defineVariable(constant);
-        } while (match(TOKEN_COMMA));
+            uint8_t constant = parseVariable(parser, "Expect parameter name.");
+            defineVariable(parser, constant);
+        } while (match(parser, TOKEN_COMMA));
     }
-    consume(TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
-    consume(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
-    block();        // the function body, in a {}-block
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+    consume(parser, TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+    block(parser);  // the function body, in a {}-block
+    return endCompiler(parser);                                 // the Compiler for this function has finished -> we get the Function-Object from it
+}
 
-    ObjFunction* function = endCompiler();                      // the Compiler for this function has finished -> we get the Function-Object from it
-    emitBytes(OP_CLOSURE, makeConstant(OBJ_VAL(function)));     // the closure wraps our function
+// helper for statement() - compiles a function "fun x() {print"hello"}"
+static ObjFunction* function(Parser* parser, FunctionType type) {
+    Compiler compiler;
+    ObjFunction* function = functionBody(parser, &compiler, type, NULL);
+    emitBytes(parser, OP_CLOSURE, makeConstant(parser, OBJ_VAL(function))); // the closure wraps our function
     // we emit instructions to resolve the Closure-captured variables to the actual point in memory where the underlying data is stored.
     for (int i=0; i<function->upvalueCount; i++) {
-        emitByte(compiler.upvalues[i].isLocal ? 1 : 0);
-        emitByte(compiler.upvalues[i].index);
+        emitByte(parser, compiler.upvalues[i].isLocal ? 1 : 0);
+        emitByte(parser, compiler.upvalues[i].index);
     }
+    return function;
 }
 
 // helper for classDeclaration() - parses a method inside a class body:
-static void method() {
-    consume(TOKEN_IDENTIFIER, "Expect method name.");
-    uint8_t constant = identifierConstant(&parser.previous);
+static void method(Parser* parser) {
+    consume(parser, TOKEN_IDENTIFIER, "Expect method name.");
+    uint8_t constant = identifierConstant(parser, &parser->previous);
     // OP_METHOD needs: a objClosure (that function() pushes on the stack)
     // it will connect that function as a method to the class aboce it on the stack
     FunctionType type = TYPE_METHOD;
-    if (parser.previous.length == 4 && memcmp(parser.previous.start, "init", 4)==0) {
+    if (parser->previous.length == 4 && memcmp(parser->previous.start, "init", 4)==0) {
         type = TYPE_INITIALIZER;    // most functions return implicit nil. BUT init() MUST return ALWAYS an INSTANCE!
     }
-    function(type);
-    emitBytes(OP_METHOD, constant);
+    function(parser, type);
+    emitBytes(parser, OP_METHOD, constant);
 }
 
 // helper for declaration() - parses a class declaration: ex: "class Boats {var passengers = 10;}"
-static void classDeclaration() {
-    consume(TOKEN_IDENTIFIER, "Expect class name!");
-    Token className = parser.previous;
-    uint8_t nameConstant = identifierConstant(&parser.previous);
-    declareVariable();                  // add our name ex. "Boats" to our string-lookup-table
+static void classDeclaration(Parser* parser) {
+    consume(parser, TOKEN_IDENTIFIER, "Expect class name!");
+    Token className = parser->previous;
+    uint8_t nameConstant = identifierConstant(parser, &parser->previous);
+    declareVariable(parser);            // add our name ex. "Boats" to our string-lookup-table
 
-    emitBytes(OP_CLASS, nameConstant);  // instruction to create Class Object at runtime
-    defineVariable(nameConstant);       // OP_CLASS takes index of nametable to class-name
+    emitBytes(parser, OP_CLASS, nameConstant); // instruction to create Class Object at runtime
+    defineVariable(parser, nameConstant); // OP_CLASS takes index of nametable to class-name
 
     ClassCompiler classCompiler;            // When the compiler begins to compile a class it pushes a new
-    classCompiler.enclosing = currentClass; // classCompiler to that implicit linked stack (head is global)
+    classCompiler.enclosing = parser->currentClass; // classCompiler to that implicit linked stack (head is global)
     classCompiler.hasSuperclass = false;    // we assume we do not inherit (as default).
-    currentClass = &classCompiler;
+    parser->currentClass = &classCompiler;
 
     // next we check for inheritance: (syntax is: "class Cat < Pet {...}")
-    if (match(TOKEN_LESS)) {
-        consume(TOKEN_IDENTIFIER, "Expect superclass name.");   // first we consume the identifier '(ex Pet)
-        variable(false);                                        // takes previous token as variable reference-> pushes superclass on stack
-        if (identifiersEqual(&className, &parser.previous)) {
-            error("A class can't inherit from itself.");
+    if (match(parser, TOKEN_LESS)) {
+        consume(parser, TOKEN_IDENTIFIER, "Expect superclass name."); // first we consume the identifier '(ex Pet)
+        variable(parser, false);                                // takes previous token as variable reference-> pushes superclass on stack
+        if (identifiersEqual(&className, &parser->previous)) {
+            error(parser, "A class can't inherit from itself.");
         }
-        beginScope();                                       // handle Superclass calls. first we create a local scope. (needed when 2 classes share the same scope)            
-        addLocal(syntheticToken("super"));                  // then we 'reserve' a local variable calls "super" by pushing that on the stack
-        defineVariable(0);                                  // and make it a local variable
-        namedVariable(className, false);                        // then we emit our opcode for inheritance
-        emitByte(OP_INHERIT);
+        beginScope(parser);                                 // handle Superclass calls. first we create a local scope. (needed when 2 classes share the same scope)            
+        addLocal(parser, syntheticToken("super"));          // then we 'reserve' a local variable calls "super" by pushing that on the stack
+        defineVariable(parser, 0);                          // and make it a local variable
+        namedVariable(parser, className, false);                // then we emit our opcode for inheritance
+        emitByte(parser, OP_INHERIT);
         classCompiler.hasSuperclass = true;                 // we set our bool to signal we inherited -> made local scope (-> we need to cleanup that later)
     }
-    namedVariable(className, false);    // method needs the class identifier-name above it on the stack:
-    consume(TOKEN_LEFT_BRACE, "Expect '{' before class body!");
+    namedVariable(parser, className, false); // method needs the class identifier-name above it on the stack:
+    consume(parser, TOKEN_LEFT_BRACE, "Expect '{' before class body!");
     // we check for method-declaration/initialisation, ex: getname():  "class Bob { getName() { return "Bob";}}""
-    while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
-        method();
+    while (!check(parser, TOKEN_RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
+        method(parser);
     }
-    consume(TOKEN_RIGHT_BRACE, "Expect '}' after class body!");
-    emitByte(OP_POP);                   // we only pushed the class identifer-name for method() so we pop it after
+    consume(parser, TOKEN_RIGHT_BRACE, "Expect '}' after class body!");
+    emitByte(parser, OP_POP);           // we only pushed the class identifer-name for method() so we pop it after
     if (classCompiler.hasSuperclass) {
-        endScope();                                         // we have to remove the scope we created when handling superclasses
+        endScope(parser);                                   // we have to remove the scope we created when handling superclasses
+    }
+    parser->currentClass = parser->currentClass->enclosing; // when were done we remove that from the implicit linked stack
+}
+
+// helper for lazyFunction() - every name the body might read from an enclosing function becomes an upvalue of the stub.
+// We dont parse the body yet so we over-capture (ex. a local of the body with the same name as an outer one), that costs nothing but a slot.
+static void captureName(Parser* parser, Upvalue* upvalues, Token* names, int* count, Token* name) {
+    for (int i = 0; i < *count; i++) {
+        if (identifiersEqual(&names[i], name)) return;
+    }
+    int index = -1;
+    bool isLocal = false;
+    for (int i = parser->compiler->localCount - 1; i >= 0; i--) { // like resolveLocal() but an uninitialized local just is not meant
+        if (parser->compiler->locals[i].depth != -1 && identifiersEqual(name, &parser->compiler->locals[i].name)) {
+            parser->compiler->locals[i].isCaptured = true;
+            index = i;
+            isLocal = true;
+            break;
+        }
+    }
+    if (index == -1) index = resolveUpvalue(parser, parser->compiler, name);
+    if (index == -1) return;                                // a global -> gets looked up at runtime anyway
+    if (*count == UINT8_COUNT) {
+        error(parser, "Too many closure variables in function.");
+        return;
+    }
+    upvalues[*count].isLocal = isLocal;
+    upvalues[*count].index = (uint8_t)index;
+    names[(*count)++] = *name;
+}
+
+// helper for funDeclaration() (--lazy) - skips over parameters and body and emits a closure of a stub function instead.
+// The stub keeps the source of "(params) {body}", compileLazy() compiles it when it gets called the first time.
+static void lazyFunction(Parser* parser, Token name) {
+    Token start = parser->current;                          // the '('
+    Upvalue upvalues[UINT8_COUNT];
+    Token names[UINT8_COUNT];
+    int count = 0;
+    int depth = 0;
+    bool afterDot = false;
+    for (;;) {
+        advance(parser);
+        TokenType type = parser->previous.type;
+        if (type == TOKEN_EOF) {
+            error(parser, "Expect '}' after block.");
+            return;
+        }
+        if ((type == TOKEN_IDENTIFIER || type == TOKEN_THIS || type == TOKEN_SUPER) && !afterDot) {
+            captureName(parser, upvalues, names, &count, &parser->previous);
+            if (type == TOKEN_SUPER) {                      // super_() reads 'this' aswell
+                Token this = syntheticToken("this");
+                captureName(parser, upvalues, names, &count, &this);
+            }
+        }
+        afterDot = type == TOKEN_DOT;
+        if (type == TOKEN_LEFT_BRACE) depth++;
+        if (type == TOKEN_RIGHT_BRACE && --depth == 0) break;
+    }
+
+    ObjFunction* function = newFunction();
+    function->name = copyString(name.start, name.length);
+    LazyFunction* lazy = newLazyFunction(function, count);
+    for (int i = 0; i < count; i++) lazy->upvalueNames[i] = copyString(names[i].start, names[i].length);
+    const char* end = parser->previous.start + parser->previous.length;
+    lazy->source = copyString(start.start, (int)(end - start.start));
+    lazy->line = start.line;
+    lazy->column = start.column;
+    lazy->inClass = parser->currentClass != NULL;
+    lazy->hasSuperclass = parser->currentClass != NULL && parser->currentClass->hasSuperclass;
+    emitBytes(parser, OP_CLOSURE, makeConstant(parser, OBJ_VAL(function)));
+    for (int i = 0; i < count; i++) {
+        emitByte(parser, upvalues[i].isLocal ? 1 : 0);
+        emitByte(parser, upvalues[i].index);
     }
-    currentClass = currentClass->enclosing; // when were done we remove that from the implicit linked stack
 }
 
 // helper for declaration() - parses a Function declaration: ex: "fun doStuff() {...}"
 // - a function declaration at top lvl will bind the function to a global variable
 // - a function inside a block or other function creates a local variable
-static void funDeclaration() {
-    uint8_t global = parseVariable("Expect function name.");
-    markInitialized();          // we can instantly mark the function initialized -> this enables recursion.
-    function(TYPE_FUNCTION);
-    defineVariable(global);
+static void funDeclaration(Parser* parser) {
+    uint8_t global = parseVariable(parser, "Expect function name.");
+    markInitialized(parser);    // we can instantly mark the function initialized -> this enables recursion.
+    if (FLAG_LAZY && check(parser, TOKEN_LEFT_PAREN)) {
+        lazyFunction(parser, parser->previous); // lazy stubs never get inlined, they have no body yet
+        defineVariable(parser, global);
+        return;
+    }
+    ObjFunction* compiled = function(parser, TYPE_FUNCTION);
+    if (parser->compiler->scopeDepth > 0) parser->compiler->locals[parser->compiler->localCount - 1].function = compiled; // calls to it might get inlined
+    defineVariable(parser, global);
 }
 
 // helper for declaration() - initial declaration of variables
-static void varDeclaration() {
-    uint8_t global = parseVariable("Expect variable name.");
+static void varDeclaration(Parser* parser) {
+    uint8_t global = parseVariable(parser, "Expect variable name.");
 
-    if (match(TOKEN_EQUAL)) {
-        expression();       // pops initial value on the stack
+    if (match(parser, TOKEN_EQUAL)) {
+        expression(parser); // pops initial value on the stack
     } else {
-        emitByte(OP_NIL);   // uninit -> we manually pop NIL on the stack ('var a' becomes 'var a=nil')
+        emitByte(parser, OP_NIL); // uninit -> we manually pop NIL on the stack ('var a' becomes 'var a=nil')
     }
-    consume(TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
-    defineVariable(global);
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
+    defineVariable(parser, global);
 }
 
 // "eat("peaches");" is simply an expression followed by a semicolon. 
 // - Usually to call it's side effects(ex function-call); 
-static void expressionStatement() {
-    expression();
-    consume(TOKEN_SEMICOLON, "Expect ';' after expression.");
-    emitByte(OP_POP);   // discards the result from the stack. Since we are only after side effects.
+static void expressionStatement(Parser* parser) {
+    expression(parser);
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after expression.");
+    emitByte(parser, OP_POP); // discards the result from the stack. Since we are only after side effects.
 }
 
 // parse for loops -    "for (var i=0; i<10; i=x+1) print x;"   but also    "for (;;) {doInfiniteLoop;}""
-static void forStatement() {
-    beginScope();                   // we ensure the counter variable is a local variable
-    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+static void forStatement(Parser* parser) {
+    beginScope(parser);             // we ensure the counter variable is a local variable
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
     // Initializer clause           // "for(x=0;...;..)":
-    if (match(TOKEN_SEMICOLON)) {   // check if this (optinal clause) exists
+    if (match(parser, TOKEN_SEMICOLON)) { // check if this (optinal clause) exists
         // No initializer found     // ex.: for (;x>10;x++)
-    } else if (match(TOKEN_VAR)) {
-        varDeclaration();           // ex.: for(var x=0;x>10;x++)
+    } else if (match(parser, TOKEN_VAR)) {
+        varDeclaration(parser);     // ex.: for(var x=0;x>10;x++)
     } else {
-        expressionStatement();      // ex.: for(x=0;x>10;x++)
+        expressionStatement(parser); // ex.: for(x=0;x>10;x++)
     }
-    int loopStart = currentChunk()->count;
+    int loopStart = currentChunk(parser)->count;
     // Condition clause             // "for(..;x>10;..)":
     int exitJump = -1;
-    if (!match(TOKEN_SEMICOLON)) {  // check if this (optinal clause) exists
-        expression();
-        consume(TOKEN_SEMICOLON, "Expect ';' after loop condition.");
+    if (!match(parser, TOKEN_SEMICOLON)) { // check if this (optinal clause) exists
+        expression(parser);
+        consume(parser, TOKEN_SEMICOLON, "Expect ';' after loop condition.");
         // jump out of the loop if exit condition is true:
-        exitJump = emitJump(OP_JUMP_IF_FALSE);
-        emitByte(OP_POP);           // clear the exit-condition from stack if were not jumping
+        exitJump = emitJump(parser, OP_JUMP_IF_FALSE);
+        emitByte(parser, OP_POP);   // clear the exit-condition from stack if were not jumping
     }
     // Increment clause             // "for(..;...;x=x+10)":
     // - we will jump over the increment, run the body, 
     // - then jump back to the increment run it then go to the next iteration.
-    if (!match(TOKEN_RIGHT_PAREN)) {// check if this (optional clause) exists
-        int bodyJump = emitJump(OP_JUMP);
-        int incrementStart = currentChunk()->count;
-        expression();
-        emitByte(OP_POP);
-        consume(TOKEN_RIGHT_PAREN, "Expect ')' after for increment clause.");
-
-        emitLoop(loopStart);
+    if (!match(parser, TOKEN_RIGHT_PAREN)) { // check if this (optional clause) exists
+        int bodyJump = emitJump(parser, OP_JUMP);
+        int incrementStart = currentChunk(parser)->count;
+        expression(parser);
+        emitByte(parser, OP_POP);
+        consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after for increment clause.");
+
+        emitLoop(parser, loopStart);
         loopStart = incrementStart;
-        patchJump(bodyJump);
+        patchJump(parser, bodyJump);
     }
 
-    statement();                    // the 'body' of the loop that gets repeated
-    emitLoop(loopStart);
+    statement(parser);              // the 'body' of the loop that gets repeated
+    emitLoop(parser, loopStart);
     if (exitJump != -1) {
-        patchJump(exitJump);
-        emitByte(OP_POP);           // clear the exit-condition from stack. (after we jumped to end)
+        patchJump(parser, exitJump);
+        emitByte(parser, OP_POP);   // clear the exit-condition from stack. (after we jumped to end)
     }
-    endScope();                     // we needed a local scope for our loop (counter variable)
+    endScope(parser);               // we needed a local scope for our loop (counter variable)
 }
 
 // parses ifStatements - "if (isTrue) { // then do this; }"
-static void ifStatement() {
+static void ifStatement(Parser* parser) {
     // the condition, enclosed by round-brackets  "(expression)"
-    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
-    expression();
-    consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
     // we emit the JUMP IF FALSE -> so we skipp our statement if the previous expression evals to false:
-    int thenJump = emitJump(OP_JUMP_IF_FALSE);
-    emitByte(OP_POP);                       //cleanup the condition value on the stack (expr==false case)
-    statement();
-    int elseJump = emitJump(OP_JUMP);
-    patchJump(thenJump);                    // this will skip the statement()-bytecode-instructions if expr==false
-    emitByte(OP_POP);                       // cleanup the condition value on the stack (expr==true/ELSE case)
-    if (match(TOKEN_ELSE)) statement();     // IF...ELSE... Should ONLY execute when expr==true
-    patchJump(elseJump);                    // so we skipp the above bytecode instructions IF expr==true
+    int thenJump = emitJump(parser, OP_JUMP_IF_FALSE);
+    emitByte(parser, OP_POP);               //cleanup the condition value on the stack (expr==false case)
+    statement(parser);
+    int elseJump = emitJump(parser, OP_JUMP);
+    patchJump(parser, thenJump);            // this will skip the statement()-bytecode-instructions if expr==false
+    emitByte(parser, OP_POP);               // cleanup the condition value on the stack (expr==true/ELSE case)
+    if (match(parser, TOKEN_ELSE)) statement(parser); // IF...ELSE... Should ONLY execute when expr==true
+    patchJump(parser, elseJump);            // so we skipp the above bytecode instructions IF expr==true
+}
+
+// 'import "lib/math.lox";' -> runs the module (the first time) and copies its globals into ours
+static void importStatement(Parser* parser) {
+    consume(parser, TOKEN_STRING, "Expect module path after 'import'.");
+    Token path = parser->previous;
+    uint8_t constant = makeConstant(parser, OBJ_VAL(copyString(path.start + 1, path.length - 2))); // without the ""
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after module path.");
+    emitBytes(parser, OP_IMPORT, constant);
 }
 
 // "print x + 1;" -> will eval x+1 then print that;
-static void printStatement() {
-    expression();
-    consume(TOKEN_SEMICOLON, "Expect ';' after value.");
-    emitByte(OP_PRINT);
+static void printStatement(Parser* parser) {
+    expression(parser);
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after value.");
+    emitByte(parser, OP_PRINT);
 }
 
 // "return true;" -> will exit this function scope to one level lower.
-static void returnStatement() {
-    if (current->type == TYPE_SCRIPT) {
-        error("Can't return from top-level code.");
+static void returnStatement(Parser* parser) {
+    if (parser->compiler->type == TYPE_SCRIPT) {
+        error(parser, "Can't return from top-level code.");
     }
-    if (match(TOKEN_SEMICOLON)) {
-        emitReturn();                       // return; (-> implicit NIL from emitReturn())
+    if (match(parser, TOKEN_SEMICOLON)) {
+        emitReturn(parser);                 // return; (-> implicit NIL from emitReturn())
     } else {
-        if(current->type == TYPE_INITIALIZER) {
-            error("Can't return a value from an initializer.");
+        if(parser->compiler->type == TYPE_INITIALIZER) {
+            error(parser, "Can't return a value from an initializer.");
         }
-        expression();                       // return expr;
-        consume(TOKEN_SEMICOLON, "Expect ';' after return value.");
-        emitByte(OP_RETURN);
+        expression(parser);                 // return expr;
+        consume(parser, TOKEN_SEMICOLON, "Expect ';' after return value.");
+        // the expression ended with a call -> its a tail call, the callee can reuse our CallFrame.
+        // (we still emit the OP_RETURN: for jumps that land behind the call, and callees that need a normal call)
+        if (parser->compiler->callEnd == currentChunk(parser)->count && parser->compiler->type != TYPE_INITIALIZER) {
+            currentChunk(parser)->code[parser->compiler->callEnd - 2] = OP_TAIL_CALL;
+        }
+        emitByte(parser, OP_RETURN);
     }
 }
 
 // 'while (true) print"loop is running"; '
 //  - we skipp over the statement with a Jump if the while condition is false
-static void whileStatement() {
-    int loopStart = currentChunk()->count;      // loop will jump back to this value
-    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
-    expression();
-    consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
-    int exitJump = emitJump(OP_JUMP_IF_FALSE);  // our jump skip/leave the whole loop
-    emitByte(OP_POP);
-    statement();
-    emitLoop(loopStart);
-    patchJump(exitJump);                        // we exit with this once while expr==false
-    emitByte(OP_POP);
+static void whileStatement(Parser* parser) {
+    int loopStart = currentChunk(parser)->count; // loop will jump back to this value
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+    int exitJump = emitJump(parser, OP_JUMP_IF_FALSE); // our jump skip/leave the whole loop
+    emitByte(parser, OP_POP);
+    statement(parser);
+    emitLoop(parser, loopStart);
+    patchJump(parser, exitJump);                // we exit with this once while expr==false
+    emitByte(parser, OP_POP);
 }
 
 // helper for declaration() - after error we enter panic mode and try to get back to a valid state
 // - we just eat tokens till we hit a statement boundary. then exit panic mode.
-static void synchronize() {
-    parser.panicMode = false;
-    while (parser.current.type != TOKEN_EOF) {
-        if (parser.previous.type == TOKEN_SEMICOLON) return;
-        switch (parser.current.type) {
+static void synchronize(Parser* parser) {
+    parser->panicMode = false;
+    while (parser->current.type != TOKEN_EOF) {
+        if (parser->previous.type == TOKEN_SEMICOLON) return;
+        switch (parser->current.type) {
             case TOKEN_CLASS:
             case TOKEN_FUN:
             case TOKEN_VAR:
@@ -1153,50 +1499,53 @@ static void synchronize() {
             case TOKEN_WHILE:
             case TOKEN_PRINT:
             case TOKEN_RETURN:
+            case TOKEN_IMPORT:
                 return;
             default:
                 ;   // DO NOTHING
         }
-        advance();
+        advance(parser);
     }
 }
 
 // maps different declaration (from our parsing grammar)
 //  declaration     -> classDecl | funDecl | varDecl | statement;
-static void declaration() {
-    if(match(TOKEN_CLASS)) {
-        classDeclaration();
-    } else if (match(TOKEN_FUN)) {
-        funDeclaration();
-    } else if (match(TOKEN_VAR)) {
-        varDeclaration();
+static void declaration(Parser* parser) {
+    if(match(parser, TOKEN_CLASS)) {
+        classDeclaration(parser);
+    } else if (match(parser, TOKEN_FUN)) {
+        funDeclaration(parser);
+    } else if (match(parser, TOKEN_VAR)) {
+        varDeclaration(parser);
     } else {
-        statement();                            // tries to parse tokens to find a statement
+        statement(parser);                      // tries to parse tokens to find a statement
     }
     
-    if (parser.panicMode) synchronize();        // encountered error -> we try to get back to a good state.
+    if (parser->panicMode) synchronize(parser); // encountered error -> we try to get back to a good state.
 }
 
 // Maps different kinds of statements (from our parsing grammar)
-// statement        ->exprStmt | forStmt | ifStmt | printStmt | returnStmt | whileStmt | block;
+// statement        ->exprStmt | forStmt | ifStmt | printStmt | returnStmt | whileStmt | importStmt | block;
 // block            -> "{" declaration "}"
-static void statement() {
-    if (match(TOKEN_PRINT)) {
-        printStatement();
-    } else if (match(TOKEN_FOR)) {
-        forStatement();
-    } else if (match(TOKEN_IF)) {
-        ifStatement();
-    } else if (match(TOKEN_RETURN)) {
-        returnStatement();
-    } else if (match(TOKEN_WHILE)) {
-        whileStatement();
-    } else if (match(TOKEN_LEFT_BRACE)) {       // we need to go one scope deeper (block encountered)
-        beginScope();
-        block();
-        endScope();
+static void statement(Parser* parser) {
+    if (match(parser, TOKEN_PRINT)) {
+        printStatement(parser);
+    } else if (match(parser, TOKEN_FOR)) {
+        forStatement(parser);
+    } else if (match(parser, TOKEN_IF)) {
+        ifStatement(parser);
+    } else if (match(parser, TOKEN_RETURN)) {
+        returnStatement(parser);
+    } else if (match(parser, TOKEN_WHILE)) {
+        whileStatement(parser);
+    } else if (match(parser, TOKEN_IMPORT)) {
+        importStatement(parser);
+    } else if (match(parser, TOKEN_LEFT_BRACE)) { // we need to go one scope deeper (block encountered)
+        beginScope(parser);
+        block(parser);
+        endScope(parser);
     } else {
-        expressionStatement();
+        expressionStatement(parser);
     }
 }
 
@@ -1206,33 +1555,91 @@ static void statement() {
 *
 */
 
+// helper for compileScript(), compileLazy() - fresh state for compiling source.
+// - the gc waits till we are done (see endParser()), so nothing the compiler holds on to has to be a root
+static void initParser(Parser* parser, const char* path) {
+    parser->hadError = false;
+    parser->panicMode = false;
+    parser->path = path;
+    parser->quiet = false;
+    parser->compiler = NULL;
+    parser->currentClass = NULL;
+    initArena(&parser->arena);
+    pauseGC();
+}
+
+// helper for compileScript(), compileLazy() - the compiled functions are reachable from the caller from now on
+static void endParser(Parser* parser) {
+    freeArena(&parser->arena);
+    resumeGC();
+}
+
 // we pass in the source code string, then try to compile the source 
 // - we compile bytecode and write it to the Chunk (that is stored in the ObjFunction, that is stored in the Compiler)
 // - to enable functions (that may exists in toplevel or another function) we return the compiled ObjFunction* 
 //      - we treat toplevel as a ObjFunction with name NULL
 // - if compilation fails we return false (compilation error) to upstread disregard the whole chunk
-ObjFunction* compile(const char* source) {
-    initScanner(source);
+ObjFunction* compile(const char* source, size_t length) {
+    return compileScript(source, length, NULL);
+}
+
+// helper for compileScript(), compileQuietly()
+static ObjFunction* compileSource(const char* source, size_t length, const char* path, bool quiet) {
+    Parser parser;
+    initParser(&parser, path);
+    parser.quiet = quiet;
+    initScanner(&parser.scanner, source, length);
     Compiler compiler;                          // set up our compiler
-    initCompiler(&compiler, TYPE_SCRIPT);       // we start compiling top-level (TYPE_SCRIPT)
-    // 'initialize' our Error-FLAGS:
-    parser.hadError = false;
-    parser.panicMode = false;
+    initCompiler(&parser, &compiler, TYPE_SCRIPT);      // we start compiling top-level (TYPE_SCRIPT)
 
-    advance();                                  // primes the scanner
-    while (!match(TOKEN_EOF)) {
-        declaration();                          // this will consume tokens and try to find declaration -> statements etc. (accoring to our lox-syntax)
+    advance(&parser);                           // primes the scanner
+    while (!match(&parser, TOKEN_EOF)) {
+        declaration(&parser);                   // this will consume tokens and try to find declaration -> statements etc. (accoring to our lox-syntax)
     }
-    ObjFunction* function = endCompiler();      // Calls and Functions call-end-compiler
+    ObjFunction* function = endCompiler(&parser);       // Calls and Functions call-end-compiler
+    endParser(&parser);
     return parser.hadError ? NULL : function;   //  if we encountered compile-time-errors we return NULL, else return the ObjFunction with the bytecode
 }
 
-// used for GC - if GC starts while were still compiling -> we need to GC the compiler-structs aswell
-// - so we walk all those and to mark every Obj still referenced
-void markCompilerRoots() {
-    Compiler* compiler = current;
-    while (compiler != NULL) {
-        markObject((Obj*)compiler->function);
-        compiler = compiler->enclosing;
-    }
-}
\ No newline at end of file
+// like compile(), but errors start with the path of the script (NULL -> they dont)
+ObjFunction* compileScript(const char* source, size_t length, const char* path) {
+    return compileSource(source, length, path, false);
+}
+
+// like compile(), but compile errors dont get reported. (modules compiled ahead of time, if it fails the import
+// compiles it again and that one reports them)
+ObjFunction* compileQuietly(const char* source, size_t length) {
+    return compileSource(source, length, NULL, true);
+}
+
+// compiles the body of a lazy function (--lazy) the first time it gets called. Its upvalues were already captured by the stub.
+// - returns false if the body has a compile error (the error got reported like any other compile error)
+bool compileLazy(ObjFunction* function) {
+    LazyFunction* lazy = function->lazy;
+    Parser parser;
+    initParser(&parser, NULL);
+    initScannerAt(&parser.scanner, lazy->source->chars, lazy->source->length, lazy->line, lazy->column);
+    ClassCompiler classCompiler;                // methods can hold functions that use this or super
+    classCompiler.enclosing = NULL;
+    classCompiler.hasSuperclass = lazy->hasSuperclass;
+    parser.currentClass = lazy->inClass ? &classCompiler : NULL;
+    parser.current.type = TOKEN_IDENTIFIER;     // initCompiler() names the new function after the previous token
+    parser.current.start = function->name->chars;
+    parser.current.length = function->name->length;
+    parser.current.line = lazy->line;
+    parser.current.column = lazy->column;
+    advance(&parser);                           // -> now the '(' is the current token
+
+    Compiler compiler;
+    ObjFunction* compiled = functionBody(&parser, &compiler, TYPE_FUNCTION, lazy);
+    endParser(&parser);
+    if (parser.hadError) return false;
+    function->arity = compiled->arity;          // move the compiled code over into the stub that the closures already point to
+    function->chunk = compiled->chunk;
+    function->regChunk = compiled->regChunk;
+    function->maxRegisters = compiled->maxRegisters;
+    initChunk(&compiled->chunk);
+    initChunk(&compiled->regChunk);
+    freeLazyFunction(function);
+    return true;
+}
@@ -4,7 +4,11 @@
 #include "object.h"
 #include "vm.h"
 
-ObjFunction* compile(const char* source);
-void markCompilerRoots();
+extern bool FLAG_LAZY;      // --lazy: compile the bodies of fun declarations when they get called the first time
+
+ObjFunction* compile(const char* source, size_t length);
+ObjFunction* compileScript(const char* source, size_t length, const char* path);
+ObjFunction* compileQuietly(const char* source, size_t length);
+bool compileLazy(ObjFunction* function);
 
 #endif
\ No newline at end of file
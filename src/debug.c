@@ -2,6 +2,7 @@
 
 #include "debug.h"
 #include "object.h"
+#include "register.h"
 #include "value.h"
 
 // dis-assemles ALL the instructions in the entire chunk.
@@ -15,6 +16,22 @@ void disassembleChunk(Chunk* chunk, const char* name) {
     }
 }
 
+// prints what the optimizer did to a chunk (--dump-opt): first the original instructions, each marked with
+// '-' if it got removed or '~' if it got rewritten (replaced opcode or jump that lands somewhere else). Then the optimized chunk.
+void disassembleComparison(const char* name, Chunk* before, Chunk* after, const char* changes) {
+    printf("== %s (before optimizing) ==\n", name);
+    for (int offset = 0; offset < before->count;) {
+        printf("%c ", changes[offset]);
+        offset = disassembleInstruction(before, offset);
+    }
+    printf("== %s (after optimizing) ==\n", name);
+    for (int offset = 0; offset < after->count;) {
+        printf("  ");
+        offset = disassembleInstruction(after, offset);
+    }
+    printf("== %s: %d -> %d bytes ==\n", name, before->count, after->count);
+}
+
 /*
 // All supported Instructions and what debug-print out they map to #
 //  - (also how many bytes big they are) -> how much to increment the offset
@@ -55,22 +72,27 @@ static int constantInstruction(const char* name, Chunk* chunk, int offset) {
 // prints out info about the method invokation
 static int invokeInstruction(const char* name, Chunk* chunk, int offset) {
     uint8_t constant = chunk->code[offset + 1];
-    uint8_t argCount = chunk->code[offset + 1];
+    uint8_t argCount = chunk->code[offset + 2];
     printf("%-16s (%d args) %4d '", name, argCount, constant);
     printValue(chunk->constants.values[constant]);
     printf("'\n");
     return offset + 3;
 }
 
+// prints line:column the instruction at offset came from. The line is just a '|' if its the same as for the byte in front of it
+static void printPosition(Chunk* chunk, int offset) {
+    int line = getLine(chunk, offset);
+    if (offset > 0 && line == getLine(chunk, offset - 1)) {
+        printf("   |:%-4d ", getColumn(chunk, offset));
+    } else {
+        printf("%4d:%-4d ", line, getColumn(chunk, offset));
+    }
+}
+
 // Reads one byte and tries to match it with known Byte-Code-Instructions
 int disassembleInstruction(Chunk* chunk, int offset) {
     printf("%04d ", offset);        // first we print the byte offset of given instruction
-    // use the line info:
-    if (offset > 0 && chunk->lines[offset] == chunk->lines[offset-1]) {
-        printf("  | ");
-    } else {
-        printf("%4d ", chunk->lines[offset]);
-    }
+    printPosition(chunk, offset);
 
 
     uint8_t instruction = chunk->code[offset];
@@ -94,9 +116,11 @@ int disassembleInstruction(Chunk* chunk, int offset) {
         case OP_GET_GLOBAL:
             return constantInstruction("OP_GET_GLOBAL", chunk, offset);
         case OP_DEFINE_GLOBAL:
-            return simpleInstruction("OP_DEFINE_GLOBAL", offset);
+            return constantInstruction("OP_DEFINE_GLOBAL", chunk, offset);
         case OP_SET_GLOBAL:
             return constantInstruction("OP_SET_GLOBAL", chunk, offset);
+        case OP_IMPORT:
+            return constantInstruction("OP_IMPORT", chunk, offset);
         case OP_GET_UPVALUE:
             return byteInstruction("OP_GET_UPVALUE", chunk, offset);
         case OP_SET_UPVALUE:
@@ -132,6 +156,8 @@ int disassembleInstruction(Chunk* chunk, int offset) {
             return simpleInstruction("OP_PRINT", offset);
         case OP_CALL:
             return byteInstruction("OP_CALL", chunk, offset);
+        case OP_TAIL_CALL:
+            return byteInstruction("OP_TAIL_CALL", chunk, offset);
         case OP_INVOKE:
             return invokeInstruction("OP_INVOKE", chunk, offset);
         case OP_CLOSURE: {
@@ -171,7 +197,7 @@ int disassembleInstruction(Chunk* chunk, int offset) {
 
         /* CUSTOM implementations on top of Lox */
         case OP_ARRAY_BUILD:
-            return simpleInstruction("OP_ARRAY_BUILD", offset);
+            return byteInstruction("OP_ARRAY_BUILD", chunk, offset);
         case OP_LISTS_READ_IDX:
             return simpleInstruction("OP_ARRAY_READ_IDX", offset);
         case OP_LISTS_WRITE_IDX:
@@ -179,9 +205,142 @@ int disassembleInstruction(Chunk* chunk, int offset) {
         case OP_MODULO:
             return simpleInstruction("OP_MODULO", offset);
         case OP_MAP_BUILD:
-            return simpleInstruction("OP_MAP_BUILD", offset);
+            return byteInstruction("OP_MAP_BUILD", chunk, offset);
+        /* only emitted by the optimizer */
+        case OP_JUMP_IF_TRUE:
+            return jumpInstruction("OP_JUMP_IF_TRUE", 1, chunk, offset);    // +1 ->jumps forwards
+        case OP_SET_LOCAL_POP:
+            return byteInstruction("OP_SET_LOCAL_POP", chunk, offset);
+        case OP_POP_BELOW:
+            return byteInstruction("OP_POP_BELOW", chunk, offset);
+        /* quickened by the vm at runtime */
+        case OP_ADD_NUM_NUM:
+            return simpleInstruction("OP_ADD_NUM_NUM", offset);
+        case OP_INDEX_ARRAY_NUM:
+            return simpleInstruction("OP_INDEX_ARRAY_NUM", offset);
+        case OP_INDEX_MAP_STR:
+            return simpleInstruction("OP_INDEX_MAP_STR", offset);
+        case OP_STORE_ARRAY_NUM:
+            return simpleInstruction("OP_STORE_ARRAY_NUM", offset);
+        case OP_STORE_MAP_STR:
+            return simpleInstruction("OP_STORE_MAP_STR", offset);
+        case OP_GET_FIELD:
+            return constantInstruction("OP_GET_FIELD", chunk, offset);
         default:
             printf("Unknown opcode %d\n", instruction);
             return offset +1;
     }
 }
+
+/*
+// The register bytecode (--register)
+//  - registers print as r3, RK operands that are constants print their value: k'12'
+*/
+
+// helper for disassembleRegisterInstruction() - prints an operand that is a register or a constant
+static void printRK(ObjFunction* function, uint8_t operand) {
+    if (operand & RK_CONSTANT) {
+        printf(" k'");
+        printValue(function->chunk.constants.values[operand & ~RK_CONSTANT]);
+        printf("'");
+    } else {
+        printf(" r%d", operand);
+    }
+}
+
+void disassembleRegisterChunk(ObjFunction* function, const char* name) {
+    printf("== %s (registers: %d) ==\n", name, function->maxRegisters);
+    for (int offset = 0; offset < function->regChunk.count;) {
+        offset = disassembleRegisterInstruction(function, offset);
+    }
+}
+
+// the names of all register instructions (in the order of RegOpCode)
+static const char* registerOpNames[] = {
+    "REG_MOVE", "REG_LOADK", "REG_NIL", "REG_TRUE", "REG_FALSE", "REG_GET_GLOBAL", "REG_DEFINE_GLOBAL", "REG_SET_GLOBAL",
+    "REG_GET_UPVALUE", "REG_SET_UPVALUE", "REG_EQUAL", "REG_GREATER", "REG_LESS", "REG_ADD", "REG_SUBTRACT", "REG_MULTIPLY",
+    "REG_DIVIDE", "REG_MODULO", "REG_NOT", "REG_NEGATE", "REG_JUMP", "REG_LOOP", "REG_JUMP_IF_FALSE", "REG_JUMP_IF_TRUE",
+    "REG_PRINT", "REG_CALL", "REG_TAIL_CALL", "REG_CLOSURE", "REG_CLOSE_UPVALUE", "REG_RETURN",
+};
+
+int disassembleRegisterInstruction(ObjFunction* function, int offset) {
+    Chunk* chunk = &function->regChunk;
+    Value* constants = function->chunk.constants.values;
+    uint8_t* code = &chunk->code[offset];
+    printf("%04d ", offset);
+    printPosition(chunk, offset);
+    printf("%-18s", registerOpNames[code[0]]);
+
+    switch (code[0]) {
+        case REG_MOVE:
+            printf(" r%d r%d", code[1], code[2]);
+            break;
+        case REG_GET_UPVALUE:
+            printf(" r%d %d", code[1], code[2]);
+            break;
+        case REG_CALL:
+        case REG_TAIL_CALL:
+            printf(" r%d (%d args)", code[1], code[2]);
+            break;
+        case REG_LOADK:
+        case REG_GET_GLOBAL:
+            printf(" r%d '", code[1]);
+            printValue(constants[code[2]]);
+            printf("'");
+            break;
+        case REG_NIL:
+        case REG_TRUE:
+        case REG_FALSE:
+        case REG_CLOSE_UPVALUE:
+            printf(" r%d", code[1]);
+            break;
+        case REG_DEFINE_GLOBAL:
+        case REG_SET_GLOBAL:
+            printf(" '");
+            printValue(constants[code[1]]);
+            printf("'");
+            printRK(function, code[2]);
+            break;
+        case REG_SET_UPVALUE:
+            printf(" %d", code[1]);
+            printRK(function, code[2]);
+            break;
+        case REG_NOT:
+        case REG_NEGATE:
+            printf(" r%d", code[1]);
+            printRK(function, code[2]);
+            break;
+        case REG_PRINT:
+        case REG_RETURN:
+            printRK(function, code[1]);
+            break;
+        case REG_JUMP:
+        case REG_LOOP: {
+            int jump = (code[1] << 8) | code[2];
+            printf(" -> %d", code[0] == REG_LOOP ? offset + 3 - jump : offset + 3 + jump);
+            break;
+        }
+        case REG_JUMP_IF_FALSE:
+        case REG_JUMP_IF_TRUE:
+            printRK(function, code[1]);
+            printf(" -> %d", offset + 4 + ((code[2] << 8) | code[3]));
+            break;
+        case REG_CLOSURE: {
+            printf(" r%d ", code[1]);
+            printValue(constants[code[2]]);
+            printf("\n");
+            ObjFunction* closure = AS_FUNCTION(constants[code[2]]);
+            for (int j = 0; j < closure->upvalueCount; j++) {
+                printf("%04d      |                     %s %d\n", offset + 3 + 2 * j, code[3 + 2 * j] ? "local" : "upvalue", code[4 + 2 * j]);
+            }
+            return offset + registerInstructionLength(function, offset);
+        }
+        default:        // the binary operations: dst, rk, rk
+            printf(" r%d", code[1]);
+            printRK(function, code[2]);
+            printRK(function, code[3]);
+            break;
+    }
+    printf("\n");
+    return offset + registerInstructionLength(function, offset);
+}
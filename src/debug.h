@@ -2,8 +2,12 @@
 #define clox_debug_h
 
 #include "chunk.h"
+#include "object.h"
 
 void disassembleChunk(Chunk* chunk, const char* name);
 int disassembleInstruction(Chunk* chunk, int offset);
+void disassembleComparison(const char* name, Chunk* before, Chunk* after, const char* changes);
+void disassembleRegisterChunk(ObjFunction* function, const char* name);
+int disassembleRegisterInstruction(ObjFunction* function, int offset);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,906 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "array.h"
+#include "compiler.h"
+#include "image.h"
+#include "memory.h"
+#include "object.h"
+#include "optimizer.h"
+#include "register.h"
+#include "vm.h"
+
+#define IMAGE_MAGIC "LOXC"
+#define SNAPSHOT_MAGIC "LOXS"
+#define HEADER_SIZE 32              // magic, version, flags, source hash, metadata length, code offset, code length, checksum
+#define CODE_ALIGNMENT 4096         // the code section starts on its own page
+
+// tags of the values in the metadata
+typedef enum {
+    CONSTANT_NIL,
+    CONSTANT_FALSE,
+    CONSTANT_TRUE,
+    CONSTANT_NUMBER,
+    CONSTANT_STRING,                // images: the string follows
+    CONSTANT_FUNCTION,              // images: the function follows
+    CONSTANT_OBJECT,                // snapshots: the id of the object follows
+} ConstantTag;
+
+// every file we mapped. The chunks point into them, so they stay till freeImages()
+typedef struct MappedImage {
+    void* memory;
+    size_t length;
+    struct MappedImage* next;
+} MappedImage;
+
+static MappedImage* mappedImages = NULL;
+
+// FNV-1a - used for the hash of the source and the checksum of the image. Continues from hash (start with FNV_OFFSET)
+#define FNV_OFFSET 2166136261u
+static uint32_t hashBytes(uint32_t hash, const uint8_t* bytes, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+// the flags that change what the compiler emits. An image next to the script only gets used if they match
+static uint32_t compileFlags() {
+    return (uint32_t)FLAG_OPT_LEVEL | (FLAG_REGISTER_VM ? 0x100 : 0);
+}
+
+
+/*
+    Object ids (snapshots) - every object we write gets a number, references to it are written as that number.
+    - ids follow the order of objectRank(), so everything an object needs to get created has a smaller id (see restoreSnapshot())
+    - id 0 is NULL, id n is objects[n - 1]
+*/
+
+typedef struct {
+    Obj** objects;
+    int count;
+    int capacity;
+    int* index;             // hash of the object pointers -> position in objects (-1 = empty bucket)
+    int indexCapacity;
+} ObjectIds;
+
+// helper for findId()
+static uint32_t hashPointer(Obj* object) {
+    uint64_t bits = (uint64_t)(uintptr_t)object;
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdULL;
+    bits ^= bits >> 33;
+    return (uint32_t)bits;
+}
+
+// the bucket that holds object or the empty one it would go into
+static int* findId(ObjectIds* ids, Obj* object) {
+    uint32_t index = hashPointer(object) & (ids->indexCapacity - 1);
+    for (;;) {
+        int* bucket = &ids->index[index];
+        if (*bucket == -1 || ids->objects[*bucket] == object) return bucket;
+        index = (index + 1) & (ids->indexCapacity - 1);
+    }
+}
+
+// helper for addObject() and sortIds() - indexes all objects again
+static void rebuildIds(ObjectIds* ids, int capacity) {
+    FREE_ARRAY(int, ids->index, ids->indexCapacity);
+    ids->indexCapacity = capacity;
+    ids->index = ALLOCATE(int, capacity);
+    for (int i = 0; i < capacity; i++) ids->index[i] = -1;
+    for (int i = 0; i < ids->count; i++) *findId(ids, ids->objects[i]) = i;
+}
+
+static void addObject(ObjectIds* ids, Obj* object) {
+    if (object == NULL) return;
+    if (ids->indexCapacity > 0 && *findId(ids, object) != -1) return;
+    if (ids->capacity < ids->count + 1) {
+        int oldCapacity = ids->capacity;
+        ids->capacity = GROW_CAPACITY(oldCapacity);
+        ids->objects = GROW_ARRAY(Obj*, ids->objects, oldCapacity, ids->capacity);
+    }
+    ids->objects[ids->count++] = object;
+    if (ids->count * 4 > ids->indexCapacity * 3) {
+        rebuildIds(ids, ids->indexCapacity < 16 ? 16 : ids->indexCapacity * 2);
+    } else {
+        *findId(ids, object) = ids->count - 1;
+    }
+}
+
+static uint32_t objectId(ObjectIds* ids, Obj* object) {
+    return object == NULL ? 0 : *findId(ids, object) + 1;
+}
+
+static void freeIds(ObjectIds* ids) {
+    FREE_ARRAY(Obj*, ids->objects, ids->capacity);
+    FREE_ARRAY(int, ids->index, ids->indexCapacity);
+}
+
+// the order objects get created in when restoring. Each kind only needs ones of a smaller rank to get created
+static int objectRank(ObjType type) {
+    switch (type) {
+        case OBJ_STRING:        return 0;
+        case OBJ_NATIVE:        return 1;
+        case OBJ_FUNCTION:      return 2;
+        case OBJ_UPVALUE:       return 3;
+        case OBJ_CLASS:         return 4;       // its name
+        case OBJ_ARRAY:         return 5;
+        case OBJ_MAP:           return 6;
+        case OBJ_CLOSURE:       return 7;       // its function
+        case OBJ_INSTANCE:      return 8;       // its class
+        case OBJ_BOUND_METHOD:  return 9;       // receiver and method
+    }
+    return 0;
+}
+#define RANK_COUNT 10
+
+// helper for addReferences()
+static void addValue(ObjectIds* ids, Value value) {
+    if (IS_OBJ(value)) addObject(ids, AS_OBJ(value));
+}
+
+// helper for addReferences()
+static void addTable(ObjectIds* ids, Table* table) {
+    int cursor = 0;
+    for (Entry* entry = tableIterate(table, &cursor); entry != NULL; entry = tableIterate(table, &cursor)) {
+        addObject(ids, (Obj*)entry->key);
+        addValue(ids, entry->value);
+    }
+}
+
+// adds everything object points to. Like blackenObject() in memory.c, just collecting instead of marking.
+// - returns false for what a snapshot cant hold (an upvalue still pointing into the stack)
+static bool addReferences(ObjectIds* ids, Obj* object) {
+    switch (object->type) {
+        case OBJ_STRING:
+        case OBJ_NATIVE:
+            break;
+        case OBJ_FUNCTION: {
+            ObjFunction* function = (ObjFunction*)object;
+            if (function->lazy != NULL && !compileLazy(function)) return false;    // --lazy: never got called, so it has no code yet
+            if (function->module != NULL) return false;     // imported: it uses the globals of its module, not the ones we save
+            addObject(ids, (Obj*)function->name);
+            for (int i = 0; i < function->chunk.constants.count; i++) addValue(ids, function->chunk.constants.values[i]);
+            for (int i = 0; i < function->chunk.inlinedCount; i++) addObject(ids, (Obj*)function->chunk.inlined[i].name);
+            for (int i = 0; i < function->regChunk.inlinedCount; i++) addObject(ids, (Obj*)function->regChunk.inlined[i].name);
+            break;
+        }
+        case OBJ_UPVALUE: {
+            ObjUpvalue* upvalue = (ObjUpvalue*)object;
+            if (upvalue->location != &upvalue->closed) return false;
+            addValue(ids, upvalue->closed);
+            break;
+        }
+        case OBJ_CLASS:
+            addObject(ids, (Obj*)((ObjClass*)object)->name);
+            addTable(ids, &((ObjClass*)object)->methods);
+            break;
+        case OBJ_ARRAY: {
+            ObjArray* array = (ObjArray*)object;
+            for (int i = 0; i < array->count; i++) addValue(ids, ARRAY_SLOT(array, i));
+            break;
+        }
+        case OBJ_MAP:
+            addTable(ids, &((ObjMap*)object)->table);
+            break;
+        case OBJ_CLOSURE: {
+            ObjClosure* closure = (ObjClosure*)object;
+            addObject(ids, (Obj*)closure->function);
+            for (int i = 0; i < closure->upvalueCount; i++) addObject(ids, (Obj*)closure->upvalues[i]);
+            break;
+        }
+        case OBJ_INSTANCE:
+            addObject(ids, (Obj*)((ObjInstance*)object)->pClass);
+            addTable(ids, &((ObjInstance*)object)->fields);
+            break;
+        case OBJ_BOUND_METHOD:
+            addValue(ids, ((ObjBoundMethod*)object)->receiver);
+            addObject(ids, (Obj*)((ObjBoundMethod*)object)->method);
+            break;
+    }
+    return true;
+}
+
+// puts the objects in the order of objectRank() (keeping the order within a rank)
+static void sortIds(ObjectIds* ids) {
+    Obj** sorted = ALLOCATE(Obj*, ids->capacity);
+    int count = 0;
+    for (int rank = 0; rank < RANK_COUNT; rank++) {
+        for (int i = 0; i < ids->count; i++) {
+            if (objectRank(ids->objects[i]->type) == rank) sorted[count++] = ids->objects[i];
+        }
+    }
+    FREE_ARRAY(Obj*, ids->objects, ids->capacity);
+    ids->objects = sorted;
+    rebuildIds(ids, ids->indexCapacity);
+}
+
+
+/*
+    Writing - the metadata (functions, constants, objects) and the code section (bytecode and line tables) get written into
+    two buffers, the metadata refers to the code by offset and length.
+*/
+
+typedef struct {
+    uint8_t* bytes;
+    int count;
+    int capacity;
+} Buffer;
+
+typedef struct {
+    Buffer meta;
+    Buffer code;
+    bool failed;            // hit something we cant write
+    ObjectIds* ids;         // snapshots write objects as their id. NULL for images, those write strings and functions inline
+} Writer;
+
+static void saveByte(Buffer* buffer, uint8_t byte) {
+    if (buffer->capacity < buffer->count + 1) {
+        int oldCapacity = buffer->capacity;
+        buffer->capacity = GROW_CAPACITY(oldCapacity);
+        buffer->bytes = GROW_ARRAY(uint8_t, buffer->bytes, oldCapacity, buffer->capacity);
+    }
+    buffer->bytes[buffer->count++] = byte;
+}
+
+static void saveBytes(Buffer* buffer, const uint8_t* bytes, int length) {
+    for (int i = 0; i < length; i++) saveByte(buffer, bytes[i]);
+}
+
+static void saveInt(Buffer* buffer, uint32_t value) {
+    for (int i = 0; i < 4; i++) saveByte(buffer, (value >> (8 * i)) & 0xff);
+}
+
+static void saveString(Buffer* buffer, ObjString* string) {
+    saveInt(buffer, string->length);
+    saveBytes(buffer, (const uint8_t*)string->chars, string->length);
+}
+
+// a string the metadata refers to: its id in snapshots, the string itself in images
+static void saveStringRef(Writer* writer, ObjString* string) {
+    if (writer->ids != NULL) {
+        saveInt(&writer->meta, objectId(writer->ids, (Obj*)string));
+    } else {
+        saveString(&writer->meta, string);
+    }
+}
+
+// bytes go into the code section, the metadata gets where they are
+static void saveSection(Writer* writer, const uint8_t* bytes, int length) {
+    saveInt(&writer->meta, writer->code.count);
+    saveInt(&writer->meta, length);
+    saveBytes(&writer->code, bytes, length);
+}
+
+static void saveFunction(Writer* writer, ObjFunction* function);
+
+// a constant of a function (images) or any value (snapshots)
+static void saveConstant(Writer* writer, Value value) {
+    Buffer* meta = &writer->meta;
+    if (IS_NIL(value)) {
+        saveByte(meta, CONSTANT_NIL);
+    } else if (IS_BOOL(value)) {
+        saveByte(meta, AS_BOOL(value) ? CONSTANT_TRUE : CONSTANT_FALSE);
+    } else if (IS_NUMBER(value)) {
+        uint64_t bits;
+        double number = AS_NUMBER(value);
+        memcpy(&bits, &number, sizeof(double));
+        saveByte(meta, CONSTANT_NUMBER);
+        saveInt(meta, (uint32_t)bits);
+        saveInt(meta, (uint32_t)(bits >> 32));
+    } else if (writer->ids != NULL) {
+        saveByte(meta, CONSTANT_OBJECT);
+        saveInt(meta, objectId(writer->ids, AS_OBJ(value)));
+    } else if (IS_STRING(value)) {
+        saveByte(meta, CONSTANT_STRING);
+        saveString(meta, AS_STRING(value));
+    } else if (IS_FUNCTION(value)) {
+        saveByte(meta, CONSTANT_FUNCTION);
+        saveFunction(writer, AS_FUNCTION(value));
+    } else {
+        writer->failed = true;          // the compiler only ever makes the ones above
+    }
+}
+
+// code, line table and inlined calls. (the constants only get written for the stack bytecode, the register bytecode shares them)
+// helper for saveChunk() - the generic instruction a quickened one was rewritten from (any other op stays as it is)
+static uint8_t genericOp(uint8_t op) {
+    switch (op) {
+        case OP_ADD_NUM_NUM:        return OP_ADD;
+        case OP_INDEX_ARRAY_NUM:
+        case OP_INDEX_MAP_STR:      return OP_LISTS_READ_IDX;
+        case OP_STORE_ARRAY_NUM:
+        case OP_STORE_MAP_STR:      return OP_LISTS_WRITE_IDX;
+        case OP_GET_FIELD:          return OP_GET_PROPERTY;
+        default:                    return op;
+    }
+}
+
+// isStack -> the chunk has stack vm code, its quickened instructions get written as the generic ones. Mapped code never gets
+// quickened (or turned back), so it has to start out generic. (ex. a snapshot of functions that already ran)
+static void saveChunk(Writer* writer, Chunk* chunk, bool isStack) {
+    Buffer* meta = &writer->meta;
+    int start = writer->code.count;
+    saveSection(writer, chunk->code, chunk->count);
+    for (int offset = 0; isStack && offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        writer->code.bytes[start + offset] = genericOp(chunk->code[offset]);
+    }
+    saveSection(writer, chunk->lines, chunk->lineCount);
+    saveInt(meta, chunk->lastOffset);
+    saveInt(meta, chunk->lastLine);
+    saveInt(meta, chunk->lastColumn);
+    saveInt(meta, chunk->inlinedCount);
+    for (int i = 0; i < chunk->inlinedCount; i++) {
+        InlinedCall* call = &chunk->inlined[i];
+        saveInt(meta, call->start);
+        saveInt(meta, call->end);
+        saveInt(meta, call->line);
+        saveStringRef(writer, call->name);
+    }
+}
+
+static void saveFunction(Writer* writer, ObjFunction* function) {
+    Buffer* meta = &writer->meta;
+    if (function->lazy != NULL) writer->failed = true;     // only has source yet (--lazy)
+    saveByte(meta, function->name != NULL);
+    if (function->name != NULL) saveStringRef(writer, function->name);
+    saveInt(meta, function->arity);
+    saveInt(meta, function->upvalueCount);
+    saveInt(meta, function->maxRegisters);
+    saveByte(meta, function->accessor);
+    // the field of an accessor is one of the constants, we just write its index
+    int field = -1;
+    for (int i = 0; function->field != NULL && i < function->chunk.constants.count; i++) {
+        Value constant = function->chunk.constants.values[i];
+        if (IS_STRING(constant) && AS_STRING(constant) == function->field) field = i;
+    }
+    saveInt(meta, (uint32_t)field);
+
+    saveChunk(writer, &function->chunk, true);
+    saveInt(meta, function->chunk.constants.count);
+    for (int i = 0; i < function->chunk.constants.count; i++) {
+        saveConstant(writer, function->chunk.constants.values[i]);
+    }
+    saveChunk(writer, &function->regChunk, false);
+}
+
+// helper for writeFile() - writes count bytes, false if that failed
+static bool writeBytes(FILE* file, const uint8_t* bytes, size_t count) {
+    return count == 0 || fwrite(bytes, 1, count, file) == count;
+}
+
+// writes header, metadata and code section to path (and frees the buffers of the writer)
+static bool writeFile(const char* path, const char* magic, uint32_t sourceHash, Writer* writer) {
+    uint32_t codeOffset = (HEADER_SIZE + writer->meta.count + CODE_ALIGNMENT - 1) / CODE_ALIGNMENT * CODE_ALIGNMENT;
+    uint32_t checksum = hashBytes(FNV_OFFSET, writer->meta.bytes, writer->meta.count);
+    checksum = hashBytes(checksum, writer->code.bytes, writer->code.count);
+    uint32_t header[] = {IMAGE_VERSION, compileFlags(), sourceHash, writer->meta.count, codeOffset, writer->code.count, checksum};
+    Buffer head = {NULL, 0, 0};
+    saveBytes(&head, (const uint8_t*)magic, 4);
+    for (int i = 0; i < 7; i++) saveInt(&head, header[i]);
+    while (head.count < (int)codeOffset - writer->meta.count) saveByte(&head, 0);  // padding goes behind the metadata
+
+    bool ok = !writer->failed;
+    if (ok) {
+        FILE* file = fopen(path, "wb");
+        ok = file != NULL && writeBytes(file, head.bytes, HEADER_SIZE)
+            && writeBytes(file, writer->meta.bytes, writer->meta.count)
+            && writeBytes(file, head.bytes + HEADER_SIZE, head.count - HEADER_SIZE)
+            && writeBytes(file, writer->code.bytes, writer->code.count);
+        if (file != NULL && fclose(file) != 0) ok = false;
+        if (!ok) fprintf(stderr, "Could not write \"%s\".\n", path);
+    }
+    FREE_ARRAY(uint8_t, head.bytes, head.capacity);
+    FREE_ARRAY(uint8_t, writer->meta.bytes, writer->meta.capacity);
+    FREE_ARRAY(uint8_t, writer->code.bytes, writer->code.capacity);
+    return ok;
+}
+
+// writes the compiled script to path. source is what it got compiled from (so the image can tell when it is stale)
+bool writeImage(ObjFunction* function, const char* source, size_t sourceLength, const char* path) {
+    push(OBJ_VAL(function));            // growing the buffers might start the gc
+    Writer writer = {{NULL, 0, 0}, {NULL, 0, 0}, false, NULL};
+    saveFunction(&writer, function);
+    pop();
+    if (writer.failed) fprintf(stderr, "Could not write image \"%s\": unsupported constant.\n", path);
+    return writeFile(path, IMAGE_MAGIC, hashBytes(FNV_OFFSET, (const uint8_t*)source, sourceLength), &writer);
+}
+
+// helper for writeSnapshot() - the table as count + (key id, value) pairs
+static void saveTable(Writer* writer, Table* table) {
+    int count = 0;
+    int cursor = 0;
+    while (tableIterate(table, &cursor) != NULL) count++;
+    saveInt(&writer->meta, count);
+    cursor = 0;
+    for (Entry* entry = tableIterate(table, &cursor); entry != NULL; entry = tableIterate(table, &cursor)) {
+        saveInt(&writer->meta, objectId(writer->ids, (Obj*)entry->key));
+        saveConstant(writer, entry->value);
+    }
+}
+
+// helper for writeSnapshot() - what restoreSnapshot() needs to create the object (it only refers to ones with smaller ids)
+static void saveShell(Writer* writer, Obj* object) {
+    Buffer* meta = &writer->meta;
+    saveByte(meta, object->type);
+    switch (object->type) {
+        case OBJ_STRING:        saveString(meta, (ObjString*)object); break;
+        case OBJ_FUNCTION:      saveInt(meta, ((ObjFunction*)object)->upvalueCount); break;
+        case OBJ_CLASS:         saveInt(meta, objectId(writer->ids, (Obj*)((ObjClass*)object)->name)); break;
+        case OBJ_CLOSURE:       saveInt(meta, objectId(writer->ids, (Obj*)((ObjClosure*)object)->function)); break;
+        case OBJ_INSTANCE:      saveInt(meta, objectId(writer->ids, (Obj*)((ObjInstance*)object)->pClass)); break;
+        case OBJ_NATIVE: {
+            int index = nativeIndex(((ObjNative*)object)->function);
+            if (index == -1) writer->failed = true;
+            saveInt(meta, (uint32_t)index);
+            break;
+        }
+        case OBJ_BOUND_METHOD:
+            saveConstant(writer, ((ObjBoundMethod*)object)->receiver);
+            saveInt(meta, objectId(writer->ids, (Obj*)((ObjBoundMethod*)object)->method));
+            break;
+        case OBJ_UPVALUE:
+        case OBJ_ARRAY:
+        case OBJ_MAP:
+            break;
+    }
+}
+
+// helper for writeSnapshot() - the rest of the object, once all objects exist
+static void saveBody(Writer* writer, Obj* object) {
+    Buffer* meta = &writer->meta;
+    switch (object->type) {
+        case OBJ_FUNCTION:      saveFunction(writer, (ObjFunction*)object); break;
+        case OBJ_UPVALUE:       saveConstant(writer, ((ObjUpvalue*)object)->closed); break;
+        case OBJ_CLASS:         saveTable(writer, &((ObjClass*)object)->methods); break;
+        case OBJ_MAP:           saveTable(writer, &((ObjMap*)object)->table); break;
+        case OBJ_INSTANCE:      saveTable(writer, &((ObjInstance*)object)->fields); break;
+        case OBJ_ARRAY: {
+            ObjArray* array = (ObjArray*)object;
+            saveInt(meta, array->count);                // slices get their own copy, they dont share the store anymore
+            for (int i = 0; i < array->count; i++) saveConstant(writer, ARRAY_SLOT(array, i));
+            break;
+        }
+        case OBJ_CLOSURE: {
+            ObjClosure* closure = (ObjClosure*)object;
+            saveInt(meta, closure->upvalueCount);
+            for (int i = 0; i < closure->upvalueCount; i++) saveInt(meta, objectId(writer->ids, (Obj*)closure->upvalues[i]));
+            break;
+        }
+        case OBJ_STRING:
+        case OBJ_NATIVE:
+        case OBJ_BOUND_METHOD:
+            break;
+    }
+}
+
+// writes the globals and everything reachable from them to path. (the vm is done running, so no stack or open upvalues)
+bool writeSnapshot(const char* path) {
+    ObjectIds ids = {NULL, 0, 0, NULL, 0};
+    int cursor = 0;
+    for (Entry* entry = tableIterate(&vm.globals, &cursor); entry != NULL; entry = tableIterate(&vm.globals, &cursor)) {
+        addObject(&ids, (Obj*)entry->key);
+        addValue(&ids, entry->value);
+    }
+    bool ok = true;
+    for (int i = 0; i < ids.count; i++) {       // addReferences() appends, so this walks everything reachable
+        if (!addReferences(&ids, ids.objects[i])) ok = false;
+    }
+    sortIds(&ids);
+
+    Writer writer = {{NULL, 0, 0}, {NULL, 0, 0}, !ok, &ids};
+    saveInt(&writer.meta, ids.count);
+    for (int i = 0; i < ids.count; i++) saveShell(&writer, ids.objects[i]);
+    for (int i = 0; i < ids.count; i++) saveBody(&writer, ids.objects[i]);
+    saveTable(&writer, &vm.globals);
+    freeIds(&ids);
+    if (writer.failed) fprintf(stderr, "Could not write snapshot \"%s\": the heap holds something we cant write.\n", path);
+    return writeFile(path, SNAPSHOT_MAGIC, 0, &writer);
+}
+
+
+/*
+    Reading - the file gets mapped into memory and the chunks use their code and line tables right where they are in the
+    mapping (no copy, not counted by the gc). Only constants and objects get created on the heap.
+    - the mapping is read only, so all its pages stay shared (through the page cache) with every other process running the
+      same image. That is why the vm never quickens mapped code (see QUICKEN in vm.c), images run the generic instructions.
+    - every read is bounds checked, a truncated or corrupt file just makes loading fail.
+*/
+
+typedef struct {
+    const uint8_t* at;      // in the metadata
+    const uint8_t* end;
+    uint8_t* code;          // the code section
+    uint32_t codeLength;
+    bool failed;
+    int depth;              // of nested functions, so a corrupt file cant make us recurse forever
+    ObjArray* objects;      // snapshots: the objects by id (id n at index n - 1), NULL for images
+} Reader;
+
+static uint8_t loadByte(Reader* reader) {
+    if (reader->at >= reader->end) {
+        reader->failed = true;
+        return 0;
+    }
+    return *reader->at++;
+}
+
+static uint32_t loadInt(Reader* reader) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) value |= (uint32_t)loadByte(reader) << (8 * i);
+    return value;
+}
+
+// a length/count that has to fit into the rest of the metadata (each entry at least size bytes)
+static int loadCount(Reader* reader, int size) {
+    uint32_t count = loadInt(reader);
+    if ((size_t)count * size > (size_t)(reader->end - reader->at)) {
+        reader->failed = true;
+        return 0;
+    }
+    return (int)count;
+}
+
+static ObjString* loadString(Reader* reader) {
+    int length = loadCount(reader, 1);
+    if (reader->failed) return NULL;
+    ObjString* string = copyString((const char*)reader->at, length);   // interns it again
+    reader->at += length;
+    return string;
+}
+
+// an object by its id, that has to exist already and be of that type. (NULL for id 0)
+static Obj* loadObject(Reader* reader, ObjType type, bool anyType) {
+    uint32_t id = loadInt(reader);
+    if (reader->failed || id == 0) return NULL;
+    if (id > (uint32_t)reader->objects->count) {
+        reader->failed = true;
+        return NULL;
+    }
+    Obj* object = AS_OBJ(ARRAY_SLOT(reader->objects, id - 1));
+    if (!anyType && object->type != type) reader->failed = true;
+    return object;
+}
+
+// the counterpart of saveStringRef()
+static ObjString* loadStringRef(Reader* reader) {
+    if (reader->objects == NULL) return loadString(reader);
+    ObjString* string = (ObjString*)loadObject(reader, OBJ_STRING, false);
+    if (string == NULL) reader->failed = true;
+    return string;
+}
+
+// where bytes in the code section are (NULL if there are none)
+static uint8_t* loadSection(Reader* reader, int* length) {
+    uint32_t offset = loadInt(reader);
+    uint32_t count = loadInt(reader);
+    if (offset > reader->codeLength || count > reader->codeLength - offset) reader->failed = true;
+    if (reader->failed || count == 0) {
+        *length = 0;
+        return NULL;
+    }
+    *length = (int)count;
+    return reader->code + offset;
+}
+
+static void loadChunk(Reader* reader, Chunk* chunk) {
+    chunk->mapped = true;
+    chunk->code = loadSection(reader, &chunk->count);
+    chunk->capacity = chunk->count;
+    chunk->lines = loadSection(reader, &chunk->lineCount);
+    chunk->lineCapacity = chunk->lineCount;
+    chunk->lastOffset = loadInt(reader);
+    chunk->lastLine = loadInt(reader);
+    chunk->lastColumn = loadInt(reader);
+    int inlinedCount = loadCount(reader, 16);
+    for (int i = 0; i < inlinedCount && !reader->failed; i++) {
+        int start = loadInt(reader);
+        int end = loadInt(reader);
+        int line = loadInt(reader);
+        ObjString* name = loadStringRef(reader);
+        if (reader->failed) return;
+        push(OBJ_VAL(name));
+        addInlinedCall(chunk, start, end, line, name);
+        pop();
+    }
+}
+
+static ObjFunction* loadFunction(Reader* reader);
+
+static Value loadConstant(Reader* reader) {
+    switch (loadByte(reader)) {
+        case CONSTANT_NIL:      return NIL_VAL;
+        case CONSTANT_FALSE:    return BOOL_VAL(false);
+        case CONSTANT_TRUE:     return BOOL_VAL(true);
+        case CONSTANT_NUMBER: {
+            uint64_t bits = loadInt(reader);
+            bits |= (uint64_t)loadInt(reader) << 32;
+            double number;
+            memcpy(&number, &bits, sizeof(double));
+            return NUMBER_VAL(number);
+        }
+        case CONSTANT_STRING:
+            if (reader->objects == NULL) {
+                ObjString* string = loadString(reader);
+                if (!reader->failed) return OBJ_VAL(string);
+            }
+            break;
+        case CONSTANT_FUNCTION:
+            if (reader->objects == NULL) {
+                ObjFunction* function = loadFunction(reader);
+                if (!reader->failed) return OBJ_VAL(function);
+            }
+            break;
+        case CONSTANT_OBJECT:
+            if (reader->objects != NULL) {
+                Obj* object = loadObject(reader, OBJ_STRING, true);
+                if (object != NULL) return OBJ_VAL(object);
+            }
+            break;
+    }
+    reader->failed = true;              // unknown tag, or a kind of constant the file cant have
+    return NIL_VAL;
+}
+
+// fills in the function. (it has to be reachable for the gc already)
+static void loadFunctionBody(Reader* reader, ObjFunction* function) {
+    if (++reader->depth > UINT8_COUNT) {
+        reader->failed = true;
+        return;
+    }
+    if (loadByte(reader)) function->name = loadStringRef(reader);
+    function->arity = loadInt(reader);
+    function->upvalueCount = loadInt(reader);
+    function->maxRegisters = loadInt(reader);
+    function->accessor = (AccessorType)loadByte(reader);
+    int field = (int)loadInt(reader);
+
+    loadChunk(reader, &function->chunk);
+    int constantCount = loadCount(reader, 1);
+    for (int i = 0; i < constantCount && !reader->failed; i++) {
+        Value constant = loadConstant(reader);
+        if (!reader->failed) addConstant(&function->chunk, constant);
+    }
+    loadChunk(reader, &function->regChunk);
+
+    if (field >= 0 && field < function->chunk.constants.count && IS_STRING(function->chunk.constants.values[field])) {
+        function->field = AS_STRING(function->chunk.constants.values[field]);
+    } else if (field != -1 || function->accessor > ACCESSOR_SETTER) {
+        reader->failed = true;
+    }
+    if (function->accessor != ACCESSOR_NONE && function->field == NULL) reader->failed = true;
+    reader->depth--;
+}
+
+static ObjFunction* loadFunction(Reader* reader) {
+    ObjFunction* function = newFunction();
+    push(OBJ_VAL(function));            // keeps it (and everything we hang on it) save from the gc while we load
+    loadFunctionBody(reader, function);
+    pop();
+    return function;
+}
+
+// maps the file at path and checks its header (magic, version, sections and checksum).
+// - sets up reader for the metadata, memory and length get the mapping (the caller unmaps it or keeps it with keepMapping())
+static bool mapFile(const char* path, const char* magic, Reader* reader, uint8_t** memory, size_t* length,
+                    uint32_t* flags, uint32_t* sourceHash) {
+    int file = open(path, O_RDONLY);
+    if (file < 0) return false;
+    struct stat info;
+    void* mapped = MAP_FAILED;
+    if (fstat(file, &info) == 0 && info.st_size >= HEADER_SIZE) {
+        mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    }
+    close(file);                        // the mapping keeps the file alive
+    if (mapped == MAP_FAILED) return false;
+    uint8_t* bytes = (uint8_t*)mapped;
+    *memory = bytes;
+    *length = info.st_size;
+
+    Reader header = {bytes + 4, bytes + HEADER_SIZE, NULL, 0, false, 0, NULL};
+    uint32_t version = loadInt(&header);
+    *flags = loadInt(&header);
+    *sourceHash = loadInt(&header);
+    uint32_t metaLength = loadInt(&header);
+    uint32_t codeOffset = loadInt(&header);
+    uint32_t codeLength = loadInt(&header);
+    uint32_t checksum = loadInt(&header);
+    bool ok = memcmp(bytes, magic, 4) == 0 && version == IMAGE_VERSION && codeOffset >= HEADER_SIZE
+        && metaLength <= codeOffset - HEADER_SIZE && codeOffset <= *length && codeLength == *length - codeOffset;
+    if (ok) {
+        uint32_t hash = hashBytes(FNV_OFFSET, bytes + HEADER_SIZE, metaLength);
+        ok = checksum == hashBytes(hash, bytes + codeOffset, codeLength);
+    }
+    if (!ok) {
+        munmap(mapped, *length);
+        return false;
+    }
+    *reader = (Reader){bytes + HEADER_SIZE, bytes + HEADER_SIZE + metaLength, bytes + codeOffset, codeLength, false, 0, NULL};
+    return true;
+}
+
+// keeps the mapping till freeImages(). (whatever we loaded from it has to be reachable for the gc)
+static void keepMapping(uint8_t* memory, size_t length) {
+    MappedImage* image = ALLOCATE(MappedImage, 1);
+    image->memory = memory;
+    image->length = length;
+    image->next = mappedImages;
+    mappedImages = image;
+}
+
+// maps the image at path and loads the script in it. With a source the image only gets used if it was compiled from
+// exactly that source (with the same flags), otherwise it is the script we run.
+// Returns NULL if there is no such file or the image is corrupt, stale or from another version.
+ObjFunction* mapImage(const char* path, const char* source, size_t sourceLength) {
+    Reader reader;
+    uint8_t* memory;
+    size_t length;
+    uint32_t flags, sourceHash;
+    if (!mapFile(path, IMAGE_MAGIC, &reader, &memory, &length, &flags, &sourceHash)) return NULL;
+    if (source != NULL && (flags != compileFlags()
+            || sourceHash != hashBytes(FNV_OFFSET, (const uint8_t*)source, sourceLength))) {
+        munmap(memory, length);
+        return NULL;
+    }
+
+    ObjFunction* function = loadFunction(&reader);
+    if (reader.failed || reader.at != reader.end) {
+        munmap(memory, length);         // what we loaded till then is garbage, freeing a mapped chunk never touches its code
+        return NULL;
+    }
+    push(OBJ_VAL(function));
+    keepMapping(memory, length);
+    pop();
+    return function;
+}
+
+// helper for restoreSnapshot() - creates the object from what saveShell() wrote
+static Obj* loadShell(Reader* reader) {
+    ObjType type = (ObjType)loadByte(reader);
+    if (reader->failed) return NULL;
+    switch (type) {
+        case OBJ_STRING:    return (Obj*)loadString(reader);
+        case OBJ_ARRAY:     return (Obj*)newArray();
+        case OBJ_MAP:       return (Obj*)newMap();
+        case OBJ_NATIVE: {
+            NativeFn function = nativeAt((int)loadInt(reader));
+            return function == NULL ? NULL : (Obj*)newNative(function);
+        }
+        case OBJ_FUNCTION: {
+            int upvalueCount = (int)loadInt(reader);
+            if (upvalueCount < 0 || upvalueCount > UINT8_COUNT) return NULL;
+            ObjFunction* function = newFunction();
+            function->upvalueCount = upvalueCount;      // so closures know how many upvalues they get
+            return (Obj*)function;
+        }
+        case OBJ_UPVALUE: {
+            ObjUpvalue* upvalue = newUpvalue(NULL);
+            upvalue->location = &upvalue->closed;       // its closed, the value comes with the body
+            return (Obj*)upvalue;
+        }
+        case OBJ_CLASS: {
+            ObjString* name = (ObjString*)loadObject(reader, OBJ_STRING, false);
+            return name == NULL ? NULL : (Obj*)newClass(name);
+        }
+        case OBJ_CLOSURE: {
+            ObjFunction* function = (ObjFunction*)loadObject(reader, OBJ_FUNCTION, false);
+            return function == NULL ? NULL : (Obj*)newClosure(function);
+        }
+        case OBJ_INSTANCE: {
+            ObjClass* pClass = (ObjClass*)loadObject(reader, OBJ_CLASS, false);
+            return pClass == NULL ? NULL : (Obj*)newInstance(pClass);
+        }
+        case OBJ_BOUND_METHOD: {
+            Value receiver = loadConstant(reader);
+            ObjClosure* method = (ObjClosure*)loadObject(reader, OBJ_CLOSURE, false);
+            return method == NULL ? NULL : (Obj*)newBoundMethod(receiver, method);
+        }
+    }
+    return NULL;
+}
+
+// helper for restoreSnapshot() - the counterpart of saveTable()
+static void loadTable(Reader* reader, Table* table) {
+    int count = loadCount(reader, 5);
+    for (int i = 0; i < count && !reader->failed; i++) {
+        ObjString* key = (ObjString*)loadObject(reader, OBJ_STRING, false);
+        Value value = loadConstant(reader);
+        if (key == NULL) reader->failed = true;
+        if (!reader->failed) tableSet(table, key, value);
+    }
+}
+
+// helper for restoreSnapshot() - fills in the object from what saveBody() wrote
+static void loadBody(Reader* reader, Obj* object) {
+    switch (object->type) {
+        case OBJ_FUNCTION: {
+            ObjFunction* function = (ObjFunction*)object;
+            int upvalueCount = function->upvalueCount;      // the closures already got made for that many
+            loadFunctionBody(reader, function);
+            if (function->upvalueCount != upvalueCount) reader->failed = true;
+            break;
+        }
+        case OBJ_UPVALUE:   ((ObjUpvalue*)object)->closed = loadConstant(reader); break;
+        case OBJ_CLASS:     loadTable(reader, &((ObjClass*)object)->methods); break;
+        case OBJ_MAP:       loadTable(reader, &((ObjMap*)object)->table); break;
+        case OBJ_INSTANCE:  loadTable(reader, &((ObjInstance*)object)->fields); break;
+        case OBJ_ARRAY: {
+            int count = loadCount(reader, 1);
+            for (int i = 0; i < count && !reader->failed; i++) {
+                Value value = loadConstant(reader);
+                if (!reader->failed) arrayAppendAtEnd((ObjArray*)object, value);
+            }
+            break;
+        }
+        case OBJ_CLOSURE: {
+            ObjClosure* closure = (ObjClosure*)object;
+            if ((int)loadInt(reader) != closure->upvalueCount) reader->failed = true;
+            for (int i = 0; i < closure->upvalueCount && !reader->failed; i++) {
+                closure->upvalues[i] = (ObjUpvalue*)loadObject(reader, OBJ_UPVALUE, false);
+            }
+            break;
+        }
+        case OBJ_STRING:
+        case OBJ_NATIVE:
+        case OBJ_BOUND_METHOD:
+            break;
+    }
+}
+
+// restores the globals (and everything they reach) from the snapshot at path. Instead of running the prelude again we just
+// create its objects and point them at each other: first every object (in id order, so what it needs already exists),
+// then their contents. Returns false if the snapshot is missing or corrupt.
+bool restoreSnapshot(const char* path) {
+    Reader reader;
+    uint8_t* memory;
+    size_t length;
+    uint32_t flags, sourceHash;
+    if (!mapFile(path, SNAPSHOT_MAGIC, &reader, &memory, &length, &flags, &sourceHash)) return false;
+
+    ObjArray* objects = newArray();
+    push(OBJ_VAL(objects));             // holds on to everything till the globals do
+    reader.objects = objects;
+    int count = loadCount(&reader, 1);
+    for (int i = 0; i < count && !reader.failed; i++) {
+        Obj* object = loadShell(&reader);
+        if (object == NULL) {
+            reader.failed = true;
+            break;
+        }
+        push(OBJ_VAL(object));
+        arrayAppendAtEnd(objects, OBJ_VAL(object));
+        pop();
+    }
+    for (int i = 0; i < count && !reader.failed; i++) {
+        loadBody(&reader, AS_OBJ(ARRAY_SLOT(objects, i)));
+    }
+    ObjMap* globals = newMap();         // only once everything worked out they become our globals
+    push(OBJ_VAL(globals));
+    loadTable(&reader, &globals->table);
+    bool ok = !reader.failed && reader.at == reader.end;
+    if (ok) {
+        tableAddAll(&globals->table, &vm.globals);
+        keepMapping(memory, length);
+    } else {
+        munmap(memory, length);         // what we loaded till then is garbage, freeing a mapped chunk never touches its code
+    }
+    pop();
+    pop();
+    return ok;
+}
+
+// unmaps all images, after all objects got freed (the chunks point into them)
+void freeImages() {
+    while (mappedImages != NULL) {
+        MappedImage* next = mappedImages->next;
+        munmap(mappedImages->memory, mappedImages->length);
+        FREE(MappedImage, mappedImages);
+        mappedImages = next;
+    }
+}
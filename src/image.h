@@ -0,0 +1,31 @@
+#ifndef clox_image_h
+#define clox_image_h
+
+#include "object.h"
+
+/*
+    Bytecode images (.loxc files) - the compiled ObjFunction tree of a script, so a later run can skip scanning and compiling.
+    - written with "--compile-only [-o file.loxc] script.lox". Running "file.loxc" loads the image instead of compiling,
+      running "script.lox" uses "script.loxc" next to it if the image was compiled from exactly this source (and the same flags).
+    - the file: a header (magic, version, flags, hash of the source, where the sections are, checksum) then two sections:
+        - metadata: the functions depth first (arity, names, inlined calls, constants...)
+        - code (page aligned): the bytecode and line tables of all chunks. Gets mapped and executed in place, see mapImage().
+    - strings get interned again on load, so they are the same objects as the ones the vm creates at runtime.
+    - everything is written little endian, numbers as their 8 bytes. Bump IMAGE_VERSION when opcodes or the layout change.
+
+    Heap snapshots (.loxs files) - the globals of a vm (and everything reachable from them) after it ran a prelude script.
+    - written with "--snapshot file.loxs prelude.lox", "--restore file.loxs script.lox" starts with those globals instead of
+      running the prelude again.
+    - same file layout as images. Every object gets an id, pointers get written as ids and turned back into pointers when
+      restoring (see restoreSnapshot()).
+*/
+
+#define IMAGE_VERSION 3
+
+bool writeImage(ObjFunction* function, const char* source, size_t sourceLength, const char* path);
+ObjFunction* mapImage(const char* path, const char* source, size_t sourceLength);
+bool writeSnapshot(const char* path);
+bool restoreSnapshot(const char* path);
+void freeImages();
+
+#endif
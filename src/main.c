@@ -1,10 +1,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "common.h"
+#include "check.h"
 #include "chunk.h"
+#include "compiler.h"
 #include "debug.h"
+#include "image.h"
+#include "module.h"
+#include "optimizer.h"
+#include "register.h"
+#include "scanner.h"
 #include "vm.h"
 
 // we define needed Flags: ( we could create flags from main(argv[]) from those) 
@@ -32,67 +40,297 @@ static void runRepl() {
 			break;
 		}
 
-		interpret(line);
+		interpret(line, strlen(line));
 	}
 }
 
-// helper for runFile - Manages allocation and file-read things. Gets array of chars of the file basically
-static char* readFile(const char* path) {
-	FILE* file = fopen(path, "rb"); // open file
-	// error handling - if opening file fails:
-	if (file == NULL) {
-		fprintf(stderr, "Could not open file \"%s\".\n", path);
-		exit(74);
+// helper for runFile - true if path ends with suffix
+static bool endsWith(const char* path, const char* suffix) {
+	size_t pathLength = strlen(path);
+	size_t suffixLength = strlen(suffix);
+	return pathLength >= suffixLength && strcmp(path + pathLength - suffixLength, suffix) == 0;
+}
+
+// other entrypoint than repl, but from a file.
+// - "file.loxc" runs the compiled image. For "script.lox" we use "script.loxc" instead of compiling, if its up to date.
+static void runFile(const char* path) {
+	InterpretResult result;
+	setMainScript(path);			// imports are relative to its directory
+	if (endsWith(path, ".loxc")) {
+		ObjFunction* function = mapImage(path, NULL, 0);
+		if (function == NULL) {
+			fprintf(stderr, "Could not load image \"%s\".\n", path);
+			exit(65);
+		}
+		result = interpretFunction(function);
+	} else {
+		size_t length;
+		bool mapped;
+		char* source = readSource(path, &length, &mapped);
+		if (source == NULL) {
+			fprintf(stderr, "Could not open file \"%s\".\n", path);
+			exit(74);
+		}
+		char imagePath[1024];
+		snprintf(imagePath, sizeof(imagePath), "%sc", path);
+		ObjFunction* function = endsWith(path, ".lox") ? mapImage(imagePath, source, length) : NULL;	// stale or corrupt images just get ignored
+		result = function != NULL ? interpretFunction(function) : interpret(source, length);
+		freeSource(source, length, mapped);
 	}
 
-	fseek(file, 0L, SEEK_END);      // find EndOfFile
-	size_t fileSize = ftell(file);  // get size (from start to EndOfFile) in bytes
-	rewind(file);                   // get back to start of file again
+	if (result == INTERPRET_COMPILE_ERROR) exit(65);
+	if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+}
 
-	char* buffer = (char*)malloc(fileSize + 1);   // allocate string of fitting size (filesize+1 for EOF='\0')
-	// error handling - ran out of memory 
-	if (buffer == NULL) {
-		fprintf(stderr, "Not enough memory to read file \"%s\".\n", path);
-		exit(74);
+// --timings: where the time of running a script goes (wall time, seconds) and how big its bytecode got
+typedef struct {
+	double readFile;
+	double scanning;			// an extra pass of only the scanner, the compiler scans while it parses
+	int tokens;
+	double compilation;			// scanning, parsing and emitting, optimizing and translating for --register (or mapping the .loxc)
+								// - no gc share here: the gc never runs while compiling (see pauseGC())
+	bool image;					// an up to date .loxc got used instead of compiling
+	double execution;
+	int runGcCount;				// collections while running (part of execution)
+	double runGcSeconds;
+	int functions;				// in the compiled script, the script itself included
+	int bytecodeBytes;			// of all stack vm chunks
+	int registerBytes;			// of all register vm chunks (--register)
+	int constants;
+	int strings;				// interned strings created by compiling
+} Timings;
+
+// helper for timeFile() - wall clock in seconds
+static double now() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// helper for timeFile() - interned strings the vm currently holds
+static int internedCount() {
+	return vm.strings.count - vm.strings.tombstones + vm.strings.oldCount;
+}
+
+// helper for timeFile() - adds function and all functions declared in it to the sizes
+static void countFunction(Timings* timings, ObjFunction* function) {
+	timings->functions++;
+	timings->bytecodeBytes += function->chunk.count;
+	timings->registerBytes += function->regChunk.count;
+	timings->constants += function->chunk.constants.count;
+	for (int i = 0; i < function->chunk.constants.count; i++) {
+		Value constant = function->chunk.constants.values[i];
+		if (IS_FUNCTION(constant)) countFunction(timings, AS_FUNCTION(constant));
 	}
-	size_t bytesRead = fread(buffer, sizeof(char), fileSize, file); // read chars to string
-	// error handling - ran out of memory 
-	if (bytesRead < fileSize) {
-		fprintf(stderr, "Could not read file \"%s\".\n", path);
-		exit(74);
+}
+
+// helper for printTimings() - writes chars as a json string (quoted, with '"', '\\' and control characters escaped)
+static void printJsonString(const char* chars) {
+	fputc('"', stderr);
+	for (const unsigned char* c = (const unsigned char*)chars; *c != '\0'; c++) {
+		if (*c == '"' || *c == '\\') {
+			fprintf(stderr, "\\%c", *c);
+		} else if (*c < 0x20) {
+			fprintf(stderr, "\\u%04x", *c);
+		} else {
+			fputc(*c, stderr);
+		}
 	}
-	buffer[bytesRead] = '\0';                                       // add EoF to our 'string'
+	fputc('"', stderr);
+}
 
-	fclose(file);                   // close file
-	return buffer;
+// helper for timeFile() - writes the report to stderr (so it does not mix with what the script prints)
+static void printTimings(Timings* t, const char* path, bool json) {
+	if (json) {
+		fprintf(stderr, "{\"path\": ");
+		printJsonString(path);
+		fprintf(stderr, ", \"readFile\": %.6f, \"scanning\": %.6f, \"tokens\": %d, \"compilation\": %.6f, \"image\": %s, "
+			"\"execution\": %.6f, \"executionGc\": %.6f, \"executionGcCount\": %d, "
+			"\"functions\": %d, \"bytecodeBytes\": %d, \"registerBytes\": %d, \"constants\": %d, \"strings\": %d}\n",
+			t->readFile, t->scanning, t->tokens, t->compilation, t->image ? "true" : "false", t->execution, t->runGcSeconds, t->runGcCount, t->functions, t->bytecodeBytes,
+			t->registerBytes, t->constants, t->strings);
+		return;
+	}
+	fprintf(stderr, "timings for %s:\n", path);
+	fprintf(stderr, "  readFile      %10.3f ms\n", t->readFile * 1000);
+	fprintf(stderr, "  scanning      %10.3f ms  (%d tokens, separate pass)\n", t->scanning * 1000, t->tokens);
+	fprintf(stderr, "  compilation   %10.3f ms%s\n", t->compilation * 1000, t->image ? "  (loaded the .loxc image)" : "");
+	fprintf(stderr, "  execution     %10.3f ms\n", t->execution * 1000);
+	fprintf(stderr, "  - gc          %10.3f ms  (%d collections)\n", t->runGcSeconds * 1000, t->runGcCount);
+	fprintf(stderr, "  %d functions, %d bytes bytecode (%d register), %d constants, %d interned strings created by compiling\n",
+		t->functions, t->bytecodeBytes, t->registerBytes, t->constants, t->strings);
 }
 
-// other entrypoint than repl, but from a file.
-static void runFile(const char* path) {
-	char* source = readFile(path);
-	InterpretResult result = interpret(source);
-	free(source);
+// --timings: like runFile(), but measures every phase on the way and reports them (json -> as one json object)
+static void timeFile(const char* path, bool json) {
+	Timings timings = {0};
+	setMainScript(path);
+	double start = now();
+	if (endsWith(path, ".loxc")) {			// an image: nothing to read, scan or compile, mapping it is the compilation
+		int strings = internedCount();
+		ObjFunction* function = mapImage(path, NULL, 0);
+		timings.compilation = now() - start;
+		timings.image = true;
+		timings.strings = internedCount() - strings;
+		if (function == NULL) {
+			fprintf(stderr, "Could not load image \"%s\".\n", path);
+			exit(65);
+		}
+		countFunction(&timings, function);
+		int gcCount = vm.gcCount;
+		double gcSeconds = vm.gcSeconds;
+		start = now();
+		InterpretResult result = interpretFunction(function);
+		timings.execution = now() - start;
+		timings.runGcCount = vm.gcCount - gcCount;
+		timings.runGcSeconds = vm.gcSeconds - gcSeconds;
+		printTimings(&timings, path, json);
+		if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+		return;
+	}
+	size_t length;
+	bool mapped;
+	char* source = readSource(path, &length, &mapped);
+	timings.readFile = now() - start;
+	if (source == NULL) {
+		fprintf(stderr, "Could not open file \"%s\".\n", path);
+		exit(74);
+	}
+
+	start = now();
+	Scanner scanner;
+	initScanner(&scanner, source, length);
+	while (scanToken(&scanner).type != TOKEN_EOF) timings.tokens++;
+	timings.scanning = now() - start;
+
+	int strings = internedCount();
+	start = now();
+	char imagePath[1024];
+	snprintf(imagePath, sizeof(imagePath), "%sc", path);
+	ObjFunction* function = endsWith(path, ".lox") ? mapImage(imagePath, source, length) : NULL;
+	timings.image = function != NULL;
+	if (function == NULL) function = compile(source, length);
+	timings.compilation = now() - start;
+	timings.strings = internedCount() - strings;
+
+	InterpretResult result = INTERPRET_COMPILE_ERROR;
+	if (function != NULL) {
+		countFunction(&timings, function);
+		int gcCount = vm.gcCount;
+		double gcSeconds = vm.gcSeconds;
+		start = now();
+		result = interpretFunction(function);
+		timings.execution = now() - start;
+		timings.runGcCount = vm.gcCount - gcCount;
+		timings.runGcSeconds = vm.gcSeconds - gcSeconds;
+	}
+	freeSource(source, length, mapped);
+	printTimings(&timings, path, json);
 
 	if (result == INTERPRET_COMPILE_ERROR) exit(65);
 	if (result == INTERPRET_RUNTIME_ERROR) exit(70);
 }
 
+// --compile-only: compiles the script at path and writes the image to output (default: path + "c" -> script.loxc)
+static void compileFile(const char* path, const char* output) {
+	size_t length;
+	bool mapped;
+	char* source = readSource(path, &length, &mapped);
+	if (source == NULL) {
+		fprintf(stderr, "Could not open file \"%s\".\n", path);
+		exit(74);
+	}
+	FLAG_LAZY = false;				// an image holds bytecode, so every function has to get compiled now
+	ObjFunction* function = compile(source, length);
+	if (function == NULL) exit(65);
+	char imagePath[1024];
+	if (output == NULL) {
+		snprintf(imagePath, sizeof(imagePath), "%sc", path);
+		output = imagePath;
+	}
+	bool ok = writeImage(function, source, length, output);
+	freeSource(source, length, mapped);
+	if (!ok) exit(74);
+}
+
+// prints how to use the binary and exits
+static void usage() {
+	fprintf(stderr, "Usage: clox [-O0|-O1|-O2] [--dump-opt] [--register] [--lazy] [--compile-only [-o file.loxc]] [--check] [--timings[=json]] [--snapshot|--restore file.loxs] [path]\n");
+	exit(64);
+}
+
 int main(int argc, const char* argv[]) {
+		// read the flags first, whatever is left is the path to run:
+		const char* path = NULL;
+		const char* output = NULL;
+		bool compileOnly = false;
+		bool check = false;
+		int timings = 0;				// 1: --timings, 2: --timings=json
+		const char* snapshotPath = NULL;
+		const char* restorePath = NULL;
+		for (int i = 1; i < argc; i++) {
+			if (strcmp(argv[i], "-O0") == 0) {
+				FLAG_OPT_LEVEL = 0;			// no optimization passes at all
+			} else if (strcmp(argv[i], "-O1") == 0) {
+				FLAG_OPT_LEVEL = 1;
+			} else if (strcmp(argv[i], "-O2") == 0) {
+				FLAG_OPT_LEVEL = 2;
+			} else if (strcmp(argv[i], "--dump-opt") == 0) {
+				FLAG_DUMP_OPT = true;		// print every chunk before and after the optimizer ran
+			} else if (strcmp(argv[i], "--register") == 0) {
+				FLAG_REGISTER_VM = true;	// run functions on the register vm (the stack vm stays for what it cant do)
+			} else if (strcmp(argv[i], "--lazy") == 0) {
+				FLAG_LAZY = true;			// compile function bodies when they get called the first time
+			} else if (strcmp(argv[i], "--compile-only") == 0) {
+				compileOnly = true;			// just write the compiled script to a .loxc image
+			} else if (strcmp(argv[i], "--check") == 0) {
+				check = true;				// compile all scripts in the directory at path (in parallel), run none of them
+			} else if (strcmp(argv[i], "--timings") == 0) {
+				timings = 1;				// report how long reading, scanning, compiling and running the script took
+			} else if (strcmp(argv[i], "--timings=json") == 0) {
+				timings = 2;
+			} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+				output = argv[++i];
+			} else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+				snapshotPath = argv[++i];	// run the script, then write the globals it left to a snapshot
+			} else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc) {
+				restorePath = argv[++i];	// start with the globals of a snapshot
+			} else if (argv[i][0] == '-' || path != NULL) {
+				usage();
+			} else {
+				path = argv[i];
+			}
+		}
+
 		// initialize our VM:
 		initVM();
+		if (restorePath != NULL && !restoreSnapshot(restorePath)) {
+			fprintf(stderr, "Could not restore snapshot \"%s\".\n", restorePath);
+			exit(65);
+		}
 
-		// Run either the REPL or OPEN-FILE or ERROR-MSG about wrong use.
-		if (argc == 1) {
+		// Run either the REPL or OPEN-FILE
+		if (check) {
+			if (path == NULL) usage();
+			int status = checkScripts(path);
+			freeVM();
+			return status;
+		} else if (compileOnly || output != NULL) {
+			if (path == NULL) usage();
+			compileFile(path, output);
+		} else if (path == NULL) {
+			if (snapshotPath != NULL || timings > 0) usage();
 			runRepl();
-		} else if (argc == 2) {
-			runFile(argv[1]);
 		} else {
-			fprintf(stderr, "Usage: clox [path]\n");
-			exit(64);
+			if (timings > 0) {
+				timeFile(path, timings == 2);
+			} else {
+				runFile(path);
+			}
+			if (snapshotPath != NULL && !writeSnapshot(snapshotPath)) exit(74);
 		}
 
 		// free the VM
 		freeVM();
 		return 0;
 }
-
@@ -1,7 +1,9 @@
 #include <stdlib.h>
+#include <time.h>
 
-#include "compiler.h"
+#include "array.h"
 #include "memory.h"
+#include "module.h"
 #include "vm.h"
 
 
@@ -12,6 +14,13 @@
 
 #define GC_HEAP_GROW_FACTOR 2           // double threshold when next GC gets triggered each time.
 
+_Thread_local Heap* threadHeap = NULL;
+// > 0 while the gc must not start on this thread: while compiling (nothing the compiler holds has to be a root then)
+// and while mergeHeap() moves objects over. Allocations still count, the next one after resumeGC() can collect
+static _Thread_local int gcPauses = 0;
+
+#define ARENA_BLOCK_SIZE (64 * 1024)    // most functions get optimized and translated in a single block
+
 //  The single function used for all dynamic memory management in clox 
 //  (this is neccessary for the Garbage Collector)
     // if   -oldSize-   -newSize-       -then do Operation:-
@@ -25,13 +34,17 @@
     // size: is the new size for the memory block in bytes
     // return value: this function returns a pointer to the newly allocated memory, or NULL if the request fails.
 void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
-    vm.bytesAllocated += newSize - oldSize;
-    if (newSize > oldSize) {
-        #ifdef DEBUG_STRESS_GC          // this FLAG -> GC at every possible time
-        collectGarbage();
-        #endif
-        if (vm.bytesAllocated > vm.nextGC) {    
-            collectGarbage();           // GC only triggers if the threshold(nextGC) gets exceded
+    if (threadHeap != NULL) {
+        threadHeap->bytesAllocated += newSize - oldSize;    // a thread's own heap never gets collected
+    } else {
+        vm.bytesAllocated += newSize - oldSize;
+        if (newSize > oldSize && gcPauses == 0) {
+            #ifdef DEBUG_STRESS_GC          // this FLAG -> GC at every possible time
+            collectGarbage();
+            #endif
+            if (vm.bytesAllocated > vm.nextGC) {    
+                collectGarbage();           // GC only triggers if the threshold(nextGC) gets exceded
+            }
         }
     }
     if (newSize == 0) {
@@ -44,6 +57,25 @@ void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
     return result;
 }
 
+// like reallocate(NULL, 0, size) but the new block is all zero bytes. (free it with reallocate() like any other block)
+// - calloc gets big blocks as fresh zero-pages from the OS, so unlike realloc + a loop writing zeros this costs nothing upfront
+void* reallocateZeroed(size_t size) {
+    if (threadHeap != NULL) {
+        threadHeap->bytesAllocated += size;
+    } else {
+        vm.bytesAllocated += size;
+        #ifdef DEBUG_STRESS_GC
+        if (gcPauses == 0) collectGarbage();
+        #endif
+        if (vm.bytesAllocated > vm.nextGC && gcPauses == 0) {
+            collectGarbage();
+        }
+    }
+    void* result = calloc(1, size);
+    if (result == NULL) exit(1);
+    return result;
+}
+
 // For GC - marks Objects as having some reference to it (so it does not get GC'd)
 void markObject(Obj* object) {
     if (object == NULL) return;
@@ -93,8 +125,9 @@ static void blackenObject(Obj* object) {
         case OBJ_ARRAY: {
             ObjArray* array = (ObjArray*)object;
             for (int i=0; i<array->count; i++) {
-                markValue(array->items[i]);
+                markValue(ARRAY_SLOT(array, i));
             }
+            markObject((Obj*)array->parent);    // slices keep the array they share the store with alive
             break;
         }
         case OBJ_MAP: {
@@ -125,7 +158,15 @@ static void blackenObject(Obj* object) {
         case OBJ_FUNCTION: {
             ObjFunction* function = (ObjFunction*)object;
             markObject((Obj*)function->name);
+            markObject((Obj*)function->closure);
             markArray(&function->chunk.constants);          // Functions have a table full of Locals etc
+            for (int i = 0; i < function->chunk.inlinedCount; i++) {
+                markObject((Obj*)function->chunk.inlined[i].name);
+            }
+            if (function->lazy != NULL) {                   // not compiled yet: its source and the names of its upvalues
+                markObject((Obj*)function->lazy->source);
+                for (int i = 0; i < function->lazy->upvalueCount; i++) markObject((Obj*)function->lazy->upvalueNames[i]);
+            }
             break;
         }
         case OBJ_INSTANCE: {
@@ -161,7 +202,7 @@ static void freeObject(Obj* object) {
         }
         case OBJ_ARRAY: {
             ObjArray* array = (ObjArray*)object;
-            FREE_ARRAY(Value*, array->items, array->count);
+            arrayReleaseStore(array);   // the store might still be in use by a slice
             FREE(ObjArray, object);
             break;
         }
@@ -183,6 +224,8 @@ static void freeObject(Obj* object) {
         case OBJ_FUNCTION: {
             ObjFunction* function = (ObjFunction*)object;
             freeChunk(&function->chunk);
+            freeChunk(&function->regChunk);
+            freeLazyFunction(function);
             FREE(ObjFunction, object);  // functions have to free their own stack
             break;
         }
@@ -224,8 +267,7 @@ static void markRoots() {
     }
     // walk all the global variables in use:
     markTable(&vm.globals);
-    // if GC starts while were still compiling -> we need to GC the compiler-structs aswell
-    markCompilerRoots();
+    markModules();                      // (imported modules have their own)
     // we need this for quick lookups to "init()" - so this always stays a root
     markObject((Obj*)vm.initString);
 }
@@ -274,12 +316,17 @@ void collectGarbage() {
     }
     size_t before = vm.bytesAllocated;
     #endif
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
     markRoots();                        // starts GC by finding & marking all roots(directly reachable objects by VM)
     traceReferences();                  // walk trough our grayStack will no more grays left (-> we visited everything)
     tableRemoveWhite(&vm.strings);      // we have to specially handle the weak-reference stringpool.
     sweep();                            // now we can cleanup everything not marked
     vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;    // threshold when next GC gets triggered.
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    vm.gcCount++;
+    vm.gcSeconds += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
 
     #ifdef DEBUG_LOG_GC
     if (FLAG_LOG_GC){
@@ -298,4 +345,126 @@ void freeObjects() {
         object = next;
     }
     free(vm.grayStack);
-}
\ No newline at end of file
+}
+// no gc on this thread till the matching resumeGC() (pauses nest)
+void pauseGC() {
+    gcPauses++;
+}
+
+void resumeGC() {
+    gcPauses--;
+}
+
+void initArena(Arena* arena) {
+    arena->block = NULL;
+}
+
+void* arenaAllocate(Arena* arena, size_t size) {
+    size = (size + 15) & ~(size_t)15;           // keeps every allocation 16 byte aligned
+    ArenaBlock* block = arena->block;
+    if (block == NULL || block->size - block->used < size) {
+        size_t blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = (ArenaBlock*)malloc(sizeof(ArenaBlock) + blockSize);
+        if (block == NULL) exit(1);
+        block->previous = arena->block;
+        block->size = blockSize;
+        block->used = 0;
+        arena->block = block;
+    }
+    void* result = block->data + block->used;
+    block->used += size;
+    return result;
+}
+
+// where the arena is at right now, arenaRelease() goes back to it
+ArenaMark arenaMark(Arena* arena) {
+    return (ArenaMark){arena->block, arena->block == NULL ? 0 : arena->block->used};
+}
+
+// frees everything allocated since mark
+void arenaRelease(Arena* arena, ArenaMark mark) {
+    while (arena->block != mark.block) {
+        ArenaBlock* previous = arena->block->previous;
+        free(arena->block);
+        arena->block = previous;
+    }
+    if (arena->block != NULL) arena->block->used = mark.used;
+}
+
+void freeArena(Arena* arena) {
+    arenaRelease(arena, (ArenaMark){NULL, 0});
+}
+
+void initHeap(Heap* heap) {
+    heap->objects = NULL;
+    heap->bytesAllocated = 0;
+    initTable(&heap->strings);
+}
+
+// objects and strings this thread creates from now on go to heap instead of the vm (NULL -> back to the vm).
+// - the vm must not run (or collect) while other threads use heaps of their own, they still read its flags
+void useHeap(Heap* heap) {
+    threadHeap = heap;
+}
+
+// helper for mergeHeap() - the vm's string with the same chars as string if there was one already (strings get compared by pointer)
+static ObjString* internedString(Heap* heap, ObjString* string) {
+    Value interned;
+    if (string != NULL && tableGet(&heap->strings, string, &interned) && IS_STRING(interned)) return AS_STRING(interned);
+    return string;
+}
+
+// helper for mergeHeap() - swaps the strings a function holds for the vm's ones
+static void internFunction(Heap* heap, ObjFunction* function) {
+    function->name = internedString(heap, function->name);
+    function->field = internedString(heap, function->field);
+    ValueArray* constants = &function->chunk.constants;
+    for (int i = 0; i < constants->count; i++) {
+        if (IS_STRING(constants->values[i])) constants->values[i] = OBJ_VAL(internedString(heap, AS_STRING(constants->values[i])));
+    }
+    for (int i = 0; i < function->chunk.inlinedCount; i++) {
+        function->chunk.inlined[i].name = internedString(heap, function->chunk.inlined[i].name);
+    }
+    for (int i = 0; i < function->regChunk.inlinedCount; i++) {      // compileRegisters() copied the same names over
+        function->regChunk.inlined[i].name = internedString(heap, function->regChunk.inlined[i].name);
+    }
+    if (function->lazy != NULL) {
+        function->lazy->source = internedString(heap, function->lazy->source);
+        for (int i = 0; i < function->lazy->upvalueCount; i++) {
+            function->lazy->upvalueNames[i] = internedString(heap, function->lazy->upvalueNames[i]);
+        }
+    }
+}
+
+// moves everything a thread created on heap into the vm (on the vm's thread, after that thread is done with it). heap is empty afterwards.
+// - the caller keeps what it got back from compiling reachable (ex. on the stack) before the next allocation can collect it
+void mergeHeap(Heap* heap) {
+    // 1. strings the vm already has: remember the vm's one as the value of the heap's string
+    int cursor = 0;
+    Entry* entry;
+    while ((entry = tableIterate(&heap->strings, &cursor)) != NULL) {
+        ObjString* string = entry->key;
+        ObjString* interned = tableFindString(&vm.strings, string->chars, string->length, string->hash);
+        entry->value = interned == NULL ? NIL_VAL : OBJ_VAL(interned);
+    }
+    // 2. point the functions to those (the heap's copies are garbage then)
+    Obj* last = NULL;
+    for (Obj* object = heap->objects; object != NULL; object = object->next) {
+        if (object->type == OBJ_FUNCTION) internFunction(heap, (ObjFunction*)object);
+        last = object;
+    }
+    // 3. hand over the objects and intern the new strings
+    pauseGC();
+    if (last != NULL) {
+        last->next = vm.objects;
+        vm.objects = heap->objects;
+    }
+    vm.bytesAllocated += heap->bytesAllocated;
+    cursor = 0;
+    while ((entry = tableIterate(&heap->strings, &cursor)) != NULL) {
+        if (IS_NIL(entry->value)) tableSet(&vm.strings, entry->key, NIL_VAL);
+    }
+    freeTable(&heap->strings);
+    resumeGC();
+    initHeap(heap);
+}
@@ -9,6 +9,10 @@
 #define ALLOCATE(type, count) \
     (type*)reallocate(NULL, 0, sizeof(type) * (count))
 
+// macro that allocates an array with all bytes set to 0. (big blocks come straight from the OS as zero pages -> no cost upfront)
+#define ALLOCATE_ZEROED(type, count) \
+    (type*)reallocateZeroed(sizeof(type) * (count))
+
 // macro - used to free memory that a custom Object used
 #define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
 
@@ -28,10 +32,64 @@
 #define FREE_ARRAY(type, pointer, oldCount) \
     reallocate(pointer, sizeof(type) * (oldCount), 0);
 
+// a heap of its own for a thread that compiles while the vm does not run (--check). Nothing on it gets collected,
+// mergeHeap() moves it into the vm afterwards
+typedef struct {
+    Obj* objects;               // like vm.objects
+    size_t bytesAllocated;
+    Table strings;              // like vm.strings (the strings created on this heap)
+} Heap;
+
+extern _Thread_local Heap* threadHeap;     // the heap allocations of this thread go to (NULL -> the vm's, see useHeap())
+
+// like push()/pop() - keep a new object save from the gc till something reachable holds it.
+// A thread on its own heap has no gc to fear (and must not touch the vm's stack)
+static inline void pushRoot(Value value) {
+    if (threadHeap == NULL) push(value);
+}
+
+static inline void popRoot() {
+    if (threadHeap == NULL) pop();
+}
+
+// memory for what only lives while a function gets compiled (ex. the work arrays of the optimizer and register translator).
+// Allocating bumps a pointer through big blocks straight from malloc, so the gc neither counts nor collects any of it.
+// arenaRelease() frees everything allocated since arenaMark() at once (there is no freeing single allocations)
+typedef struct ArenaBlock {
+    struct ArenaBlock* previous;
+    size_t size;
+    size_t used;
+    _Alignas(16) unsigned char data[];
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock* block;          // the block we allocate from, NULL till the first allocation
+} Arena;
+
+typedef struct {
+    ArenaBlock* block;
+    size_t used;
+} ArenaMark;
+
+// like ALLOCATE() but from an Arena
+#define ARENA_ALLOCATE(arena, type, count) \
+    (type*)arenaAllocate(arena, sizeof(type) * (count))
+
 void* reallocate(void* pointer, size_t oldSize, size_t newSize);
+void* reallocateZeroed(size_t size);
 void markObject(Obj* object);
 void markValue(Value value);
 void collectGarbage();
 void freeObjects();
+void pauseGC();
+void resumeGC();
+void initArena(Arena* arena);
+void* arenaAllocate(Arena* arena, size_t size);
+ArenaMark arenaMark(Arena* arena);
+void arenaRelease(Arena* arena, ArenaMark mark);
+void freeArena(Arena* arena);
+void initHeap(Heap* heap);
+void useHeap(Heap* heap);
+void mergeHeap(Heap* heap);
 
 #endif
\ No newline at end of file
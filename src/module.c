@@ -0,0 +1,340 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "compiler.h"
+#include "image.h"
+#include "memory.h"
+#include "module.h"
+#include "optimizer.h"
+#include "vm.h"
+
+// every module loaded so far (the registry). Their globals and functions are gc roots, see markModules()
+static Module* modules = NULL;
+// directory of the main script ("" -> the working directory), imports of the main script are relative to it
+static char mainDirectory[PATH_MAX] = "";
+
+// helper for readSource() - reads the whole file into a malloc'd buffer (for what cant be mapped). NULL if that fails
+static char* readFile(const char* path, size_t* length) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+    fseek(file, 0L, SEEK_END);      // find EndOfFile
+    long fileSize = ftell(file);    // get size (from start to EndOfFile) in bytes
+    rewind(file);                   // get back to start of file again
+    char* buffer = fileSize < 0 ? NULL : (char*)malloc(fileSize + 1);
+    size_t bytesRead = buffer == NULL ? 0 : fread(buffer, sizeof(char), fileSize, file);
+    fclose(file);
+    if (buffer == NULL || bytesRead < (size_t)fileSize) {
+        free(buffer);
+        return NULL;
+    }
+    buffer[bytesRead] = '\0';
+    *length = bytesRead;
+    return buffer;
+}
+
+// the source of the script at path (NULL if it cant be read). It gets mapped into memory, so the scanner reads it
+// right out of the page cache instead of a copy of it. (the scanner knows the length, so no '\0' at the end needed)
+// - what cant be mapped (empty files, pipes...) gets read with readFile(), *mapped tells freeSource() which one it was
+char* readSource(const char* path, size_t* length, bool* mapped) {
+    int file = open(path, O_RDONLY);
+    struct stat info;
+    void* memory = MAP_FAILED;
+    if (file >= 0 && fstat(file, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        memory = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    }
+    if (file >= 0) close(file);     // the mapping keeps the file alive
+    if (memory == MAP_FAILED) {
+        *mapped = false;
+        return readFile(path, length);
+    }
+    madvise(memory, info.st_size, MADV_SEQUENTIAL);        // the scanner reads it front to back once
+    *mapped = true;
+    *length = info.st_size;
+    return (char*)memory;
+}
+
+// frees what readSource() returned
+void freeSource(char* source, size_t length, bool mapped) {
+    if (mapped) {
+        munmap(source, length);
+    } else {
+        free(source);
+    }
+}
+
+// helper for setMainScript(), resolvePath() - copies the directory part of path (with its '/') to directory
+static void directoryOf(const char* path, char* directory) {
+    const char* slash = strrchr(path, '/');
+    int length = slash == NULL ? 0 : (int)(slash - path) + 1;
+    memcpy(directory, path, length);
+    directory[length] = '\0';
+}
+
+// the script at path is the one we run, its imports are relative to its directory
+void setMainScript(const char* path) {
+    if (strlen(path) < PATH_MAX) directoryOf(path, mainDirectory);
+}
+
+// helper for importModule() - the canonical path (absolute, no "." or ".." or symlinks) of path relative to the directory
+// of the importer (absolute paths stay as they are). So "lib.lox" and "./lib.lox" are the same module.
+// - false if the file does not exist or the path does not fit into resolved
+static bool resolvePath(Module* importer, const char* path, char* resolved) {
+    char joined[PATH_MAX];
+    if (path[0] == '/') {
+        if (strlen(path) >= PATH_MAX) return false;
+        strcpy(joined, path);
+    } else {
+        char directory[PATH_MAX];
+        if (importer != NULL) {
+            directoryOf(importer->path->chars, directory);
+        } else {
+            strcpy(directory, mainDirectory);
+        }
+        if (snprintf(joined, PATH_MAX, "%s%s", directory, path) >= PATH_MAX) return false;
+    }
+    return realpath(joined, resolved) != NULL;
+}
+
+// helper for importModule() - compiles the module at path (or maps its up to date .loxc). NULL if it cant be read or does not compile
+static ObjFunction* loadModule(const char* path) {
+    size_t length;
+    bool mapped;
+    char* source = readSource(path, &length, &mapped);
+    if (source == NULL) return NULL;
+    ObjFunction* function = NULL;
+    size_t pathLength = strlen(path);
+    if (pathLength >= 4 && strcmp(path + pathLength - 4, ".lox") == 0) {
+        char imagePath[PATH_MAX + 1];
+        snprintf(imagePath, sizeof(imagePath), "%sc", path);
+        function = mapImage(imagePath, source, length);     // stale or corrupt images just get ignored
+    }
+    if (function == NULL) function = compile(source, length);
+    freeSource(source, length, mapped);     // (lazy functions keep a copy of their source)
+    return function;
+}
+
+// helper for importModule(), findImports() - the module in the registry loaded from the (canonical) path, NULL if there is none
+static Module* findModule(const char* path) {
+    for (Module* module = modules; module != NULL; module = module->next) {
+        if (strcmp(module->path->chars, path) == 0) return module;
+    }
+    return NULL;
+}
+
+// helper for importModule(), prefetchImports() - adds the module compiled from the file at path to the registry (not run yet)
+static Module* registerModule(const char* path, ObjFunction* function) {
+    push(OBJ_VAL(function));                // the gc might run till the module is in the registry
+    push(OBJ_VAL(copyString(path, (int)strlen(path))));
+    Module* module = ALLOCATE(Module, 1);
+    module->path = AS_STRING(pop());
+    module->function = function;
+    initTable(&module->globals);
+    module->ran = false;
+    module->next = modules;
+    modules = module;
+    pop();
+    defineNatives(&module->globals);
+    setFunctionModule(function, module);
+    return module;
+}
+
+// the module path refers to (when imported from importer, NULL for the main script). Loads it the first time.
+// Returns NULL if it cant be read or does not compile (compile errors already got reported)
+Module* importModule(Module* importer, ObjString* path) {
+    char resolved[PATH_MAX];
+    if (!resolvePath(importer, path->chars, resolved)) return NULL;
+    Module* module = findModule(resolved);
+    if (module != NULL) return module;      // (most of the time prefetchImports() already loaded it)
+
+    ObjFunction* function = loadModule(resolved);
+    if (function == NULL) return NULL;
+    module = registerModule(resolved, function);
+    prefetchImports(module, function);
+    return module;
+}
+
+/*
+    Compiling imports ahead of time - when a script or module got compiled we look for its 'import "path";' instructions
+    and compile all the modules it imports at once, one thread per core (each on a heap of its own, see useHeap()).
+    Then the modules those import, and so on. So OP_IMPORT only has to run them.
+    - modules that dont compile (or cant be read) dont get registered, the import loads them again (and reports the errors).
+    - imports inside function bodies that are not compiled yet (--lazy) get loaded when they run, like without this.
+*/
+
+// a module prefetchImports() found that is not in the registry yet
+typedef struct {
+    char path[PATH_MAX];        // canonical
+    char* source;
+    size_t length;
+    bool mapped;
+    ObjFunction* function;      // what it compiled to, NULL if it did not compile
+} PendingModule;
+
+// the modules one level of prefetchImports() compiles, in the order the threads take them
+typedef struct {
+    PendingModule* modules;
+    int count;
+    int capacity;
+    atomic_int next;            // the next module a thread takes
+} ImportBatch;
+
+// one thread of compileBatch()
+typedef struct {
+    pthread_t thread;
+    ImportBatch* batch;
+    Heap heap;
+} ImportWorker;
+
+// helper for findImports() - adds the module at the (canonical) path, unless the registry or the batch has it already.
+// A module with an up to date .loxc image gets mapped and registered right away, there is nothing to compile
+static void addPending(ImportBatch* batch, const char* path) {
+    if (findModule(path) != NULL) return;
+    for (int i = 0; i < batch->count; i++) {
+        if (strcmp(batch->modules[i].path, path) == 0) return;
+    }
+    size_t length;
+    bool mapped;
+    char* source = readSource(path, &length, &mapped);
+    if (source == NULL) return;
+    size_t pathLength = strlen(path);
+    if (pathLength >= 4 && strcmp(path + pathLength - 4, ".lox") == 0) {
+        char imagePath[PATH_MAX + 1];
+        snprintf(imagePath, sizeof(imagePath), "%sc", path);
+        ObjFunction* function = mapImage(imagePath, source, length);
+        if (function != NULL) {
+            freeSource(source, length, mapped);
+            registerModule(path, function);
+            return;
+        }
+    }
+    if (batch->count == batch->capacity) {
+        int oldCapacity = batch->capacity;
+        batch->capacity = GROW_CAPACITY(oldCapacity);
+        batch->modules = GROW_ARRAY(PendingModule, batch->modules, oldCapacity, batch->capacity);
+    }
+    PendingModule* pending = &batch->modules[batch->count++];
+    strcpy(pending->path, path);
+    pending->source = source;
+    pending->length = length;
+    pending->mapped = mapped;
+    pending->function = NULL;
+}
+
+// helper for prefetchImports() - adds what the 'import "path";' instructions in function (and the functions declared in it) import
+static void findImports(ImportBatch* batch, Module* importer, ObjFunction* function) {
+    Chunk* chunk = &function->chunk;
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        if (chunk->code[offset] != OP_IMPORT) continue;
+        ObjString* path = AS_STRING(chunk->constants.values[chunk->code[offset + 1]]);
+        char resolved[PATH_MAX];
+        if (resolvePath(importer, path->chars, resolved)) addPending(batch, resolved);
+    }
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value constant = chunk->constants.values[i];
+        if (IS_FUNCTION(constant)) findImports(batch, importer, AS_FUNCTION(constant));
+    }
+}
+
+// a thread of compileBatch() - keeps taking the next module till there are none left
+static void* runImportWorker(void* argument) {
+    ImportWorker* worker = (ImportWorker*)argument;
+    ImportBatch* batch = worker->batch;
+    useHeap(&worker->heap);
+    for (;;) {
+        int i = atomic_fetch_add(&batch->next, 1);
+        if (i >= batch->count) break;
+        PendingModule* pending = &batch->modules[i];
+        pending->function = compileQuietly(pending->source, pending->length);
+    }
+    useHeap(NULL);
+    return NULL;
+}
+
+// helper for prefetchImports() - compiles the modules of batch in parallel, merges what the threads created into the vm and
+// registers the modules that compiled
+static void compileBatch(ImportBatch* batch) {
+    atomic_init(&batch->next, 0);
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int threadCount = cores < 1 || FLAG_DUMP_OPT ? 1 : (int)cores;     // (--dump-opt output of threads would get mixed up)
+    if (threadCount > batch->count) threadCount = batch->count;
+    ImportWorker* workers = ALLOCATE(ImportWorker, threadCount);
+    int started = 0;
+    for (int i = 0; i < threadCount; i++) {
+        workers[i].batch = batch;
+        initHeap(&workers[i].heap);
+        if (threadCount == 1 || pthread_create(&workers[i].thread, NULL, runImportWorker, &workers[i]) != 0) break;
+        started++;
+    }
+    if (started == 0) {         // a single module or no threads to be had -> this thread compiles them all
+        runImportWorker(&workers[0]);
+        started = 1;
+    } else {
+        for (int i = 0; i < started; i++) pthread_join(workers[i].thread, NULL);
+    }
+    for (int i = 0; i < started; i++) mergeHeap(&workers[i].heap);
+    FREE_ARRAY(ImportWorker, workers, threadCount);
+
+    for (int i = 0; i < batch->count; i++) {
+        PendingModule* pending = &batch->modules[i];
+        freeSource(pending->source, pending->length, pending->mapped);
+        if (pending->function != NULL) registerModule(pending->path, pending->function);
+    }
+}
+
+// compiles (or maps) everything function imports - directly or through other modules - that is not in the registry yet.
+// importer is the module function belongs to (NULL for the main script)
+void prefetchImports(Module* importer, ObjFunction* function) {
+    pauseGC();                  // what the threads compiled is not reachable till it is in the registry
+    Module* known = modules;
+    ImportBatch batch = {NULL, 0, 0};
+    findImports(&batch, importer, function);
+    while (batch.count > 0 || modules != known) {
+        if (batch.count > 0) compileBatch(&batch);
+        FREE_ARRAY(PendingModule, batch.modules, batch.capacity);
+        batch = (ImportBatch){NULL, 0, 0};
+        // the next level: what the modules registered since then import (mapped images included)
+        Module* newest = modules;
+        for (Module* module = modules; module != known; module = module->next) {
+            findImports(&batch, module, module->function);
+        }
+        known = newest;
+    }
+    resumeGC();
+}
+
+// function and all functions declared in it belong to module: they use its globals
+void setFunctionModule(ObjFunction* function, Module* module) {
+    function->module = module;
+    for (int i = 0; i < function->chunk.constants.count; i++) {
+        Value constant = function->chunk.constants.values[i];
+        if (IS_FUNCTION(constant)) setFunctionModule(AS_FUNCTION(constant), module);
+    }
+}
+
+// for the gc - modules stay loaded till the vm gets freed
+void markModules() {
+    for (Module* module = modules; module != NULL; module = module->next) {
+        markObject((Obj*)module->path);
+        markObject((Obj*)module->function);
+        markTable(&module->globals);
+    }
+}
+
+void freeModules() {
+    Module* module = modules;
+    while (module != NULL) {
+        Module* next = module->next;
+        freeTable(&module->globals);
+        FREE(Module, module);
+        module = next;
+    }
+    modules = NULL;
+}
@@ -0,0 +1,33 @@
+#ifndef clox_module_h
+#define clox_module_h
+
+#include "object.h"
+#include "table.h"
+
+/*
+    Modules - 'import "lib/math.lox";' runs another file and brings its globals into the importing one.
+    - the path is relative to the directory of the file that imports it (the working directory for the repl)
+    - every module gets compiled and run once per process. Importing it again (from anywhere) only copies its globals again.
+    - each module has its own globals: its functions keep reading and writing those, even when called from the importer.
+    - a module.loxc next to the module (written with --compile-only) gets used instead of compiling it, if it is up to date.
+    - the imports of a script get compiled ahead of time, in parallel (see prefetchImports()).
+*/
+
+typedef struct Module {
+    ObjString* path;            // what it got loaded from (canonical, see resolvePath()), the key of the registry
+    ObjFunction* function;      // its top level code
+    Table globals;              // its global variables (starts out with the natives)
+    bool ran;                   // its top level code started running (so an import cycle doesnt run it twice)
+    struct Module* next;        // the registry is a linked list
+} Module;
+
+char* readSource(const char* path, size_t* length, bool* mapped);
+void freeSource(char* source, size_t length, bool mapped);
+void setMainScript(const char* path);
+Module* importModule(Module* importer, ObjString* path);
+void prefetchImports(Module* importer, ObjFunction* function);
+void setFunctionModule(ObjFunction* function, Module* module);
+void markModules();
+void freeModules();
+
+#endif
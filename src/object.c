@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "array.h"
 #include "memory.h"
 #include "object.h"
 #include "table.h"
@@ -13,9 +14,10 @@ static Obj* allocateObject(size_t size, ObjType type) {
     Obj* object = (Obj*)reallocate(NULL, 0, size);
     object->type = type;
     object->isMarked = false;
-    // insert this obj to the obj-linked list at the head (so at vm.objects):
-    object->next = vm.objects;  
-    vm.objects = object;
+    // insert this obj to the obj-linked list at the head (so at vm.objects, or the objects of this thread's heap):
+    Obj** objects = threadHeap != NULL ? &threadHeap->objects : &vm.objects;
+    object->next = *objects;
+    *objects = object;
 
 
     #ifdef DEBUG_LOG_GC     // log GC-Event:
@@ -65,9 +67,40 @@ ObjFunction* newFunction() {
     function->upvalueCount = 0;
     function->name = NULL;
     initChunk(&function->chunk);
+    initChunk(&function->regChunk);
+    function->maxRegisters = 0;
+    function->accessor = ACCESSOR_NONE;
+    function->field = NULL;
+    function->closure = NULL;
+    function->lazy = NULL;
+    function->module = NULL;
     return function;
 }
 
+// turns function into a lazy one (--lazy) that captures upvalueCount variables. (their names still have to get filled in)
+LazyFunction* newLazyFunction(ObjFunction* function, int upvalueCount) {
+    LazyFunction* lazy = ALLOCATE(LazyFunction, 1);
+    lazy->source = NULL;
+    lazy->line = 0;
+    lazy->column = 0;
+    lazy->upvalueNames = ALLOCATE(ObjString*, upvalueCount);
+    lazy->upvalueCount = upvalueCount;
+    for (int i = 0; i < upvalueCount; i++) lazy->upvalueNames[i] = NULL;
+    lazy->inClass = false;
+    lazy->hasSuperclass = false;
+    function->upvalueCount = upvalueCount;
+    function->lazy = lazy;
+    return lazy;
+}
+
+// once the function got compiled (or gets freed) we dont need to know how to compile it anymore
+void freeLazyFunction(ObjFunction* function) {
+    if (function->lazy == NULL) return;
+    FREE_ARRAY(ObjString*, function->lazy->upvalueNames, function->lazy->upvalueCount);
+    FREE(LazyFunction, function->lazy);
+    function->lazy = NULL;
+}
+
 // helper for ALLOCATE_OBJ macro - allocates instance (runtime) of a class - we pass in the 'parent'Class we build off
 ObjInstance* newInstance(ObjClass* pClass) {
     ObjInstance* instance = ALLOCATE_OBJ(ObjInstance, OBJ_INSTANCE);
@@ -83,17 +116,22 @@ ObjNative* newNative(NativeFn function) {
     return native;
 }
 
+// helper for the string constructors - the stringpool of the heap we allocate on
+static Table* internedStrings() {
+    return threadHeap != NULL ? &threadHeap->strings : &vm.strings;
+}
+
 // constructor for ObjString - creates a new ObjString on the heap then initializes the fields
 static ObjString* allocateString(char* chars, int length, uint32_t hash) {
     ObjString* string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
     string->length = length;
     string->chars = chars;
     string->hash = hash;
-    push(OBJ_VAL(string));      // we only push it to the stack in case a GC happens next step
+    pushRoot(OBJ_VAL(string));   // we only push it to the stack in case a GC happens next step
     // insert our String into the stringpool-HashTable:
     // - we use it more as a HashSet (we ONLY care about values so we just NIL the value)
-    tableSet(&vm.strings, string, NIL_VAL);
-    pop();                      // we remove our savety push from the stack
+    tableSet(internedStrings(), string, NIL_VAL);
+    popRoot();                  // we remove our savety push from the stack
     return string;
 }
 
@@ -111,7 +149,7 @@ static uint32_t hashString(const char* key, int length) {
 //  (this is done so concatenate can just take the input strings and consume them, without extra copying)
 ObjString* takeString(char* chars, int length) {
     uint32_t hash = hashString(chars, length);
-    ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
+    ObjString* interned = tableFindString(internedStrings(), chars, length, hash);
     if (interned != NULL) {
         FREE_ARRAY(char, chars, length + 1);    // since it already is in the HashTable we can free the string passed in as args
         return interned;                        // and return reference to the identical string in the stringpool-HashTable
@@ -123,7 +161,7 @@ ObjString* takeString(char* chars, int length) {
 // - if the string already exists in our stringpool Hashmap we dont allocate but just return reference to that
 ObjString* copyString(const char* chars, int length) {
     uint32_t hash = hashString(chars, length);          // calculate our hash
-    ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
+    ObjString* interned = tableFindString(internedStrings(), chars, length, hash);
     if (interned != NULL) return interned;              // string already exists in stringpool-HashMap so we return reference to it
     
     char* heapChars = ALLOCATE(char, length +1);        // need space for the trailing '\0'
@@ -158,6 +196,9 @@ ObjArray* newArray() {
     array->items = NULL;
     array->count = 0;
     array->capacity = 0;
+    array->head = 0;
+    array->store = NULL;
+    array->parent = NULL;
     return array;
 }
 
@@ -171,14 +212,13 @@ ObjMap* newMap() {
 // helper for printObject() - printing our custom map
 static void printMap(ObjMap* map) {
     printf("{ ");
-    for (int i=0; i< map->table.capacity; i++){
-        // need to check for tombstones or empty:
-        if(! (map->table.entries[i].key == NULL )) {
-            printf("%s", map->table.entries[i].key->chars);
-            printf(" : ");
-            printValue(map->table.entries[i].value);
-            printf(", ");
-        }
+    int cursor = 0;
+    Entry* entry;
+    while ((entry = tableIterate(&map->table, &cursor)) != NULL) {  // skips tombstones and empty buckets for us
+        printf("%s", entry->key->chars);
+        printf(" : ");
+        printValue(entry->value);
+        printf(", ");
     }
     printf("}");
 }
@@ -214,7 +254,7 @@ void printObject(Value value) {
             printf("[ ");
             ObjArray* array = AS_ARRAY(value);
             for (int i = 0; i < array->count; i++) {
-                printValue(array->items[i]);
+                printValue(ARRAY_SLOT(array, i));
                 printf(", ");
             }
             printf("]");
@@ -64,12 +64,37 @@ struct Obj {
     struct Obj* next;   // linked list-ish to next Object. This is used to keep track on active heap -> used for GC
 };
 
+// methods that only read or write one field of 'this'. OP_INVOKE does that directly instead of pushing a CallFrame
+typedef enum {
+    ACCESSOR_NONE,
+    ACCESSOR_GETTER,    // "getName() { return this.name; }"
+    ACCESSOR_SETTER,    // "setName(name) { this.name = name; }"
+} AccessorType;
+
+// a function that gets compiled on its first call (--lazy). The compiler only skipped over its body and noted what it captures
+typedef struct {
+    ObjString* source;          // the function from its '(' to its '}'
+    int line;                   // where that starts
+    int column;
+    ObjString** upvalueNames;   // the variables it captures, in the order of its upvalues
+    int upvalueCount;
+    bool inClass;               // declared in a method, so it can use 'this'
+    bool hasSuperclass;         // ... of a class with a superclass, so it can use 'super'
+} LazyFunction;
+
 // Each Function needs its own Chunk (Callstack, etc...)
 typedef struct {
     Obj obj;
     int arity;          // nr of parameters the function takes in
     int upvalueCount;   // keep track of upvalues we use
     Chunk chunk;
+    Chunk regChunk;     // the register bytecode (--register), empty if the function runs on the stack vm. Uses the constants of chunk
+    int maxRegisters;   // how many slots of the stack the register bytecode uses
+    AccessorType accessor;
+    ObjString* field;   // the field a getter/setter accesses (one of its constants)
+    struct ObjClosure* closure;     // without upvalues every closure of the function is the same -> all share this one (NULL till needed)
+    LazyFunction* lazy; // not compiled yet (--lazy), NULL once it is
+    struct Module* module;  // the module it got declared in (its globals are the ones it uses), NULL for the main script
     ObjString* name;
 } ObjFunction;
 
@@ -105,7 +130,7 @@ typedef struct ObjUpvalue {
 
 // To enable Closures at runtime we wrap every ObjFunction(created at compiletime) in a ObjClosure, 
 // - so we can capture run time-state of encompassing Scopes
-typedef struct {
+typedef struct ObjClosure {
     Obj obj;
     ObjFunction* function;
     ObjUpvalue** upvalues;      // pointer to dynamic upvalue array that stores array of pointers of upvalues
@@ -135,12 +160,23 @@ typedef struct {
 
 /* Own implementations top of default-lox */
 
-// a array/list type data structure that basically just wraps the dynamic array
+// the buffer behind an array. Slices share the store of the array they got taken from (till one of them writes -> copy on write)
 typedef struct {
+    int refCount;               // nr of arrays reading from this store. Only the last one to let go frees it.
+    Value values[];
+} ArrayStore;
+
+// a array/list type data structure that wraps a growable ring buffer
+// - head points at the slot of the first element. So adding/removing at the front is as cheap as at the end.
+// - capacity is always a power of 2, so mapping an index to its slot is just an add and a mask (see ARRAY_SLOT in array.h)
+typedef struct ObjArray {
     Obj obj;
     int count;
     int capacity;
-    Value* items;               // the array should take different kind of values, just like a JS-Array
+    int head;                   // slot in items where index 0 of the array currently lives
+    Value* items;               // the array should take different kind of values, just like a JS-Array (points into store)
+    ArrayStore* store;          // owner of items - might be shared with slices
+    struct ObjArray* parent;    // for slices: the array we got sliced from. Kept alive while we still share its store.
 } ObjArray;
 
 typedef struct {
@@ -152,6 +188,8 @@ ObjBoundMethod* newBoundMethod(Value receiver, ObjClosure* method);
 ObjClass* newClass(ObjString* name);
 ObjClosure* newClosure(ObjFunction* function);
 ObjFunction* newFunction();
+LazyFunction* newLazyFunction(ObjFunction* function, int upvalueCount);
+void freeLazyFunction(ObjFunction* function);
 ObjInstance* newInstance(ObjClass* pClass);
 ObjNative* newNative(NativeFn function);
 ObjString* takeString(char* chars, int length);
@@ -0,0 +1,581 @@
+#include <string.h>
+
+#include "debug.h"
+#include "memory.h"
+#include "object.h"
+#include "optimizer.h"
+
+int FLAG_OPT_LEVEL = 1;
+bool FLAG_DUMP_OPT = false;
+
+/*
+    IR - the chunk decoded into one Instr per instruction
+    - jumps point to the index of the instruction they land on (instead of a byte offset), so passes can freely remove
+      instructions and retarget jumps. Encoding calculates the byte offsets again.
+    - removed instructions just get flagged. A jump to a removed instruction lands on the next one that is still there.
+*/
+
+typedef struct {
+    uint8_t op;
+    int offset;             // where the instruction was in the original chunk (OP_CLOSURE copies its upvalue-bytes from there)
+    int length;             // opcode + operands in bytes
+    int line;
+    int column;
+    int target;             // only jumps: index of the instruction they land on
+    bool removed;
+    bool changed;           // a pass rewrote the opcode or retargeted the jump (only used for --dump-opt)
+    int site;               // inlined instructions: index of the InlineSite they replaced (-1 for all others)
+} Instr;
+
+typedef struct {
+    Chunk* chunk;
+    int codeLength;         // how many bytes of the chunk decode() saw. Inlined code gets appended behind those
+    Instr* code;
+    int count;
+    int* jumpsTo;           // for each instruction: how many jumps land on it
+    InlineSite* sites;
+    Arena* arena;           // everything the passes allocate (freed all at once when optimizeFunction() is done)
+} Ir;
+
+static bool isJump(uint8_t op) {
+    return op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_TRUE || op == OP_LOOP;
+}
+
+static bool isConditionalJump(uint8_t op) {
+    return op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_TRUE;
+}
+
+// decodes the chunk into our list of instructions
+static void decode(Ir* ir, Chunk* chunk, Arena* arena) {
+    ir->chunk = chunk;
+    ir->arena = arena;
+    ir->codeLength = chunk->count;
+    ir->sites = NULL;
+    ir->count = 0;
+    // maps byte offset -> instruction index (+1 for jumps that land right at the end)
+    int* indexAt = ARENA_ALLOCATE(ir->arena, int, chunk->count + 1);
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        indexAt[offset] = ir->count++;
+    }
+    indexAt[chunk->count] = ir->count;
+
+    ir->code = ARENA_ALLOCATE(ir->arena, Instr, ir->count + 1); // +1 so a jump to the end has an instruction to point at
+    ir->jumpsTo = ARENA_ALLOCATE(ir->arena, int, ir->count + 1);
+    int index = 0;
+    LineReader lines;
+    initLineReader(&lines, chunk);
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        Instr* instr = &ir->code[index++];
+        readLine(&lines, offset);
+        instr->op = chunk->code[offset];
+        instr->offset = offset;
+        instr->length = instructionLength(chunk, offset);
+        instr->line = lines.line;
+        instr->column = lines.column;
+        instr->target = isJump(instr->op) ? indexAt[jumpDestination(chunk, offset)] : -1;
+        instr->removed = false;
+        instr->changed = false;
+        instr->site = -1;
+    }
+    ir->code[ir->count] = (Instr){OP_RETURN, chunk->count, 0, 0, 0, -1, true, false, -1};   // the end, never gets encoded
+}
+
+// helper - first instruction from index on, that is not removed
+static int nextLive(Ir* ir, int index) {
+    while (index < ir->count && ir->code[index].removed) index++;
+    return index;
+}
+
+// helper - last instruction in front of index that is not removed (-1 if none)
+static int previousLive(Ir* ir, int index) {
+    index--;
+    while (index >= 0 && ir->code[index].removed) index--;
+    return index;
+}
+
+static void countJumpTargets(Ir* ir) {
+    memset(ir->jumpsTo, 0, sizeof(int) * (ir->count + 1));
+    for (int i = 0; i < ir->count; i++) {
+        if (!ir->code[i].removed && isJump(ir->code[i].op)) {
+            ir->jumpsTo[nextLive(ir, ir->code[i].target)]++;
+        }
+    }
+}
+
+// removes the instruction at index. Jumps that landed on it now land on the next one, so we keep counting them there
+static void removeInstr(Ir* ir, int index) {
+    ir->code[index].removed = true;
+    ir->jumpsTo[nextLive(ir, index + 1)] += ir->jumpsTo[index];
+    ir->jumpsTo[index] = 0;
+}
+
+/*
+*
+*       The Passes
+*
+*/
+
+// Dead code elimination: removes everything that can never run. Ex. code after a 'return' or the implicit 'nil return'
+// at the end of a function that already returned explicitly.
+// - we walk the control flow from the first instruction, whatever we did not reach gets removed.
+static void removeUnreachable(Ir* ir) {
+    bool* reached = ARENA_ALLOCATE(ir->arena, bool, ir->count);
+    int* worklist = ARENA_ALLOCATE(ir->arena, int, 2 * ir->count + 1); // every instruction adds at most 2 successors (the first time we reach it)
+    memset(reached, 0, sizeof(bool) * ir->count);
+    int workCount = 0;
+    worklist[workCount++] = nextLive(ir, 0);
+    while (workCount > 0) {
+        int i = worklist[--workCount];
+        if (i >= ir->count || reached[i]) continue;
+        reached[i] = true;
+        Instr* instr = &ir->code[i];
+        if (isJump(instr->op)) {
+            worklist[workCount++] = nextLive(ir, instr->target);
+        }
+        // everything but the unconditional jumps and return can continue with the next instruction:
+        if (instr->op != OP_JUMP && instr->op != OP_LOOP && instr->op != OP_RETURN) {
+            worklist[workCount++] = nextLive(ir, i + 1);
+        }
+    }
+    for (int i = 0; i < ir->count; i++) {
+        if (!reached[i]) ir->code[i].removed = true;
+    }
+}
+
+// Jump threading: a jump that lands on another jump can go straight to where that one goes.
+// - conditional jumps do not pop the value they check. So OP_JUMP_IF_FALSE landing on another OP_JUMP_IF_FALSE knows that
+//   one will jump aswell. (ex. "if (a and b)" -> if a is false we go straight to the else branch). And if it lands on an
+//   OP_JUMP_IF_TRUE that one wont jump, so we continue right after it. Same the other way around for OP_JUMP_IF_TRUE.
+// - an OP_JUMP that we only reach by an OP_JUMP_IF_FALSE NOT jumping knows the value is truthy. If that lands on an
+//   OP_JUMP_IF_FALSE we know it wont jump and continue right after it. (ex. "if (a or b)" -> if a is true we go straight into the then-branch)
+static void threadJumps(Ir* ir) {
+    countJumpTargets(ir);
+    for (int i = 0; i < ir->count; i++) {
+        Instr* instr = &ir->code[i];
+        if (instr->removed || !isJump(instr->op)) continue;
+
+        // what we know about the value on top of the stack, when we arrive at the target:
+        bool isFalsey = instr->op == OP_JUMP_IF_FALSE;
+        bool isTruthy = instr->op == OP_JUMP_IF_TRUE;
+        int previous = previousLive(ir, i);
+        if (instr->op == OP_JUMP && ir->jumpsTo[i] == 0 && previous != -1
+            && isConditionalJump(ir->code[previous].op) && nextLive(ir, previous + 1) == i) {
+            isTruthy = ir->code[previous].op == OP_JUMP_IF_FALSE;
+            isFalsey = ir->code[previous].op == OP_JUMP_IF_TRUE;
+        }
+
+        int target = nextLive(ir, instr->target);
+        int best = target;
+        for (int hops = 0; hops < ir->count && target < ir->count; hops++) {
+            Instr* next = &ir->code[target];
+            bool jumps = next->op == OP_JUMP || next->op == OP_LOOP
+                || (next->op == OP_JUMP_IF_FALSE && isFalsey) || (next->op == OP_JUMP_IF_TRUE && isTruthy);
+            bool fallsThrough = (next->op == OP_JUMP_IF_FALSE && isTruthy) || (next->op == OP_JUMP_IF_TRUE && isFalsey);
+            if (jumps) {
+                target = nextLive(ir, next->target);
+            } else if (fallsThrough) {
+                target = nextLive(ir, target + 1);
+            } else {
+                break;
+            }
+            // conditional jumps can only go forward
+            if (!isConditionalJump(instr->op) || target > i) best = target;
+        }
+        if (best != nextLive(ir, instr->target)) {
+            instr->target = best;
+            instr->changed = true;
+        }
+    }
+}
+
+// Peephole: looks at short sequences of instructions and replaces them with fewer/cheaper ones:
+// - OP_NOT, OP_JUMP_IF_FALSE  -> OP_JUMP_IF_TRUE       (ex. "if (!done)") only if both ways start with OP_POP,
+//                                                       since we leave the not-negated value on the stack.
+// - OP_JUMP_IF_FALSE a, OP_JUMP b, a: -> OP_JUMP_IF_TRUE b    (what "x or y" compiles to)
+// - OP_SET_LOCAL, OP_POP      -> OP_SET_LOCAL_POP      (ex. "i = i + 1;" as a statement)
+// - a jump to the instruction right after it       -> removed  (conditional jumps dont pop, so they do nothing aswell)
+// Nothing may jump into the middle of a sequence, or it would skip half of the replacement.
+static void peephole(Ir* ir) {
+    countJumpTargets(ir);
+    for (int i = 0; i < ir->count; i++) {
+        Instr* instr = &ir->code[i];
+        if (instr->removed) continue;
+        int next = nextLive(ir, i + 1);
+        if (next >= ir->count) break;
+        Instr* second = &ir->code[next];
+
+        if (instr->op == OP_NOT && second->op == OP_JUMP_IF_FALSE && ir->jumpsTo[next] == 0) {
+            int fallthrough = nextLive(ir, next + 1);
+            int target = nextLive(ir, second->target);
+            if (fallthrough < ir->count && ir->code[fallthrough].op == OP_POP
+                && target < ir->count && ir->code[target].op == OP_POP) {
+                removeInstr(ir, i);
+                second->op = OP_JUMP_IF_TRUE;
+                second->changed = true;
+            }
+        } else if (instr->op == OP_JUMP_IF_FALSE && second->op == OP_JUMP && ir->jumpsTo[next] == 0
+            && nextLive(ir, instr->target) == nextLive(ir, next + 1) && second->target > i) {
+            instr->op = OP_JUMP_IF_TRUE;
+            instr->target = second->target;
+            instr->changed = true;
+            removeInstr(ir, next);
+        } else if (instr->op == OP_SET_LOCAL && second->op == OP_POP && ir->jumpsTo[next] == 0) {
+            instr->op = OP_SET_LOCAL_POP;
+            instr->changed = true;
+            removeInstr(ir, next);
+        }
+    }
+    // jumps that just land on the next instruction (ex. left over from an "else" branch that got removed)
+    for (int i = 0; i < ir->count; i++) {
+        Instr* instr = &ir->code[i];
+        if (!instr->removed && isJump(instr->op) && nextLive(ir, instr->target) == nextLive(ir, i + 1)) {
+            removeInstr(ir, i);
+        }
+    }
+}
+
+// Dead stores: removes assignments to local slots that never get read. (OP_SET_LOCAL leaves the value on the stack, so we
+// can just drop the instruction). A slot counts as read if any OP_GET_LOCAL reads it or a closure captures it.
+// - the slot itself has to stay, since every local after it is addressed by its position on the stack.
+static void removeDeadStores(Ir* ir) {
+    bool read[UINT8_COUNT];
+    memset(read, 0, sizeof(read));
+    read[0] = true;                     // slot 0 holds 'this' or the function itself
+    Chunk* chunk = ir->chunk;
+    for (int i = 0; i < ir->count; i++) {
+        Instr* instr = &ir->code[i];
+        if (instr->op == OP_GET_LOCAL) {
+            read[chunk->code[instr->offset + 1]] = true;
+        } else if (instr->op == OP_CLOSURE) {
+            for (int j = instr->offset + 2; j < instr->offset + instr->length; j += 2) {
+                if (chunk->code[j]) read[chunk->code[j + 1]] = true;     // isLocal -> captures our slot
+            }
+        }
+    }
+    for (int i = 0; i < ir->count; i++) {
+        Instr* instr = &ir->code[i];
+        if (instr->op == OP_SET_LOCAL && !read[chunk->code[instr->offset + 1]]) {
+            instr->removed = true;
+        }
+    }
+}
+
+/*
+*
+*       Inlining
+*
+*/
+
+#define INLINE_MAX_LENGTH 32        // functions with more bytes of code than this never get inlined
+
+// helper for inlineDepth() - the instructions an inlined function may use. No jumps, calls, closures or upvalues
+static bool canInline(uint8_t op) {
+    switch (op) {
+        case OP_CONSTANT:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_POP:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_SET_LOCAL_POP:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_MODULO:
+        case OP_NOT:
+        case OP_NEGATE:
+        case OP_PRINT:
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_ARRAY_BUILD:
+        case OP_MAP_BUILD:
+        case OP_LISTS_READ_IDX:
+        case OP_LISTS_WRITE_IDX:
+        case OP_RETURN:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// helper for inlineCalls() - checks if the function can get inlined into a frame where its slot 0 lands at base.
+// returns the depth of its stack at its OP_RETURN (or -1 if it cant get inlined)
+static int inlineDepth(ObjFunction* function, int argCount, int base) {
+    if (function->arity != argCount || function->upvalueCount != 0) return -1;
+    Chunk* body = &function->chunk;
+    int depth = function->arity + 1;
+    for (int offset = 0; offset < body->count && offset < INLINE_MAX_LENGTH; offset += instructionLength(body, offset)) {
+        uint8_t op = body->code[offset];
+        if (!canInline(op)) return -1;
+        if (op == OP_RETURN) return depth;  // without jumps everything behind it is dead
+        depth += stackEffect(body, offset);
+        if (base + depth > UINT8_COUNT) return -1;
+    }
+    return -1;
+}
+
+// helper for inlineCalls() - appends the code of function to the end of the chunk (behind everything decode() saw), rewritten so it
+// runs in the frame of the caller: its slots start at base, its constants get copied over and OP_RETURN becomes OP_POP_BELOW.
+// returns false (and leaves the chunk like it was) if the constants dont fit.
+static bool appendInlined(Chunk* chunk, ObjFunction* function, int base, int depth) {
+    Chunk* body = &function->chunk;
+    Chunk saved = *chunk;           // to undo what we wrote (the arrays only grow, so the old counts are all we need)
+    LineReader lines;
+    initLineReader(&lines, body);
+    for (int offset = 0; body->code[offset] != OP_RETURN; offset += instructionLength(body, offset)) {
+        uint8_t op = body->code[offset];
+        readLine(&lines, offset);
+        writeChunk(chunk, op, lines.line, lines.column);
+        if (instructionLength(body, offset) == 1) continue;
+        int operand = body->code[offset + 1];
+        if (op == OP_GET_LOCAL || op == OP_SET_LOCAL || op == OP_SET_LOCAL_POP) {
+            operand += base;
+        } else if (op != OP_ARRAY_BUILD && op != OP_MAP_BUILD) {
+            operand = internConstant(chunk, body->constants.values[operand]);
+            if (operand > UINT8_MAX) {
+                chunk->count = saved.count;
+                while (chunk->constants.count > saved.constants.count) {
+                    removeLastConstant(chunk);  // takes them out of the constant index aswell
+                }
+                chunk->lineCount = saved.lineCount;
+                chunk->lastOffset = saved.lastOffset;
+                chunk->lastLine = saved.lastLine;
+                chunk->lastColumn = saved.lastColumn;
+                return false;
+            }
+        }
+        writeChunk(chunk, (uint8_t)operand, lines.line, lines.column);
+    }
+    writeChunk(chunk, OP_POP_BELOW, lines.line, lines.column);
+    writeChunk(chunk, depth - 1, lines.line, lines.column);        // everything of the function below its return value
+    return true;
+}
+
+// helper for inlineCalls() - walks every path through the code and returns the depth of the stack in front of each instruction
+// (-1 if never reached). Returns NULL if two paths disagree.
+static int* stackDepths(Ir* ir, int arity) {
+    int* depth = ARENA_ALLOCATE(ir->arena, int, ir->count + 1);
+    int* worklist = ARENA_ALLOCATE(ir->arena, int, ir->count + 1); // every instruction gets added once, when we first reach it
+    for (int i = 0; i <= ir->count; i++) depth[i] = -1;
+    int workCount = 0;
+    bool ok = true;
+    depth[0] = arity + 1;                               // slot 0 holds the function (or 'this') then the arguments
+    worklist[workCount++] = 0;
+    while (ok && workCount > 0) {
+        int i = worklist[--workCount];
+        if (i >= ir->count) continue;
+        Instr* instr = &ir->code[i];
+        int after = depth[i] + stackEffect(ir->chunk, instr->offset);
+        int successors[2];
+        int successorCount = 0;
+        if (isJump(instr->op)) successors[successorCount++] = instr->target;
+        if (instr->op != OP_JUMP && instr->op != OP_LOOP && instr->op != OP_RETURN) successors[successorCount++] = i + 1;
+        for (int j = 0; j < successorCount; j++) {
+            int next = successors[j];
+            if (depth[next] == -1) {
+                depth[next] = after;
+                worklist[workCount++] = next;
+            } else if (depth[next] != after) {
+                ok = false;
+            }
+        }
+    }
+    return ok ? depth : NULL;
+}
+
+// Inlining: replaces calls of small functions (that the compiler proved always call the same function) with their code.
+// - "fun square(x) { return x * x; } square(3);" -> GET_LOCAL square, CONSTANT 3, GET_LOCAL, GET_LOCAL, MULTIPLY, POP_BELOW 2
+//   the callee and arguments land on the stack like for the call, so the inlined code finds its slots at the same place.
+// - only straight-line functions of at most INLINE_MAX_LENGTH bytes, without calls (so never recursive) or upvalues.
+// - the chunk remembers what got inlined from where, so error traces still show the inlined function (see runtimeError())
+static void inlineCalls(Ir* ir, ObjFunction* function, InlineSite* sites, int siteCount) {
+    ir->sites = sites;
+    if (siteCount == 0) return;
+    int* depth = stackDepths(ir, function->arity);
+    if (depth == NULL) return;
+
+    // first we append the code of every call we can inline to the chunk
+    Chunk* chunk = ir->chunk;
+    int* callAt = ARENA_ALLOCATE(ir->arena, int, siteCount);         // index of the call instruction (-1 if we dont inline it)
+    int* codeStart = ARENA_ALLOCATE(ir->arena, int, siteCount + 1);  // where its inlined code starts in the chunk
+    int added = 0;                                                   // nr of inlined instructions
+    int i = 0;
+    for (int site = 0; site < siteCount; site++) {
+        callAt[site] = -1;
+        codeStart[site] = chunk->count;
+        while (i < ir->count && ir->code[i].offset < sites[site].call) i++;     // sites are sorted by offset
+        Instr* call = &ir->code[i];
+        if (i >= ir->count || call->offset != sites[site].call || depth[i] == -1) continue;
+        if (call->op != OP_CALL && call->op != OP_TAIL_CALL) continue;
+        int argCount = chunk->code[call->offset + 1];
+        int base = depth[i] - argCount - 1;
+        int returnDepth = inlineDepth(sites[site].function, argCount, base);
+        if (returnDepth == -1 || !appendInlined(chunk, sites[site].function, base, returnDepth)) continue;
+        callAt[site] = i;
+        for (int offset = codeStart[site]; offset < chunk->count; offset += instructionLength(chunk, offset)) added++;
+    }
+    codeStart[siteCount] = chunk->count;
+
+    // then we splice its instructions in behind the call, which gets removed -> jumps to the call land on the inlined code
+    if (added > 0) {
+        Instr* code = ARENA_ALLOCATE(ir->arena, Instr, ir->count + added + 1);
+        int* newIndex = ARENA_ALLOCATE(ir->arena, int, ir->count + 1);
+        LineReader lines;
+        initLineReader(&lines, chunk);
+        int count = 0;
+        int site = 0;
+        for (int old = 0; old <= ir->count; old++) {
+            newIndex[old] = count;
+            code[count++] = ir->code[old];
+            while (site < siteCount && callAt[site] < old) site++;
+            if (old == ir->count || site >= siteCount || callAt[site] != old) continue;
+            code[count - 1].removed = true;
+            for (int offset = codeStart[site]; offset < codeStart[site + 1]; offset += instructionLength(chunk, offset)) {
+                readLine(&lines, offset);
+                code[count++] = (Instr){chunk->code[offset], offset, instructionLength(chunk, offset), lines.line, lines.column, -1, false, true, site};
+            }
+        }
+        count--;                                        // the end does not count
+        for (int j = 0; j < count; j++) {
+            if (code[j].target != -1) code[j].target = newIndex[code[j].target];
+        }
+        ir->code = code;
+        ir->count = count;
+        ir->jumpsTo = ARENA_ALLOCATE(ir->arena, int, count + 1);
+    }
+}
+
+/*
+*
+*       Encoding the IR back into the chunk
+*
+*/
+
+// writes the instructions that are left back into the chunk. Returns false (and leaves the chunk like decode() saw it) if a jump
+// got too far for its 16-bit offset.
+static bool encode(Ir* ir) {
+    Chunk* chunk = ir->chunk;
+    int* newOffset = ARENA_ALLOCATE(ir->arena, int, ir->count + 1);
+    int position = 0;
+    for (int i = 0; i <= ir->count; i++) {
+        newOffset[i] = position;        // removed instructions get the offset of the next one -> jumps to them land there
+        if (i < ir->count && !ir->code[i].removed) position += ir->code[i].length;
+    }
+    bool fits = true;
+    for (int i = 0; i < ir->count; i++) {
+        Instr* instr = &ir->code[i];
+        if (instr->removed || !isJump(instr->op)) continue;
+        int distance = newOffset[instr->target] - (newOffset[i] + 3);
+        if (distance < 0) distance = -distance;
+        if (distance > UINT16_MAX) fits = false;
+    }
+    if (!fits) {
+        chunk->count = ir->codeLength;          // drops the inlined code
+        return false;
+    }
+
+    uint8_t* code = ARENA_ALLOCATE(ir->arena, uint8_t, position);
+    resetLines(chunk);                                      // the line table gets written anew, in the order of the new code
+    for (int i = 0; i < ir->count; i++) {
+        Instr* instr = &ir->code[i];
+        if (instr->removed) continue;
+        int at = newOffset[i];
+        memcpy(&code[at], &chunk->code[instr->offset], instr->length);
+        code[at] = instr->op;                               // the peephole pass might have replaced the opcode
+        setLine(chunk, at, instr->line, instr->column);
+        if (isJump(instr->op)) {
+            int jump = newOffset[instr->target] - (at + 3);
+            if (!isConditionalJump(instr->op)) {
+                code[at] = jump < 0 ? OP_LOOP : OP_JUMP;    // threading might have turned a jump forward into one backwards
+            }
+            if (jump < 0) jump = -jump;
+            code[at + 1] = (jump >> 8) & 0xff;
+            code[at + 2] = jump & 0xff;
+        }
+    }
+    // the new code is never longer than the old one plus the inlined code appended to it, so it fits into the chunk's arrays
+    memcpy(chunk->code, code, position);
+    chunk->count = position;
+
+    // the inlined calls: each is a run of instructions from the same site
+    chunk->inlinedCount = 0;
+    for (int i = 0; i < ir->count; i++) {
+        Instr* instr = &ir->code[i];
+        if (instr->removed || instr->site == -1) continue;
+        int end = newOffset[i] + instr->length;
+        int next = nextLive(ir, i + 1);
+        while (next < ir->count && ir->code[next].site == instr->site) {
+            end = newOffset[next] + ir->code[next].length;
+            next = nextLive(ir, next + 1);
+        }
+        InlineSite* site = &ir->sites[instr->site];
+        addInlinedCall(chunk, newOffset[i], end, site->line, site->function->name);
+        i = next - 1;
+    }
+
+    return true;
+}
+
+// helper for optimizeFunction() - --dump-opt prints the chunk before and after, with every instruction that got removed or rewritten marked
+static void dumpChanges(Ir* ir, Chunk* before, const char* name, bool encoded) {
+    char* changes = ARENA_ALLOCATE(ir->arena, char, before->count);
+    memset(changes, ' ', before->count);
+    for (int i = 0; encoded && i < ir->count; i++) {
+        Instr* instr = &ir->code[i];
+        if (instr->offset >= before->count) continue;      // inlined code, was not there before
+        if (instr->removed) changes[instr->offset] = '-';
+        else if (instr->changed) changes[instr->offset] = '~';
+    }
+    disassembleComparison(name, before, ir->chunk, changes);
+}
+
+// marks methods that only return a field of 'this' or only set one as accessors. OP_INVOKE runs those without a CallFrame
+static void detectAccessor(ObjFunction* function) {
+    Chunk* chunk = &function->chunk;
+    uint8_t* code = chunk->code;
+    if (function->arity == 0 && chunk->count >= 5
+        && code[0] == OP_GET_LOCAL && code[1] == 0 && code[2] == OP_GET_PROPERTY && code[4] == OP_RETURN) {
+        function->accessor = ACCESSOR_GETTER;           // "getName() { return this.name; }"
+        function->field = AS_STRING(chunk->constants.values[code[3]]);
+    } else if (function->arity == 1 && chunk->count >= 9
+        && code[0] == OP_GET_LOCAL && code[1] == 0 && code[2] == OP_GET_LOCAL && code[3] == 1 && code[4] == OP_SET_PROPERTY
+        && code[6] == OP_POP && code[7] == OP_NIL && code[8] == OP_RETURN) {
+        function->accessor = ACCESSOR_SETTER;           // "setName(name) { this.name = name; }"
+        function->field = AS_STRING(chunk->constants.values[code[5]]);
+    }
+}
+
+// the pass manager - runs the passes enabled by FLAG_OPT_LEVEL over the function's chunk
+void optimizeFunction(Arena* arena, ObjFunction* function, InlineSite* sites, int siteCount) {
+    Chunk* chunk = &function->chunk;
+    if (FLAG_OPT_LEVEL <= 0 || chunk->count == 0) return;
+    Ir ir;
+    decode(&ir, chunk, arena);
+    inlineCalls(&ir, function, sites, siteCount);
+    if (FLAG_OPT_LEVEL >= 2) removeDeadStores(&ir);
+    removeUnreachable(&ir);
+    threadJumps(&ir);
+    removeUnreachable(&ir);     // threading can leave jumps behind that nothing reaches anymore
+    peephole(&ir);
+
+    if (!FLAG_DUMP_OPT) {
+        encode(&ir);
+    } else {
+        // encode overwrites the chunk in place, so we keep a copy of the original code around (constants dont change)
+        Chunk before = *chunk;
+        before.count = ir.codeLength;
+        before.code = ARENA_ALLOCATE(arena, uint8_t, before.count);
+        before.lines = ARENA_ALLOCATE(arena, uint8_t, before.lineCount);
+        memcpy(before.code, chunk->code, before.count);
+        memcpy(before.lines, chunk->lines, before.lineCount);
+        dumpChanges(&ir, &before, function->name != NULL ? function->name->chars : "<script>", encode(&ir));
+    }
+    detectAccessor(function);
+}
@@ -0,0 +1,28 @@
+#ifndef clox_optimizer_h
+#define clox_optimizer_h
+
+#include "chunk.h"
+#include "memory.h"
+#include "object.h"
+
+/*
+    The Optimizer - runs over the bytecode of each function once the compiler finished it (in endCompiler).
+    - since the compiler is single-pass it only ever sees one token ahead, so we cant optimize while emitting.
+    - instead we decode the finished chunk into a list of instructions with explicit jump targets (our IR),
+      run the optimization passes over that list, then encode it back into the chunk.
+*/
+
+// a call the compiler proved always calls the same function: "fun square(x) {...} square(3);" where square is a local that
+// never gets reassigned or captured. The optimizer inlines it if the function is small enough.
+typedef struct {
+    int call;                   // offset of the OP_CALL
+    int line;
+    ObjFunction* function;
+} InlineSite;
+
+extern int FLAG_OPT_LEVEL;      // -O0: no passes. -O1 (default): inlining, dead code, jump threading, peephole. -O2: also dead stores to unused locals
+extern bool FLAG_DUMP_OPT;      // --dump-opt: print every chunk before and after optimizing
+
+void optimizeFunction(Arena* arena, ObjFunction* function, InlineSite* sites, int siteCount);
+
+#endif
@@ -0,0 +1,512 @@
+#include <string.h>
+
+#include "memory.h"
+#include "register.h"
+
+bool FLAG_REGISTER_VM = false;
+
+/*
+    The register backend - translates the stack bytecode of a finished function into register bytecode.
+    - the depth of the stack is known at every instruction (the compiler makes sure every path leaves it the same),
+      so every stack position becomes a fixed register: the value the stack vm would push at depth d goes into register d.
+    - that alone would just trade each push/pop for a register write. The win comes from not writing values that are
+      only read once: a OP_GET_LOCAL or OP_CONSTANT does not emit anything, it stays 'pending' and the instruction that
+      consumes it reads the local/constant directly. (ex. "i = i + 1;" becomes a single REG_ADD i, i, k'1')
+    - pending values get written out (materialized) before anything that needs them really on the stack:
+      jumps and the instructions they land on, calls and closures.
+*/
+
+typedef enum {
+    PENDING_NONE,           // the value already is in its register
+    PENDING_LOCAL,          // the value is a copy of another register (index)
+    PENDING_CONSTANT,       // the value is constants[index]
+} PendingType;
+
+typedef struct {
+    PendingType type;
+    int index;
+} Pending;
+
+typedef struct {
+    int op;                 // offset in the register code of the jump instruction
+    int from;               // offset in the register code of the 2 offset-bytes
+    int target;             // offset in the stack code the jump lands on
+} RegJump;
+
+typedef struct {
+    ObjFunction* function;
+    Chunk* stack;           // the stack bytecode we translate
+    Chunk* out;             // the register bytecode we write (function->regChunk)
+    int* depth;             // for each offset in the stack code: depth of the stack before that instruction (-1 if never reached)
+    bool* isTarget;         // for each offset in the stack code: does a jump land here
+    int* labels;            // for each offset in the stack code: where its translation starts in the register code
+    RegJump* jumps;
+    int jumpCount;
+    Pending pending[REGISTER_MAX];
+    int line;               // where the stack instruction we translate came from
+    int column;
+    int lastDst;            // offset of the dst-operand of the instruction we just emitted (-1 if not a plain dst instruction)
+    int maxDepth;
+    Arena* arena;           // the arrays above and the worklist of analyze() (the compiler frees them after the function)
+} Backend;
+
+/*
+*
+*       Analysis - can we translate it and how deep is the stack at every instruction
+*
+*/
+
+// helper for analyze() - returns false for every instruction we cant translate
+static bool isTranslatable(uint8_t op) {
+    switch (op) {
+        case OP_CONSTANT:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_POP:
+        case OP_POP_BELOW:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_SET_LOCAL_POP:
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_MODULO:
+        case OP_NOT:
+        case OP_NEGATE:
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_LOOP:
+        case OP_PRINT:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_CLOSURE:
+        case OP_CLOSE_UPVALUE:
+        case OP_RETURN:
+            return true;
+        default:
+            return false;       // classes, properties, arrays and maps stay on the stack vm
+    }
+}
+
+// walks every path through the stack code and records the depth of the stack at each instruction.
+// returns false if the function cant be translated.
+static bool analyze(Backend* backend) {
+    Chunk* chunk = backend->stack;
+    int* worklist = ARENA_ALLOCATE(backend->arena, int, chunk->count);
+    int workCount = 0;
+    bool ok = true;
+    backend->depth[0] = backend->function->arity + 1;      // slot 0 holds the function (or 'this') then the arguments
+    backend->maxDepth = backend->depth[0];
+    worklist[workCount++] = 0;
+
+    while (ok && workCount > 0) {
+        int offset = worklist[--workCount];
+        uint8_t op = chunk->code[offset];
+        if (!isTranslatable(op)) {
+            ok = false;
+            break;
+        }
+        int after = backend->depth[offset] + stackEffect(chunk, offset);
+        if (after < 0 || after >= REGISTER_MAX) {
+            ok = false;
+            break;
+        }
+        if (after > backend->maxDepth) backend->maxDepth = after;
+
+        int successors[2];
+        int successorCount = 0;
+        bool isJump = op == OP_JUMP || op == OP_LOOP || op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_TRUE;
+        if (isJump) {
+            successors[successorCount++] = jumpDestination(chunk, offset);
+        }
+        if (op != OP_JUMP && op != OP_LOOP && op != OP_RETURN) {
+            successors[successorCount++] = offset + instructionLength(chunk, offset);
+        }
+        for (int i = 0; i < successorCount; i++) {
+            int next = successors[i];
+            if (next < 0 || next >= chunk->count) {
+                ok = false;
+                break;
+            }
+            if (isJump && i == 0) backend->isTarget[next] = true;
+            if (backend->depth[next] == -1) {
+                backend->depth[next] = after;
+                worklist[workCount++] = next;
+            } else if (backend->depth[next] != after) {
+                ok = false;         // should never happen, but we cant give that instruction a fixed set of registers
+                break;
+            }
+        }
+    }
+    return ok;
+}
+
+/*
+*
+*       Emitting the register code
+*
+*/
+
+static void emitByte(Backend* backend, uint8_t byte) {
+    writeChunk(backend->out, byte, backend->line, backend->column);
+}
+
+// writes the pending value of register reg into it
+static void materialize(Backend* backend, int reg) {
+    Pending* pending = &backend->pending[reg];
+    if (pending->type == PENDING_CONSTANT) {
+        emitByte(backend, REG_LOADK);
+        emitByte(backend, reg);
+        emitByte(backend, pending->index);
+    } else if (pending->type == PENDING_LOCAL) {
+        emitByte(backend, REG_MOVE);
+        emitByte(backend, reg);
+        emitByte(backend, pending->index);
+    }
+    pending->type = PENDING_NONE;
+    backend->lastDst = -1;
+}
+
+// materializes every register below depth
+static void flush(Backend* backend, int depth) {
+    for (int reg = 0; reg < depth; reg++) materialize(backend, reg);
+}
+
+// before register 'reg' gets overwritten, every pending copy of it has to get its own value
+static void materializeCopiesOf(Backend* backend, int reg, int depth) {
+    for (int i = 0; i < depth; i++) {
+        if (backend->pending[i].type == PENDING_LOCAL && backend->pending[i].index == reg) materialize(backend, i);
+    }
+}
+
+// the operand that reads register reg: the local or constant directly if its still pending. Consumes the pending value.
+static uint8_t operand(Backend* backend, int reg) {
+    Pending pending = backend->pending[reg];
+    backend->pending[reg].type = PENDING_NONE;
+    if (pending.type == PENDING_CONSTANT) return RK_CONSTANT | pending.index;
+    if (pending.type == PENDING_LOCAL) return pending.index;
+    return reg;
+}
+
+// emits an instruction that writes its result to dst (the first operand)
+static void emitDst(Backend* backend, uint8_t op, int dst) {
+    emitByte(backend, op);
+    emitByte(backend, dst);
+    backend->lastDst = backend->out->count - 1;
+}
+
+// emits a jump with placeholder offset, that gets patched once we know where everything landed
+static void emitJump(Backend* backend, int op, int target) {
+    emitByte(backend, 0xff);
+    emitByte(backend, 0xff);
+    RegJump* jump = &backend->jumps[backend->jumpCount++];
+    jump->op = op;
+    jump->from = backend->out->count - 2;
+    jump->target = target;
+}
+
+// helper for translate() - the value of a conditional jump is dead if both ways pop it right away (ex. "if (a)" "while (a)")
+static bool conditionIsDead(Backend* backend, int offset) {
+    Chunk* chunk = backend->stack;
+    return chunk->code[offset + 3] == OP_POP && chunk->code[jumpDestination(chunk, offset)] == OP_POP;
+}
+
+// translates the stack instruction at offset. depth: the depth of the stack before it
+static void translate(Backend* backend, int offset, int depth) {
+    Chunk* chunk = backend->stack;
+    uint8_t* code = &chunk->code[offset];
+    int top = depth - 1;                    // register of the value on top of the stack
+    int lastDst = backend->lastDst;
+    backend->lastDst = -1;
+
+    switch (code[0]) {
+        case OP_CONSTANT:
+            if (code[1] < REGISTER_MAX) {
+                backend->pending[depth] = (Pending){PENDING_CONSTANT, code[1]};
+            } else {
+                emitDst(backend, REG_LOADK, depth);
+                emitByte(backend, code[1]);
+            }
+            break;
+        case OP_NIL:    emitDst(backend, REG_NIL, depth); break;
+        case OP_TRUE:   emitDst(backend, REG_TRUE, depth); break;
+        case OP_FALSE:  emitDst(backend, REG_FALSE, depth); break;
+        case OP_POP:
+            backend->pending[top].type = PENDING_NONE;      // nobody reads it, so it never has to get written
+            break;
+        case OP_POP_BELOW: {
+            // end of an inlined call - the result moves down into the register of the callee
+            int dst = top - code[1];
+            Pending value = backend->pending[top];
+            if (value.type == PENDING_CONSTANT || (value.type == PENDING_LOCAL && value.index < dst)) {
+                backend->pending[dst] = value;                  // still nothing to write
+            } else if (lastDst != -1 && value.type == PENDING_NONE && backend->out->code[lastDst] == top) {
+                backend->out->code[lastDst] = dst;              // the instruction that computed the result writes to dst instead
+                backend->pending[dst].type = PENDING_NONE;
+            } else {
+                materializeCopiesOf(backend, dst, dst);
+                emitByte(backend, REG_MOVE);
+                emitByte(backend, dst);
+                emitByte(backend, value.type == PENDING_LOCAL ? value.index : top);
+                backend->pending[dst].type = PENDING_NONE;
+            }
+            for (int reg = dst + 1; reg <= top; reg++) backend->pending[reg].type = PENDING_NONE;
+            break;
+        }
+        case OP_GET_LOCAL: {
+            Pending local = backend->pending[code[1]];
+            backend->pending[depth] = local.type != PENDING_NONE ? local : (Pending){PENDING_LOCAL, code[1]};
+            break;
+        }
+        case OP_SET_LOCAL:
+        case OP_SET_LOCAL_POP: {
+            int slot = code[1];
+            bool pops = code[0] == OP_SET_LOCAL_POP;
+            Pending value = backend->pending[top];
+            // "x = a + b;" - the add can write into x directly, if no one still needs the old x
+            bool isCopied = false;
+            for (int i = 0; i < top; i++) {
+                if (backend->pending[i].type == PENDING_LOCAL && backend->pending[i].index == slot) isCopied = true;
+            }
+            if (pops && lastDst != -1 && value.type == PENDING_NONE && backend->out->code[lastDst] == top && !isCopied) {
+                backend->out->code[lastDst] = slot;
+            } else if (!(value.type == PENDING_LOCAL && value.index == slot)) {
+                materializeCopiesOf(backend, slot, top);
+                emitByte(backend, value.type == PENDING_CONSTANT ? REG_LOADK : REG_MOVE);
+                emitByte(backend, slot);
+                emitByte(backend, value.type == PENDING_NONE ? top : value.index);
+            }
+            backend->pending[slot].type = PENDING_NONE;
+            if (pops) backend->pending[top].type = PENDING_NONE;
+            break;
+        }
+        case OP_GET_GLOBAL:
+            emitDst(backend, REG_GET_GLOBAL, depth);
+            emitByte(backend, code[1]);
+            break;
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL: {
+            bool pops = code[0] == OP_DEFINE_GLOBAL;
+            Pending value = backend->pending[top];
+            uint8_t rk = operand(backend, top);
+            if (!pops) backend->pending[top] = value;       // the assignment is an expression -> its value stays
+            emitByte(backend, pops ? REG_DEFINE_GLOBAL : REG_SET_GLOBAL);
+            emitByte(backend, code[1]);
+            emitByte(backend, rk);
+            break;
+        }
+        case OP_GET_UPVALUE:
+            emitDst(backend, REG_GET_UPVALUE, depth);
+            emitByte(backend, code[1]);
+            break;
+        case OP_SET_UPVALUE: {
+            Pending value = backend->pending[top];
+            uint8_t rk = operand(backend, top);
+            backend->pending[top] = value;
+            emitByte(backend, REG_SET_UPVALUE);
+            emitByte(backend, code[1]);
+            emitByte(backend, rk);
+            break;
+        }
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_MODULO: {
+            RegOpCode op;
+            switch (code[0]) {
+                case OP_EQUAL:      op = REG_EQUAL; break;
+                case OP_GREATER:    op = REG_GREATER; break;
+                case OP_LESS:       op = REG_LESS; break;
+                case OP_ADD:        op = REG_ADD; break;
+                case OP_SUBTRACT:   op = REG_SUBTRACT; break;
+                case OP_MULTIPLY:   op = REG_MULTIPLY; break;
+                case OP_DIVIDE:     op = REG_DIVIDE; break;
+                default:            op = REG_MODULO; break;
+            }
+            uint8_t b = operand(backend, top - 1);
+            uint8_t c = operand(backend, top);
+            emitDst(backend, op, top - 1);
+            emitByte(backend, b);
+            emitByte(backend, c);
+            break;
+        }
+        case OP_NOT:
+        case OP_NEGATE: {
+            uint8_t rk = operand(backend, top);
+            emitDst(backend, code[0] == OP_NOT ? REG_NOT : REG_NEGATE, top);
+            emitByte(backend, rk);
+            break;
+        }
+        case OP_PRINT:
+            emitByte(backend, REG_PRINT);
+            emitByte(backend, operand(backend, top));
+            break;
+        case OP_JUMP:
+        case OP_LOOP:
+            flush(backend, depth);
+            emitByte(backend, REG_JUMP);    // jumps backwards become REG_LOOP once we patch them
+            emitJump(backend, backend->out->count - 1, jumpDestination(chunk, offset));
+            break;
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE: {
+            uint8_t condition;
+            if (conditionIsDead(backend, offset)) {
+                flush(backend, top);
+                condition = operand(backend, top);
+            } else {
+                flush(backend, depth);
+                condition = top;
+            }
+            emitByte(backend, code[0] == OP_JUMP_IF_FALSE ? REG_JUMP_IF_FALSE : REG_JUMP_IF_TRUE);
+            emitByte(backend, condition);
+            emitJump(backend, backend->out->count - 2, jumpDestination(chunk, offset));
+            break;
+        }
+        case OP_CALL:
+        case OP_TAIL_CALL: {
+            int argCount = code[1];
+            flush(backend, depth);              // the callee and arguments have to really be on the stack
+            emitByte(backend, code[0] == OP_TAIL_CALL ? REG_TAIL_CALL : REG_CALL);
+            emitByte(backend, top - argCount);
+            emitByte(backend, argCount);
+            break;
+        }
+        case OP_CLOSURE: {
+            flush(backend, depth);              // captured locals have to be in their registers
+            emitByte(backend, REG_CLOSURE);
+            emitByte(backend, depth);
+            int length = instructionLength(chunk, offset);
+            for (int i = 1; i < length; i++) emitByte(backend, code[i]);
+            break;
+        }
+        case OP_CLOSE_UPVALUE:
+            flush(backend, depth);
+            emitByte(backend, REG_CLOSE_UPVALUE);
+            emitByte(backend, top);
+            break;
+        case OP_RETURN:
+            emitByte(backend, REG_RETURN);
+            emitByte(backend, operand(backend, top));
+            break;
+    }
+    // after these we only continue at the target of some jump, and all jumps materialize everything before
+    if (code[0] == OP_JUMP || code[0] == OP_LOOP || code[0] == OP_RETURN) {
+        for (int reg = 0; reg < REGISTER_MAX; reg++) backend->pending[reg].type = PENDING_NONE;
+    }
+}
+
+// fills in the offsets of all jumps. Returns false if one doesnt fit into its 16 bits.
+static bool patchJumps(Backend* backend) {
+    for (int i = 0; i < backend->jumpCount; i++) {
+        RegJump* jump = &backend->jumps[i];
+        int distance = backend->labels[jump->target] - (jump->from + 2);
+        uint8_t* op = &backend->out->code[jump->op];
+        if (distance < 0) {
+            if (*op != REG_JUMP) return false;          // conditional jumps only go forward
+            *op = REG_LOOP;
+            distance = -distance;
+        }
+        if (distance > UINT16_MAX) return false;
+        backend->out->code[jump->from] = (distance >> 8) & 0xff;
+        backend->out->code[jump->from + 1] = distance & 0xff;
+    }
+    return true;
+}
+
+// translates the function's stack bytecode into register bytecode (function->regChunk).
+// returns false and leaves the function on the stack vm, if it uses anything the register vm cant do.
+bool compileRegisters(Arena* arena, ObjFunction* function) {
+    Chunk* chunk = &function->chunk;
+    if (chunk->count == 0) return false;
+    Backend backend;
+    backend.function = function;
+    backend.stack = chunk;
+    backend.out = &function->regChunk;
+    backend.arena = arena;
+    backend.depth = ARENA_ALLOCATE(arena, int, chunk->count);
+    backend.isTarget = ARENA_ALLOCATE(arena, bool, chunk->count);
+    backend.labels = ARENA_ALLOCATE(arena, int, chunk->count);
+    backend.jumps = ARENA_ALLOCATE(arena, RegJump, chunk->count);
+    backend.jumpCount = 0;
+    backend.lastDst = -1;
+    for (int i = 0; i < chunk->count; i++) {
+        backend.depth[i] = -1;
+        backend.isTarget[i] = false;
+    }
+    for (int i = 0; i < REGISTER_MAX; i++) backend.pending[i].type = PENDING_NONE;
+
+    bool ok = analyze(&backend);
+    LineReader lines;
+    initLineReader(&lines, chunk);
+    for (int offset = 0; ok && offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        if (backend.depth[offset] == -1) continue;          // unreachable
+        readLine(&lines, offset);
+        backend.line = lines.line;
+        backend.column = lines.column;
+        if (backend.isTarget[offset]) {
+            flush(&backend, backend.depth[offset]);         // whoever jumps here expects every value in its register
+        }
+        backend.labels[offset] = backend.out->count;
+        translate(&backend, offset, backend.depth[offset]);
+    }
+    if (ok) ok = patchJumps(&backend);
+
+    if (ok) {
+        function->maxRegisters = backend.maxDepth + 1;     // +1 for the register of a value pushed at the max depth
+        // inlined calls cover the translation of their instructions
+        for (int i = 0; i < chunk->inlinedCount; i++) {
+            InlinedCall* inlined = &chunk->inlined[i];
+            int end = inlined->end < chunk->count ? backend.labels[inlined->end] : backend.out->count;
+            addInlinedCall(backend.out, backend.labels[inlined->start], end, inlined->line, inlined->name);
+        }
+    } else {
+        freeChunk(&function->regChunk);
+    }
+    return ok;
+}
+
+// how many bytes the register instruction at offset takes up (opcode + its operands)
+int registerInstructionLength(ObjFunction* function, int offset) {
+    Chunk* chunk = &function->regChunk;
+    switch (chunk->code[offset]) {
+        case REG_NIL:
+        case REG_TRUE:
+        case REG_FALSE:
+        case REG_PRINT:
+        case REG_CLOSE_UPVALUE:
+        case REG_RETURN:
+            return 2;
+        case REG_EQUAL:
+        case REG_GREATER:
+        case REG_LESS:
+        case REG_ADD:
+        case REG_SUBTRACT:
+        case REG_MULTIPLY:
+        case REG_DIVIDE:
+        case REG_MODULO:
+        case REG_JUMP_IF_FALSE:
+        case REG_JUMP_IF_TRUE:
+            return 4;
+        case REG_CLOSURE: {
+            ObjFunction* closure = AS_FUNCTION(function->chunk.constants.values[chunk->code[offset + 2]]);
+            return 3 + 2 * closure->upvalueCount;
+        }
+        default:
+            return 3;
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef clox_register_h
+#define clox_register_h
+
+#include "chunk.h"
+#include "memory.h"
+#include "object.h"
+
+/*
+    Register based bytecode - the alternative instruction set of the vm (selected with --register)
+    - three-address instructions (ex. REG_ADD dst, b, c) that name their operands directly, instead of pushing and popping
+      them on the stack. Most OP_GET_LOCAL, OP_SET_LOCAL, OP_POP and OP_CONSTANT instructions just disappear.
+    - the registers are the slots of the frame's window on the stack: register i is exactly where the stack vm would
+      keep the i-th value (locals first, then temporaries). So calls, upvalues and the GC work the same in both modes.
+    - the compiler backend translates the finished stack bytecode of a function into register bytecode. Functions that use
+      anything it cant translate (classes, properties, arrays, maps) stay stack bytecode. Both kinds can call each other.
+*/
+
+// marks an 'RK' operand as index into the constants (instead of a register): rk & RK_CONSTANT ? constants[rk & 0x7f] : slots[rk]
+#define RK_CONSTANT 0x80
+#define REGISTER_MAX 128            // registers and RK-constants have to fit into 7 bits
+
+// all instructions of the register vm:
+//  - dst, src, a: register. rk: register or constant (RK_CONSTANT). k: constant (full byte). offset: 2 bytes like OP_JUMP
+typedef enum {
+    REG_MOVE,               // dst, src         dst = src
+    REG_LOADK,              // dst, k           dst = constants[k]
+    REG_NIL,                // dst
+    REG_TRUE,               // dst
+    REG_FALSE,              // dst
+    REG_GET_GLOBAL,         // dst, k           dst = globals[constants[k]]
+    REG_DEFINE_GLOBAL,      // k, rk
+    REG_SET_GLOBAL,         // k, rk
+    REG_GET_UPVALUE,        // dst, index
+    REG_SET_UPVALUE,        // index, rk
+    REG_EQUAL,              // dst, rk, rk      dst = b == c
+    REG_GREATER,
+    REG_LESS,
+    REG_ADD,
+    REG_SUBTRACT,
+    REG_MULTIPLY,
+    REG_DIVIDE,
+    REG_MODULO,
+    REG_NOT,                // dst, rk
+    REG_NEGATE,             // dst, rk
+    REG_JUMP,               // offset
+    REG_LOOP,               // offset (backwards)
+    REG_JUMP_IF_FALSE,      // rk, offset
+    REG_JUMP_IF_TRUE,       // rk, offset
+    REG_PRINT,              // rk
+    REG_CALL,               // a, argCount      callee in a, arguments in a+1... result lands in a
+    REG_TAIL_CALL,          // a, argCount      like REG_CALL, but the callee takes over the frame ("return f(x);")
+    REG_CLOSURE,            // dst, k, then (isLocal, index) pairs like OP_CLOSURE
+    REG_CLOSE_UPVALUE,      // src
+    REG_RETURN,             // rk
+} RegOpCode;
+
+#define IS_REGISTER_FUNCTION(function) ((function)->regChunk.count > 0)
+
+extern bool FLAG_REGISTER_VM;       // --register: compile functions to register bytecode and run them in runRegister()
+
+bool compileRegisters(Arena* arena, ObjFunction* function);
+int registerInstructionLength(ObjFunction* function, int offset);
+
+#endif
@@ -4,113 +4,184 @@
 #include "common.h"
 #include "scanner.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>      // skipping whitespace, comments and string bodies 16 chars at a time (x86-64 always has SSE2)
+#endif
+
 /*
     Scanner/Lexer chews trough the source code
     - tracks how far it already has gone
-    - one it reaches EoF '\0' its done
+    - once it reaches the end of the source its done. The source does not need a '\0' at its end (it might be a mapped file)
 
     At any point we know we only need 1 token look ahead (of current) to fulfill all our grammar
     So it will be enough to just 
-*/
 
-typedef struct {
-    const char* start;      // beginning of the current Lexeme that is beeing parse
-    const char* current;    // current char were scanning
-    int line;               // line in source code we need to pass on for error reporting
-} Scanner;
+    Speed: scanning is most of the compile time for big (generated) sources, so
+    - the long boring stretches (indentation, // comments, string bodies) get skipped 16 chars at a time with SSE2 (see skipTo())
+    - character classes come from a lookup table instead of comparisons
+    - keywords get recognized with a perfect hash: one table lookup and one memcmp per identifier
+*/
 
-Scanner scanner;
+void initScanner(Scanner* scanner, const char* source, size_t length) {
+    scanner->start = source;
+    scanner->current = source;
+    scanner->line = 1;       // first line is a 1 because thats how us humans roll
+    scanner->lineStart = source;
+    scanner->column = 1;
+    scanner->columnOffset = 0;
+    scanner->end = source + length;
+}
 
-void initScanner(const char* source) {
-    scanner.start = source;
-    scanner.current = source;
-    scanner.line = 1;       // first line is a 1 because thats how us humans roll
+// like initScanner() but source is a piece cut out of a bigger one, that starts at line and column (ex. a lazy function)
+void initScannerAt(Scanner* scanner, const char* source, size_t length, int line, int column) {
+    initScanner(scanner, source, length);
+    scanner->line = line;
+    scanner->columnOffset = column - 1;
 }
 
+// character classes, so isAlpha() and co. are a single lookup
+#define CHAR_ALPHA 0x1      // a-z A-Z _
+#define CHAR_DIGIT 0x2      // 0-9
+#define CHAR_SPACE 0x4      // whitespace that is not a newline
+
+static const uint8_t charClass[256] = {
+    ['a' ... 'z'] = CHAR_ALPHA,
+    ['A' ... 'Z'] = CHAR_ALPHA,
+    ['_'] = CHAR_ALPHA,
+    ['0' ... '9'] = CHAR_DIGIT,
+    [' '] = CHAR_SPACE, ['\t'] = CHAR_SPACE, ['\r'] = CHAR_SPACE,
+};
+
 // helper for scanToken - check for alphabethical Char (begin of identifier or Keyword)
 static bool isAlpha(char c) {
-    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+    return charClass[(uint8_t)c] & CHAR_ALPHA;
 }
 
 // helper for scanToken() - true if char between 0 and 9
 static bool isDigit(char c) {
-    return c >= '0' && c <= '9';
+    return charClass[(uint8_t)c] & CHAR_DIGIT;
 }
 
-// helper for scanToken() - checks if were at the end of the string (we appended '\0' at the end of the string when reading it form the file)
-static bool isAtEnd() {
-    return *scanner.current == '\0';
+// helper for identifierToken() - a char that can continue an identifier
+static bool isAlphaNumeric(char c) {
+    return charClass[(uint8_t)c] & (CHAR_ALPHA | CHAR_DIGIT);
+}
+
+// helper for scanToken() - checks if were at the end of the source
+static bool isAtEnd(Scanner* scanner) {
+    return scanner->current >= scanner->end;
 }
 
 // helper for scanToken() - read out the next char - consumes by incrementing the current-pointer
-static char advance() {
-    scanner.current++;
-    return scanner.current[-1];
+static char advance(Scanner* scanner) {
+    scanner->current++;
+    return scanner->current[-1];
 }
 
-// helper - peek into upcoming Char WITHOUT consuming it/incrementing current-pointer;
-static char peek() {
-    return *scanner.current;
+// helper - peek into upcoming Char WITHOUT consuming it/incrementing current-pointer; ('\0' at the end)
+static char peek(Scanner* scanner) {
+    if (isAtEnd(scanner)) return '\0';
+    return *scanner->current;
 }
 
 // helper - peek 2 characters forward WITHOUT consuming
-static char peekNext() {
-    if (isAtEnd()) return '\0';
-    return scanner.current[1];
+static char peekNext(Scanner* scanner) {
+    if (scanner->end - scanner->current < 2) return '\0';
+    return scanner->current[1];
 }
 
 // helper for scanToken() - peaks into next char 
 // ONLY incrementing the current-pointer IF we consume next char (like with '!=' or '>=')
-static bool match(char expected) {
-    if (isAtEnd()) return false;
-    if (*scanner.current != expected) return false;
-    scanner.current++;
+static bool match(Scanner* scanner, char expected) {
+    if (isAtEnd(scanner)) return false;
+    if (*scanner->current != expected) return false;
+    scanner->current++;
     return true;
 }
 
 // helper for scanToken() - constructor like for Token: 
 // - creates a token from the current start-pointer to current-pointer
-static Token makeToken(TokenType type) {
+static Token makeToken(Scanner* scanner, TokenType type) {
     Token token;
     token.type = type;
-    token.start = scanner.start;
-    token.length = (int)(scanner.current - scanner.start);
-    token.line = scanner.line;
+    token.start = scanner->start;
+    token.length = (int)(scanner->current - scanner->start);
+    token.line = scanner->line;
+    token.column = scanner->column;
     return token;
 }
 
 // helper for scanToken() - constructs a error Token - with length of the error-message etc.
-static Token errorToken(const char* message) {
+static Token errorToken(Scanner* scanner, const char* message) {
     Token token;
     token.type = TOKEN_ERROR;
     token.start = message;
     token.length = (int)strlen(message);
-    token.line = scanner.line;
+    token.line = scanner->line;
+    token.column = scanner->column;
     return token;
 }
 
+// helper for skipWhitespace(), stringToken() - the first char from at on that is a, b or c (or the end of the source)
+// - with SSE2 we compare 16 chars at once, the scalar loop does the rest (and everything without SSE2, like the wasm build)
+static const char* skipTo(Scanner* scanner, const char* at, char a, char b, char c) {
+#ifdef __SSE2__
+    __m128i wantA = _mm_set1_epi8(a);
+    __m128i wantB = _mm_set1_epi8(b);
+    __m128i wantC = _mm_set1_epi8(c);
+    while (scanner->end - at >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)at);
+        __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, wantA), _mm_cmpeq_epi8(chunk, wantB)), _mm_cmpeq_epi8(chunk, wantC));
+        int mask = _mm_movemask_epi8(hits);
+        if (mask != 0) return at + __builtin_ctz(mask);
+        at += 16;
+    }
+#endif
+    while (at < scanner->end && *at != a && *at != b && *at != c) at++;
+    return at;
+}
+
+// helper for skipWhitespace() - the first char from at on that is no space, tab or '\r'
+static const char* skipSpaces(Scanner* scanner, const char* at) {
+#ifdef __SSE2__
+    __m128i space = _mm_set1_epi8(' ');
+    __m128i tab = _mm_set1_epi8('\t');
+    __m128i carriage = _mm_set1_epi8('\r');
+    while (scanner->end - at >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)at);
+        __m128i spaces = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, space), _mm_cmpeq_epi8(chunk, tab)), _mm_cmpeq_epi8(chunk, carriage));
+        int mask = _mm_movemask_epi8(spaces) ^ 0xffff;      // bits of the chars that are NOT whitespace
+        if (mask != 0) return at + __builtin_ctz(mask);
+        at += 16;
+    }
+#endif
+    while (at < scanner->end && (charClass[(uint8_t)*at] & CHAR_SPACE)) at++;
+    return at;
+}
+
 // helper for scanToken() 
 // - removes all leading whitespace(and newlines)
 // - also remove everything commented out. after '//' till newline
-static void skipWhitespace() {
+static void skipWhitespace(Scanner* scanner) {
     for (;;) {
-        char c = peek();
+        char c = peek(scanner);
         switch (c) {
             case ' ':
             case '\r':
             case '\t':
-                advance();
+                scanner->current = skipSpaces(scanner, scanner->current);
                 break;
             case '\n':
-                scanner.line++;     // here we aditionally need to increment current line
-                advance();
+                scanner->line++;    // here we aditionally need to increment current line
+                advance(scanner);
+                scanner->lineStart = scanner->current;
+                scanner->columnOffset = 0;
                 break;
             case '/':
-                if (peekNext() == '/')  {
-                    while (peek() != '\n' && !isAtEnd()) {
-                        advance();  // keep advancing till newline reached (== end of commented-line)
-                        // since we did NOT consume the '\0' next skipWhitespace() loop will hit it and increment the linecount there
-                    }
+                if (peekNext(scanner) == '/')  {
+                    // skip till newline reached (== end of commented-line)
+                    // since we did NOT consume the '\n' next skipWhitespace() loop will hit it and increment the linecount there
+                    scanner->current = skipTo(scanner, scanner->current, '\n', '\n', '\n');
                 } else {
                     return;         // only single / detected -> not whitespace
                 }
@@ -121,136 +192,133 @@ static void skipWhitespace() {
     }
 }
 
-// helper for identifierType() - tries to match for keywords after hitting the 'start'-character
-// - after previously finding the prefix, we check if the rest of the Token chars follow 
-//      - (ex after a 'c' we check if the following chars are 'lass' if so we know we hit a 'class'-Token)
-static TokenType checkKeyword(int start, int length, const char* rest, TokenType type) {
-    if (scanner.current - scanner.start == start + length && 
-            memcmp(scanner.start + start, rest, length) == 0) {
-        return type;
-    }
-    return TOKEN_IDENTIFIER;
-}
+// perfect hash of the keywords - no two keywords share a slot, so one lookup and one compare tell if an identifier is a keyword.
+// (found by trying multipliers till all 17 keywords landed in different slots of 32, check that again when adding a keyword)
+#define KEYWORD_SLOTS 32
+#define KEYWORD_HASH(first, last, length) (((uint8_t)(first) * 7 + (uint8_t)(last) + (length)) & (KEYWORD_SLOTS - 1))
 
-// helper for identifierToken() - this checks Type of the current Token -> could be Keyword or Literal etc...
-// - we just check by hand for all reserved keywords:
-//      ( we know only and starts with 'a' or this and true for 't' so we only check that)
-// - this mean we can build a Trie/digital-tree to check for valid character combinations
-static TokenType identifierType() {
-    switch(scanner.start[0]) {
-        case 'a': return checkKeyword(1, 2, "nd", TOKEN_AND);
-        case 'c': return checkKeyword(1, 4, "lass", TOKEN_CLASS);
-        case 'e': return checkKeyword(1, 3, "lse", TOKEN_ELSE);
-        case 'f':
-            // since f cound lead to false || for or fun -> we branch for those:
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 'a': return checkKeyword(2, 3, "lse", TOKEN_FALSE);
-                    case 'o': return checkKeyword(2, 1, "r", TOKEN_FOR);
-                    case 'u': return checkKeyword(2, 1, "n", TOKEN_FUN);
-                }
-            }
-            break;
-        case 'i': return checkKeyword(1, 1, "f", TOKEN_IF);
-        case 'n': return checkKeyword(1, 2, "il", TOKEN_NIL);
-        case 'o': return checkKeyword(1, 1, "r", TOKEN_OR);
-        case 'p': return checkKeyword(1, 4, "rint", TOKEN_PRINT);
-        case 'r': return checkKeyword(1, 5, "eturn", TOKEN_RETURN);
-        case 's': return checkKeyword(1, 4, "uper", TOKEN_SUPER);
-        case 't':
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 'h': return checkKeyword(2, 2, "is", TOKEN_THIS);
-                    case 'r': return checkKeyword(2, 2, "ue", TOKEN_TRUE);
-                }
-            }
-            break;
-        case 'v': return checkKeyword(1, 2, "ar", TOKEN_VAR);
-        case 'w': return checkKeyword(1, 4, "hile", TOKEN_WHILE);
-    }
+typedef struct {
+    const char* name;
+    int length;             // 0 for empty slots -> never matches
+    TokenType type;
+} Keyword;
+
+static const Keyword keywords[KEYWORD_SLOTS] = {
+    [3] = {"this", 4, TOKEN_THIS},
+    [7] = {"if", 2, TOKEN_IF},
+    [9] = {"print", 5, TOKEN_PRINT},
+    [11] = {"while", 5, TOKEN_WHILE},
+    [12] = {"else", 4, TOKEN_ELSE},
+    [13] = {"class", 5, TOKEN_CLASS},
+    [14] = {"and", 3, TOKEN_AND},
+    [15] = {"var", 3, TOKEN_VAR},
+    [17] = {"nil", 3, TOKEN_NIL},
+    [18] = {"return", 6, TOKEN_RETURN},
+    [20] = {"false", 5, TOKEN_FALSE},
+    [21] = {"true", 4, TOKEN_TRUE},
+    [25] = {"import", 6, TOKEN_IMPORT},
+    [27] = {"fun", 3, TOKEN_FUN},
+    [28] = {"super", 5, TOKEN_SUPER},
+    [29] = {"or", 2, TOKEN_OR},
+    [31] = {"for", 3, TOKEN_FOR},
+};
+
+// helper for identifierToken() - this checks Type of the current Token -> a Keyword or an identifier
+static TokenType identifierType(Scanner* scanner) {
+    int length = (int)(scanner->current - scanner->start);
+    if (length > 6) return TOKEN_IDENTIFIER;               // longer than "return"
+    const Keyword* keyword = &keywords[KEYWORD_HASH(scanner->start[0], scanner->start[length - 1], length)];
+    if (keyword->length == length && memcmp(scanner->start, keyword->name, length) == 0) return keyword->type;
     return TOKEN_IDENTIFIER;
 }
 
 // helper for scanToken() - creates an Identifier Token (can be a Keyword or Literal etc...)
-static Token identifierToken() {
-    while (isAlpha(peek()) || isDigit(peek())) advance();       // after first digit we allow Alphanumerical
-    return makeToken(identifierType());                         // here let identifierType() identify the type
+static Token identifierToken(Scanner* scanner) {
+    while (isAlphaNumeric(peek(scanner))) advance(scanner);     // after first digit we allow Alphanumerical
+    return makeToken(scanner, identifierType(scanner));         // here let identifierType() identify the type
 }
 
 // helper for scanToken() - keeps consuming Digits (and one . if next Digit again) to get a Float-Token
-static Token numberToken() {
-    while (isDigit(peek())) advance();
+static Token numberToken(Scanner* scanner) {
+    while (isDigit(peek(scanner))) advance(scanner);
 
-    if (peek() == '.' && isDigit(peekNext())) {
-        advance();                  // consume the '.'
-        while (isDigit(peek())) advance();
+    if (peek(scanner) == '.' && isDigit(peekNext(scanner))) {
+        advance(scanner);           // consume the '.'
+        while (isDigit(peek(scanner))) advance(scanner);
     }
-    return makeToken(TOKEN_NUMBER);
+    return makeToken(scanner, TOKEN_NUMBER);
 }
 
 // helper for scanToken - (after opening ") we keep reading the literal till we hit a closing one or Error
-static Token stringToken() {
-    // keep going till we find '"' to terminate the string:
-    while(peek() != '"' && !isAtEnd()) {
-        if (peek() == '\\' && peekNext() == '"'){
-            advance();
+static Token stringToken(Scanner* scanner) {
+    // keep going till we find '"' to terminate the string (only escapes and newlines need a closer look):
+    for (;;) {
+        scanner->current = skipTo(scanner, scanner->current, '"', '\\', '\n');
+        if (isAtEnd(scanner) || peek(scanner) == '"') break;
+        if (peek(scanner) == '\\' && peekNext(scanner) == '"'){
+            advance(scanner);
+        }
+        if(peek(scanner) == '\n') {
+            scanner->line++;
+            scanner->lineStart = scanner->current + 1;
+            scanner->columnOffset = 0;
         }
-        if(peek() == '\n') scanner.line++;
-        advance();
+        advance(scanner);
     }
-    if (isAtEnd()) return errorToken("Unterminated string.");
+    if (isAtEnd(scanner)) return errorToken(scanner, "Unterminated string.");
 
-    advance();
-    return makeToken(TOKEN_STRING);
+    advance(scanner);
+    return makeToken(scanner, TOKEN_STRING);
 }
 
 // each call to this function scans a complete token.
 // - and by doing this sets the new current to after then end of the 'consumed' token
-Token scanToken() {
-    skipWhitespace();                               // ignore leading-whitespace before we start checking for a LEXEME
-    scanner.start = scanner.current;                // we know our last call to scanToken() ended the current-pointer 'above' the end of the last
-    if (isAtEnd()) return makeToken(TOKEN_EOF);     // We must add a EOF-Token at the end. The compiler needs this or it will keep going
+Token scanToken(Scanner* scanner) {
+    skipWhitespace(scanner);                        // ignore leading-whitespace before we start checking for a LEXEME
+    scanner->start = scanner->current;              // we know our last call to scanToken() ended the current-pointer 'above' the end of the last
+    scanner->column = (int)(scanner->start - scanner->lineStart) + 1 + scanner->columnOffset;
+    if (isAtEnd(scanner)) return makeToken(scanner, TOKEN_EOF); // We must add a EOF-Token at the end. The compiler needs this or it will keep going
 
     // advance a character
-    char c = advance();
+    char c = advance(scanner);
 
-    if (isAlpha(c)) return identifierToken();
-    if (isDigit(c)) return numberToken();  	            // instead of a switch for 0-9 digits we do this
+    if (isAlpha(c)) return identifierToken(scanner);
+    if (isDigit(c)) return numberToken(scanner);        // instead of a switch for 0-9 digits we do this
 
     switch (c) {
         // Map single-character TokenTypes to the char we just read:
-        case '(': return makeToken(TOKEN_LEFT_PAREN);
-        case ')': return makeToken(TOKEN_RIGHT_PAREN);
-        case '{': return makeToken(TOKEN_LEFT_BRACE);
-        case '}': return makeToken(TOKEN_RIGHT_BRACE);
-        case '[': return makeToken(TOKEN_LEFT_BRACKET);
-        case ']': return makeToken(TOKEN_RIGHT_BRACKET);
-        case ';': return makeToken(TOKEN_SEMICOLON);
-        case ',': return makeToken(TOKEN_COMMA);
-        case '.': return makeToken(TOKEN_DOT);
-        case '-': return makeToken(TOKEN_MINUS);
-        case '+': return makeToken(TOKEN_PLUS);
-        case '/': return makeToken(TOKEN_SLASH);
-        case '*': return makeToken(TOKEN_STAR);
-        case '%': return makeToken(TOKEN_MODULO);
-        case ':': return makeToken(TOKEN_COLON);
+        case '(': return makeToken(scanner, TOKEN_LEFT_PAREN);
+        case ')': return makeToken(scanner, TOKEN_RIGHT_PAREN);
+        case '{': return makeToken(scanner, TOKEN_LEFT_BRACE);
+        case '}': return makeToken(scanner, TOKEN_RIGHT_BRACE);
+        case '[': return makeToken(scanner, TOKEN_LEFT_BRACKET);
+        case ']': return makeToken(scanner, TOKEN_RIGHT_BRACKET);
+        case ';': return makeToken(scanner, TOKEN_SEMICOLON);
+        case ',': return makeToken(scanner, TOKEN_COMMA);
+        case '.': return makeToken(scanner, TOKEN_DOT);
+        case '-': return makeToken(scanner, TOKEN_MINUS);
+        case '+': return makeToken(scanner, TOKEN_PLUS);
+        case '/': return makeToken(scanner, TOKEN_SLASH);
+        case '*': return makeToken(scanner, TOKEN_STAR);
+        case '%': return makeToken(scanner, TOKEN_MODULO);
+        case ':': return makeToken(scanner, TOKEN_COLON);
 
         // Map two-character TokenTypes (like '!' can be ! for NOT or != for UNEQUALS)
         case '!':
-            return makeToken(
-                match('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
+            return makeToken(scanner,
+                match(scanner, '=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
         case '=':
-            return makeToken(
-                match('=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
+            return makeToken(scanner,
+                match(scanner, '=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
         case '<':
-            return makeToken(
-                match('=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
+            return makeToken(scanner,
+                match(scanner, '=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
         case '>':
-            return makeToken(
-                match('=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
+            return makeToken(scanner,
+                match(scanner, '=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
         
         // Literal Tokens (enclosed by "")
-        case '"': return stringToken();
+        case '"': return stringToken(scanner);
     }
-    return errorToken("Unexpected character.");     // couldnt parse Token -> do the Error-Token 
+    return errorToken(scanner, "Unexpected character."); // couldnt parse Token -> do the Error-Token 
 }
@@ -31,6 +31,7 @@ typedef enum {
     /*CUSTOM Tokens added on top of default-lox implementation*/
     TOKEN_MODULO,
     TOKEN_COLON,    // our map needs colon ':' -> var someMap = { "key" : 123 };
+    TOKEN_IMPORT,   // import "path/to/module.lox";
 
 } TokenType;
 
@@ -41,9 +42,22 @@ typedef struct {
     const char* start;      // the lexeme (character sequance like "var" or "=" or "12.5")
     int length;
     int line;
+    int column;             // where the lexeme starts in its line (1 = first character)
 } Token;
 
-void initScanner(const char* source);
-Token scanToken();
+// where scanning one source is at. Every compile has its own, so several sources can be scanned at once (see --check)
+typedef struct {
+    const char* start;      // beginning of the current Lexeme that is beeing parse
+    const char* current;    // current char were scanning
+    int line;               // line in source code we need to pass on for error reporting
+    const char* lineStart;  // first char of the current line (for the column of tokens)
+    int column;             // column of the current Lexeme
+    int columnOffset;       // columns left of the source on its first line (initScannerAt())
+    const char* end;        // right after the last char of the source. Nothing reads past it (not even the SIMD loads)
+} Scanner;
+
+void initScanner(Scanner* scanner, const char* source, size_t length);
+void initScannerAt(Scanner* scanner, const char* source, size_t length, int line, int column);
+Token scanToken(Scanner* scanner);
 
 #endif
\ No newline at end of file
@@ -8,17 +8,40 @@
 
 // if our load-factor (=entry_number/bucket_number) reaches this treshold we grow the HashMap size (reallocate it to be 2 times the size)
 #define TABLE_MAX_LOAD 0.75
+// if less than this share of buckets holds live entries after a delete we shrink the HashMap to half the size
+// - growing leaves us at 0.375 and shrinking at <0.5 load, so a map hovering arround one size does not resize back and forth
+#define TABLE_MIN_LOAD 0.25
+// we never shrink below this
+#define TABLE_MIN_CAPACITY 8
+// growing to this capacity (or bigger) happens incrementally: instead of rehashing everything at once (a noticeable stall for
+// big maps or the string-pool) we keep the old buckets and move TABLE_MIGRATE_STEP of them to the new ones on every get/set/delete
+// - growing leaves the new buckets at 0.375 load and every step adds at most 1 entry -> we are done long before the next grow
+#define TABLE_INCREMENTAL_MIN 65536
+#define TABLE_MIGRATE_STEP 32
+
+// bucket states:
+// - empty:     {key: NULL, value: false}   all bytes zero -> bucket arrays come zeroed from ALLOCATE_ZEROED (for big ones
+//                                          the OS hands out zero pages lazily, so no O(capacity) init loop when resizing)
+// - tombstone: {key: NULL, value: true}
+#define IS_EMPTY_BUCKET(entry) ((entry)->key == NULL && !AS_BOOL((entry)->value))
+#define TOMBSTONE_VAL BOOL_VAL(true)
 
 // constructor for the HashMap
 void initTable(Table* table) {
     table->count = 0;
+    table->tombstones = 0;
     table->capacity = 0;
     table->entries = NULL;
+    table->oldEntries = NULL;
+    table->oldCapacity = 0;
+    table->oldCount = 0;
+    table->migrateIndex = 0;
 }
 
 // basically behaves like a dynamic array (with some extra rules for inserting, delting, searching a value)
 void freeTable(Table* table) {
     FREE_ARRAY(Entry, table->entries, table->capacity);
+    FREE_ARRAY(Entry, table->oldEntries, table->oldCapacity);
     initTable(table);
 }
 
@@ -35,7 +58,7 @@ static Entry* findEntry(Entry* entries, int capacity, ObjString* key) {
     for (;;) {
         Entry* entry = &entries[index];
         if (entry->key == NULL) {
-            if (IS_NIL(entry->value)) {         //<- empty entry
+            if (!AS_BOOL(entry->value)) {       //<- empty entry
                 return tombstone != NULL ? tombstone : entry;
             } else {                            //<- we found a tombstone
                 if (tombstone == NULL) tombstone = entry;
@@ -48,28 +71,65 @@ static Entry* findEntry(Entry* entries, int capacity, ObjString* key) {
     }
 }
 
+// helper for the incremental resize - moves the entries of the next few old buckets to the new ones.
+// - a moved old bucket becomes a tombstone: lookups in the old buckets must still probe past it (empty ones stay empty)
+// - once all are moved the old buckets get freed
+static void migrateStep(Table* table, int buckets) {
+    if (table->oldEntries == NULL) return;
+    int end = table->migrateIndex + buckets;
+    if (end > table->oldCapacity) end = table->oldCapacity;
+    for (int i = table->migrateIndex; i < end; i++) {
+        Entry* entry = &table->oldEntries[i];
+        if (entry->key == NULL) continue;
+        Entry* dest = findEntry(table->entries, table->capacity, entry->key);
+        if (IS_EMPTY_BUCKET(dest)) table->count++;
+        else table->tombstones--;           // (the key is never in both buckets, so dest is empty or a tombstone)
+        dest->key = entry->key;
+        dest->value = entry->value;
+        entry->key = NULL;
+        entry->value = TOMBSTONE_VAL;
+        table->oldCount--;
+    }
+    table->migrateIndex = end;
+    if (end == table->oldCapacity) {
+        FREE_ARRAY(Entry, table->oldEntries, table->oldCapacity);
+        table->oldEntries = NULL;
+        table->oldCapacity = 0;
+        table->oldCount = 0;
+        table->migrateIndex = 0;
+    }
+}
+
+// helper - finishes a running incremental resize right away
+static void finishMigration(Table* table) {
+    migrateStep(table, table->oldCapacity);
+}
+
 // HashMap-Functionality - If finds entry it returns true, otherwise false. 
 // - value-output will point to resulting value if true
+// - while a resize is running we look into the new buckets first, then into the old ones
 bool tableGet(Table* table, ObjString* key, Value* value) {
-    if (table->count == 0) return false;
+    if (table->count == 0 && table->oldEntries == NULL) return false;
+    migrateStep(table, TABLE_MIGRATE_STEP);
     Entry* entry = findEntry(table->entries, table->capacity, key);
-    if(entry->key == NULL) return false;
+    if (entry->key == NULL) {
+        if (table->oldEntries == NULL) return false;
+        entry = findEntry(table->oldEntries, table->oldCapacity, key);
+        if (entry->key == NULL) return false;
+    }
     *value = entry->value;      // set the value-parameter found pointer to value
     return true;
 }
 
-// grows our HashTable size:
+// grows (or shrinks or just cleans up) our HashTable:
 // we can just write over the memory (because of collisions might become less on bigger space)
 // so we just make a empty new one. Then fill the table entry by entry.
 // - we dont copy Tombstones -> we need to recalculate the entries-count
 static void adjustCapacity(Table* table, int capacity){
     // we allocate an array of (empty) buckets
-    Entry* entries = ALLOCATE(Entry, capacity);
-    for (int i = 0; i<capacity; i++) {
-        entries[i].key = NULL;
-        entries[i].value = NIL_VAL;
-    }
+    Entry* entries = ALLOCATE_ZEROED(Entry, capacity);
     table->count = 0;
+    table->tombstones = 0;
 
     // we walk trough the old array front to back. 
     for (int i=0; i<table->capacity; i++) {
@@ -87,48 +147,131 @@ static void adjustCapacity(Table* table, int capacity){
     table->capacity = capacity;
 }
 
+// starts an incremental resize: the current buckets become the old ones, that get moved over bit by bit in migrateStep()
+static void startMigration(Table* table, int capacity) {
+    Entry* entries = ALLOCATE_ZEROED(Entry, capacity);  // might trigger GC (that might tombstone string-pool entries) -> count after this
+    table->oldEntries = table->entries;
+    table->oldCapacity = table->capacity;
+    table->oldCount = table->count - table->tombstones;
+    table->migrateIndex = 0;
+    table->entries = entries;
+    table->capacity = capacity;
+    table->count = 0;
+    table->tombstones = 0;
+}
+
 // HashMap-Functionality - Add the given key-value-pair to our table:
 bool tableSet(Table* table, ObjString* key, Value value) {
+    if (table->oldEntries != NULL) {
+        migrateStep(table, TABLE_MIGRATE_STEP);
+        if (table->oldEntries != NULL) {
+            // while resizing: if the key is still in the old buckets we update it there (it gets moved later)
+            Entry* entry = findEntry(table->oldEntries, table->oldCapacity, key);
+            if (entry->key != NULL) {
+                entry->value = value;
+                return false;
+            }
+        }
+    }
     // if our load-factor gets to big (to many entries in map) we make the map bigger:
-    if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
+    // - unless most used buckets are just tombstones (ex. a cache that churns keys) -> then a rehash at the same size clears them out
+    //   (or at a smaller size, if the GC tombstoned most of the string-pool)
+    if (table->count + table->oldCount + 1 > table->capacity * TABLE_MAX_LOAD) {
+        finishMigration(table);
+        int liveCount = table->count - table->tombstones;
         int capacity = GROW_CAPACITY(table->capacity);
-        adjustCapacity(table, capacity);
+        if (table->tombstones > liveCount) {
+            capacity = table->capacity;
+            while (capacity > TABLE_MIN_CAPACITY && liveCount + 1 < capacity * TABLE_MIN_LOAD) capacity /= 2;
+        }
+        if (capacity > table->capacity && capacity >= TABLE_INCREMENTAL_MIN) {
+            startMigration(table, capacity);
+        } else {
+            adjustCapacity(table, capacity);
+        }
     }
     // figure out what bucket we write to
     Entry* entry = findEntry(table->entries, table->capacity, key); 
     // then write to that bucket:
     bool isNewKey = entry->key == NULL; 
     // if key is already present we just overwrote to the same key (updated) -> we dont increment size:
-    // we also check if we write to a NOT Tombstone (the nil-check) only then do we increment
-    if (isNewKey && IS_NIL(entry->value)) table->count++;   
+    // we also check if we write to a NOT Tombstone (empty bucket) only then do we increment
+    if (IS_EMPTY_BUCKET(entry)) table->count++;   
+    else if (isNewKey) table->tombstones--;                 // we reused a tombstone
     entry->key = key;  
     entry->value = value;
     return isNewKey;
 }
 
+// helper - place the tombstone. We use a {key: NULL, Value: true} to represent this.
+// - this is arbitrarily chosen. Any unique combination (not in use) would work.
+static void placeTombstone(Table* table, Entry* entry) {
+    entry->key = NULL;
+    entry->value = TOMBSTONE_VAL;
+    table->tombstones++;
+}
+
 // HashMap-Functionality - Delete a key-value pair from the Map
 // - the problem is we can just delete the entry directly. Because another entry might have dependet on it's collision when beeing entered
 // - the solution is Tombstones. Instead of clearing the entry on deletion, we replace it with a special entry called tombstone
 //      during probing we dont treat tombstones like empty but keep going (we treat them like full)
+// - if the map got mostly empty we shrink it (that also clears out all tombstones), so a map that once was big gives back its memory
+// - while resizing we dont shrink, the key might also still be in the old buckets
 bool tableDelete(Table* table, ObjString* key) {
-    if (table->count == 0) return false;
+    if (table->count == 0 && table->oldEntries == NULL) return false;
+    migrateStep(table, TABLE_MIGRATE_STEP);
     Entry* entry = findEntry(table->entries, table->capacity, key);
-    if (entry->key == NULL) return false;
+    if (entry->key == NULL) {
+        if (table->oldEntries == NULL) return false;
+        entry = findEntry(table->oldEntries, table->oldCapacity, key);
+        if (entry->key == NULL) return false;
+        entry->key = NULL;              // old buckets dont count their tombstones
+        entry->value = TOMBSTONE_VAL;
+        table->oldCount--;
+        return true;
+    }
 
-    // place the tombstone. We use a {key: NULL, Value: true} to represent this.
-    // - this is arbitrarily chosen. Any unique combination (not in use) would work.
-    entry->key = NULL;
-    entry->value = BOOL_VAL(true);
+    placeTombstone(table, entry);
+    int liveCount = table->count - table->tombstones;
+    if (table->oldEntries == NULL && table->capacity > TABLE_MIN_CAPACITY && liveCount < table->capacity * TABLE_MIN_LOAD) {
+        adjustCapacity(table, table->capacity / 2);
+    }
     return true;
 }
 
 // HashMap-Functionality - Copies all Data from one HashTable to another - ex. used for inheritance (of class-methods)
 void tableAddAll(Table* from, Table* to) {
-    for (int i=0; i<from->capacity; i++) {
-        Entry* entry = &from->entries[i];
-        if (entry->key != NULL) {
-            tableSet(to, entry->key, entry->value);
+    int cursor = 0;
+    Entry* entry;
+    while ((entry = tableIterate(from, &cursor)) != NULL) {
+        tableSet(to, entry->key, entry->value);
+    }
+}
+
+// walks all key-value pairs of the table, in both bucket arrays while a resize is running.
+// - start with cursor = 0, returns NULL once done. (no adding/deleting keys of this table while walking it)
+Entry* tableIterate(Table* table, int* cursor) {
+    while (*cursor < table->capacity + table->oldCapacity) {
+        int i = (*cursor)++;
+        Entry* entry = i < table->capacity ? &table->entries[i] : &table->oldEntries[i - table->capacity];
+        if (entry->key != NULL) return entry;
+    }
+    return NULL;
+}
+
+// helper for tableFindString() and tableFindValue() - probes one bucket array, returns NULL if not found
+static Entry* findStringEntry(Entry* entries, int capacity, const char* chars, int length, uint32_t hash) {
+    uint32_t index = hash & (capacity - 1);      // modulo for 2pow
+    for (;;) {
+        Entry* entry = &entries[index];
+        if(entry->key == NULL) {
+            if (!AS_BOOL(entry->value)) return NULL;
+        } else if (entry->key->length == length &&
+                    entry->key->hash == hash &&
+                    memcmp(entry->key->chars, chars, length) == 0) {
+            return entry;
         }
+        index = (index + 1) & (capacity - 1);    // modulo with 2pow
     }
 }
 
@@ -141,51 +284,46 @@ void tableAddAll(Table* from, Table* to) {
 //    Everyplace else can just check if 2 strings use the same pointer in our stringpool-HashTable
 //    => STRING INTERNING - STRING DEDUPLICATION saves us a lot of time!
 ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash) {
-    if (table->count == 0) return NULL;
-
-    uint32_t index = hash & (table->capacity - 1);      // modulo for 2pow
-    for (;;) {
-        Entry* entry = &table->entries[index];
-        if(entry->key == NULL) {
-            if (IS_NIL(entry->value)) return NULL;
-        } else if (entry->key->length == length &&
-                    entry->key->hash == hash &&
-                    memcmp(entry->key->chars, chars, length) == 0) {
-            return entry->key;
-        }
-        index = (index + 1) & (table->capacity - 1);    // modulo with 2pow
+    if (table->count == 0 && table->oldEntries == NULL) return NULL;
+    Entry* entry = findStringEntry(table->entries, table->capacity, chars, length, hash);
+    if (entry == NULL && table->oldEntries != NULL) {
+        entry = findStringEntry(table->oldEntries, table->oldCapacity, chars, length, hash);
     }
+    return entry == NULL ? NULL : entry->key;
 }
-#include <stdio.h>
+
 /* CUSTOM lookup for value- like tableFindString() - takes use of string interning */
 // - if successful it writes pointer to value to value-arg
 bool tableFindValue(Table* table, const char* chars, int length, uint32_t hash, Value* value) {
-    if (table->count == 0) return false;
-
-    uint32_t index = hash & (table->capacity - 1);      // modulo for 2pow
-    for (;;) {
-        Entry* entry = &table->entries[index];
-        if(entry->key == NULL) {
-            if (IS_NIL(entry->value)) return false;
-        } else if (entry->key->length == length &&
-                    entry->key->hash == hash &&
-                    memcmp(entry->key->chars, chars, length) == 0) {
-            *value = entry->value;      // set the value-parameter found pointer to value
-            return true;
-        }
-        index = (index + 1) & (table->capacity - 1);    // modulo with 2pow
+    if (table->count == 0 && table->oldEntries == NULL) return false;
+    Entry* entry = findStringEntry(table->entries, table->capacity, chars, length, hash);
+    if (entry == NULL && table->oldEntries != NULL) {
+        entry = findStringEntry(table->oldEntries, table->oldCapacity, chars, length, hash);
     }
+    if (entry == NULL) return false;
+    *value = entry->value;      // set the value-parameter found pointer to value
+    return true;
 }
 
 // helper for collectGarbage() - we have to specially handle the weak-reference stringpool in our GC
 // - the string-table only uses the key (functions as a HashSet) 
 // -> so we can check if the key string object's mark is not set
 // -> its a white object that gets GC'd this cycle -> we remove it from string-table aswell
+// - we only place tombstones here and never shrink: we are in the middle of a GC and must not allocate.
+//   (the next tableSet() that crosses the max load clears them out)
 void tableRemoveWhite(Table* table) {
     for (int i=0; i<table->capacity; i++) {
         Entry* entry = &table->entries[i];
         if (entry->key != NULL && !entry->key->obj.isMarked) {
-            tableDelete(table, entry->key);
+            placeTombstone(table, entry);
+        }
+    }
+    for (int i=0; i<table->oldCapacity; i++) {
+        Entry* entry = &table->oldEntries[i];
+        if (entry->key != NULL && !entry->key->obj.isMarked) {
+            entry->key = NULL;
+            entry->value = TOMBSTONE_VAL;
+            table->oldCount--;
         }
     }
 }
@@ -193,8 +331,9 @@ void tableRemoveWhite(Table* table) {
 // used for GC - walks all the global variables in use and marks everything on heap that gets referenced.
 // - we also walk all the key strings since GC collects those aswell
 void markTable(Table* table) {
-    for (int i=0; i<table->capacity; i++) {
-        Entry* entry = &table->entries[i];
+    int cursor = 0;
+    Entry* entry;
+    while ((entry = tableIterate(table, &cursor)) != NULL) {
         markObject((Obj*)entry->key);
         markValue(entry->value);
     }
@@ -48,9 +48,15 @@ typedef struct {
 
 // The struct of our HashMap
 typedef struct {
-    int count;          // currently stores key-value pairs
+    int count;          // currently used buckets: key-value pairs + tombstones (both make probing longer)
+    int tombstones;     // how many of count are tombstones -> live entries = count - tombstones
     int capacity;       // capacity (so can easly get the load-factor: count/capacity)
     Entry* entries;     // array of the entries we hash
+    // incremental resize - while big tables grow we keep the old buckets arround and move a few of them on every operation
+    Entry* oldEntries;  // old buckets still to migrate (NULL if no resize is running)
+    int oldCapacity;
+    int oldCount;       // live entries left in oldEntries
+    int migrateIndex;   // next old bucket to migrate
 } Table;
 
 void initTable(Table* table);
@@ -62,6 +68,7 @@ void tableAddAll(Table* from, Table* to);
 ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash);
 void tableRemoveWhite(Table* table);
 void markTable(Table* table);
+Entry* tableIterate(Table* table, int* cursor);
 
 /*CUSTOM:*/
 bool tableFindValue(Table* table, const char* chars, int length, uint32_t hash, Value* value);
@@ -5,17 +5,24 @@
 
 #include "common.h"
 #include "compiler.h"
+#include "image.h"
+#include "module.h"
 #include "debug.h"
 #include "object.h"
 #include "memory.h"
 #include "vm.h"
 #include "array.h"
+#include "register.h"
 
 // instance of our VM:
 VM vm;
 
 // foward declaration:
 static void runtimeError(const char* format, ...);
+static bool callFromNative(Value callee, int argCount, Value* args, Value* result);
+static InterpretResult run(int baseFrame);
+static InterpretResult runRegister(int baseFrame);
+static void closeUpvalues(Value* last);
 
 
 // define Static/Native C-Functions - returns time elapsed since the program started running in seconds.
@@ -205,6 +212,220 @@ static NativeResult arrDeleteNative(int argCount, Value* args) {
     return result;
 }
 
+// shift(array) - removes the first element and returns it. Counterpart to pop()
+static NativeResult arrShiftNative(int argCount, Value* args) {
+    NativeResult result;
+    result.didError = false;
+    if (argCount != 1 || !IS_ARRAY(args[0])) {
+        runtimeError("wrong arguments for: 'shift(array)'.");
+        result.didError = true;
+        result.value = NIL_VAL;
+        return result;
+    }
+    ObjArray* array = AS_ARRAY(args[0]);
+    if (arrayGetLength(array) == 0) {
+        runtimeError("can't shift empty array.");
+        result.didError = true;
+        result.value = NIL_VAL;
+        return result;
+    }
+    result.value = arrayShift(array);   // return the item shifted out
+    return result;
+}
+
+// unshift(array, value) - adds value in front of the first element. Counterpart to push()
+static NativeResult arrUnshiftNative(int argCount, Value* args) {
+    NativeResult result;
+    result.didError = false;
+    if (argCount != 2 || !IS_ARRAY(args[0])) {
+        runtimeError("wrong arguments for: 'unshift(array, 123)'.");
+        result.didError = true;
+        result.value = NIL_VAL;
+        return result;
+    }
+    arrayPrepend(AS_ARRAY(args[0]), args[1]);
+    result.value = NIL_VAL;
+    return result;
+}
+
+// insert(array, index, value) - inserts value at index, moves following elements one up. "insert(arr, len(arr), x)" appends
+static NativeResult arrInsertNative(int argCount, Value* args) {
+    NativeResult result;
+    result.didError = false;
+    if (argCount != 3 || !IS_ARRAY(args[0]) || !IS_NUMBER(args[1])) {
+        runtimeError("wrong arguments for: 'insert(array, index, value)'.");
+        result.didError = true;
+        result.value = NIL_VAL;
+        return result;
+    }
+    ObjArray* array = AS_ARRAY(args[0]);
+    int idx = AS_NUMBER(args[1]);
+    if (idx < 0 || idx > arrayGetLength(array)) {
+        runtimeError("index out of bounds for: 'insert(array, index, value)'.");
+        result.didError = true;
+        result.value = NIL_VAL;
+        return result;
+    }
+    arrayInsertAt(array, idx, args[2]);
+    result.value = NIL_VAL;
+    return result;
+}
+
+// slice(array, start, end) - returns new array with elements [start, end). 'slice(arr, start)' takes everything from start.
+// - the slice shares its items with the original till one of them gets written to (copy on write)
+static NativeResult arrSliceNative(int argCount, Value* args) {
+    NativeResult result;
+    result.didError = false;
+    if ((argCount != 2 && argCount != 3) || !IS_ARRAY(args[0]) || !IS_NUMBER(args[1])
+            || (argCount == 3 && !IS_NUMBER(args[2]))) {
+        runtimeError("wrong arguments for: 'slice(array, start, end)'.");
+        result.didError = true;
+        result.value = NIL_VAL;
+        return result;
+    }
+    ObjArray* array = AS_ARRAY(args[0]);
+    int start = AS_NUMBER(args[1]);
+    int end = argCount == 3 ? AS_NUMBER(args[2]) : arrayGetLength(array);
+    if (start < 0 || start > end || end > arrayGetLength(array)) {
+        runtimeError("invalid range for: 'slice(array, start, end)'.");
+        result.didError = true;
+        result.value = NIL_VAL;
+        return result;
+    }
+    result.value = OBJ_VAL(arraySlice(array, start, end));
+    return result;
+}
+
+// reverse(array) - reverses the order of the elements in place
+static NativeResult arrReverseNative(int argCount, Value* args) {
+    NativeResult result;
+    result.didError = false;
+    if (argCount != 1 || !IS_ARRAY(args[0])) {
+        runtimeError("wrong arguments for: 'reverse(array)'.");
+        result.didError = true;
+        result.value = NIL_VAL;
+        return result;
+    }
+    arrayReverse(AS_ARRAY(args[0]));
+    result.value = NIL_VAL;
+    return result;
+}
+
+// fill(array, value) - overwrites every element with value
+static NativeResult arrFillNative(int argCount, Value* args) {
+    NativeResult result;
+    result.didError = false;
+    if (argCount != 2 || !IS_ARRAY(args[0])) {
+        runtimeError("wrong arguments for: 'fill(array, value)'.");
+        result.didError = true;
+        result.value = NIL_VAL;
+        return result;
+    }
+    arrayFill(AS_ARRAY(args[0]), args[1]);
+    result.value = NIL_VAL;
+    return result;
+}
+
+// indexOf(array, value) - index of the first element equal to value, -1 if there is none
+static NativeResult arrIndexOfNative(int argCount, Value* args) {
+    NativeResult result;
+    result.didError = false;
+    if (argCount != 2 || !IS_ARRAY(args[0])) {
+        runtimeError("wrong arguments for: 'indexOf(array, value)'.");
+        result.didError = true;
+        result.value = NIL_VAL;
+        return result;
+    }
+    result.value = NUMBER_VAL(arrayIndexOf(AS_ARRAY(args[0]), args[1]));
+    return result;
+}
+
+// array(n, init) - creates a new array with n elements all set to init. 'array(n)' fills with nil
+static NativeResult arrCreateNative(int argCount, Value* args) {
+    NativeResult result;
+    result.didError = false;
+    if ((argCount != 1 && argCount != 2) || !IS_NUMBER(args[0])) {
+        runtimeError("wrong arguments for: 'array(n, init)'.");
+        result.didError = true;
+        result.value = NIL_VAL;
+        return result;
+    }
+    double count = AS_NUMBER(args[0]);
+    // written so NaN fails it too. Sizes like 2.5 get rejected instead of silently rounded
+    if (!(count >= 0 && count <= ARRAY_MAX_COUNT) || count != myfloor(count)) {
+        runtimeError("invalid size for: 'array(n, init)'.");
+        result.didError = true;
+        result.value = NIL_VAL;
+        return result;
+    }
+    result.value = OBJ_VAL(arrayCreate((int)count, argCount == 2 ? args[1] : NIL_VAL));
+    return result;
+}
+
+// what sortCompare() needs to know to call the lox compare function
+typedef struct {
+    Value compareFn;
+    ObjArray* array;
+    ArrayStore* store;      // the array must still look the same after each call of compareFn, since we sort its items in place
+    int head;
+    int count;
+} SortContext;
+
+// helper for sort(array, compareFn) - calls compareFn(a, b), a belongs in front of b if that returns a number < 0
+static bool sortCompare(void* context, Value a, Value b, bool* isLess) {
+    SortContext* sort = (SortContext*)context;
+    ObjArray* array = sort->array;
+    if (sort->store == NULL) {
+        // first compare -> arraySort() has unwrapped the items into their final store, remember how that looks
+        sort->store = array->store;
+        sort->head = array->head;
+        sort->count = array->count;
+    }
+    Value args[2] = {a, b};
+    Value order;
+    if (!callFromNative(sort->compareFn, 2, args, &order)) return false;
+    if (array->store != sort->store || array->head != sort->head || array->count != sort->count || array->store->refCount != 1) {
+        runtimeError("array got modified while sorting.");
+        return false;
+    }
+    if (!IS_NUMBER(order)) {
+        runtimeError("compare function for 'sort(array, compareFn)' must return a number.");
+        return false;
+    }
+    *isLess = AS_NUMBER(order) < 0;
+    return true;
+}
+
+// sort(array) - sorts an array of only numbers or only strings in place (ascending)
+// sort(array, compareFn) - sorts anything. compareFn(a, b) returns <0 if a belongs in front of b.
+static NativeResult arrSortNative(int argCount, Value* args) {
+    NativeResult result;
+    result.didError = false;
+    result.value = NIL_VAL;
+    if ((argCount != 1 && argCount != 2) || !IS_ARRAY(args[0])) {
+        runtimeError("wrong arguments for: 'sort(array, compareFn)'.");
+        result.didError = true;
+        return result;
+    }
+    ObjArray* array = AS_ARRAY(args[0]);
+    if (argCount == 1) {
+        if (!arraySortDefault(array)) {
+            runtimeError("can only sort arrays of only numbers or only strings without a compare function.");
+            result.didError = true;
+        }
+        return result;
+    }
+    if (arrayGetLength(array) < 2) return result;
+    SortContext context;
+    context.compareFn = args[1];
+    context.array = array;
+    context.store = NULL;
+    if (!arraySort(array, sortCompare, &context)) {
+        result.didError = true;
+    }
+    return result;
+}
+
 // helperFunction to setup/reset the stack
 static void resetStack() {
     vm.stackTop = vm.stack;     // we just reuse the stack. So we can just point to its start
@@ -228,8 +449,16 @@ static void runtimeError(const char* format, ...) {
     for (int i = vm.frameCount - 1; i>=0; i--) {
         CallFrame* frame = &vm.frames[i];
         ObjFunction* function = frame->closure->function;
-        size_t instruction = frame->ip - function->chunk.code -1;
-        fprintf(stderr, "[line %d] in ", function->chunk.lines[instruction]);
+        Chunk* chunk = IS_REGISTER_FUNCTION(function) ? &function->regChunk : &function->chunk;
+        size_t instruction = frame->ip - chunk->code -1;
+        InlinedCall* inlined = findInlinedCall(chunk, (int)instruction);
+        if (inlined != NULL) {
+            // the error happened in code the optimizer inlined from another function -> we still show its frame
+            fprintf(stderr, "[line %d] in %s()\n", getLine(chunk, (int)instruction), inlined->name->chars);
+            fprintf(stderr, "[line %d] in ", inlined->line);
+        } else {
+            fprintf(stderr, "[line %d] in ", getLine(chunk, (int)instruction));
+        }
         if (function->name == NULL) {
             fprintf(stderr, "script\n");
         } else {
@@ -242,14 +471,59 @@ static void runtimeError(const char* format, ...) {
 // takes pointer to a C-Function and the name it will be known as in Lox. 
 // We Wrap the function in an ObjNative then store that in a global Variable (that our code can call)
 // -  we push and pop the name and function on the stack -> this is so the GC will not free anything in use
-static void defineNative(const char* name, NativeFn function) {
+static void defineNative(Table* globals, const char* name, NativeFn function) {
     push(OBJ_VAL(copyString(name, (int)strlen(name))));
     push(OBJ_VAL(newNative(function)));
-    tableSet(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
+    tableSet(globals, AS_STRING(vm.stackTop[-2]), vm.stackTop[-1]);
     pop();
     pop();
 }
 
+// all native functions and the names lox knows them by. (snapshots refer to a native by its index in here, see image.c)
+static const struct {
+    const char* name;
+    NativeFn function;
+} natives[] = {
+    {"clock", clockNative},
+    {"push", arrPushNative},
+    {"pop", arrPopNative},
+    {"delete", arrDeleteNative},
+    {"shift", arrShiftNative},
+    {"unshift", arrUnshiftNative},
+    {"insert", arrInsertNative},
+    {"slice", arrSliceNative},
+    {"sort", arrSortNative},
+    {"reverse", arrReverseNative},
+    {"fill", arrFillNative},
+    {"indexOf", arrIndexOfNative},
+    {"array", arrCreateNative},
+    {"len", lengthNative},
+    {"floor", floorNative},
+    {"printf", printfNative},
+    {"typeof", typeofNative},
+};
+#define NATIVE_COUNT ((int)(sizeof(natives) / sizeof(natives[0])))
+
+// index of the native in natives[] (-1 if it is none of ours)
+int nativeIndex(NativeFn function) {
+    for (int i = 0; i < NATIVE_COUNT; i++) {
+        if (natives[i].function == function) return i;
+    }
+    return -1;
+}
+
+// the native at index in natives[] (NULL if there is none)
+NativeFn nativeAt(int index) {
+    return index >= 0 && index < NATIVE_COUNT ? natives[index].function : NULL;
+}
+
+// defines all natives in globals (the ones of the vm or of a module)
+void defineNatives(Table* globals) {
+    for (int i = 0; i < NATIVE_COUNT; i++) {
+        defineNative(globals, natives[i].name, natives[i].function);
+    }
+}
+
 void initVM() {
     resetStack();
     vm.objects = NULL;      // reset linked list of all active object
@@ -258,28 +532,27 @@ void initVM() {
     vm.grayCount = 0;       // init the gray-Stack we use in our GC-Algorithm:
     vm.grayCapacity = 0;
     vm.grayStack = NULL;
+    vm.gcCount = 0;
+    vm.gcSeconds = 0;
+    #ifdef DEBUG_COUNT_INSTRUCTIONS
+    vm.instructionCount = 0;
+    #endif
     initTable(&vm.globals); // setup the HashTable for global variables
     initTable(&vm.strings); // setup the HashTable for used strings
     // to make lookup for "init()" we define this ObjString(string-interning):
     vm.initString = NULL;   // zero the field out to avoid GC reading undefined before copyString("init")
     vm.initString = copyString("init", 4);  
     // init Native Functions:
-    defineNative("clock", clockNative);
-    defineNative("push", arrPushNative);
-    defineNative("pop", arrPopNative);
-    defineNative("delete", arrDeleteNative);
-    defineNative("len", lengthNative);
-    defineNative("floor", floorNative);
-    defineNative("printf", printfNative);
-    defineNative("typeof", typeofNative);
-    
+    defineNatives(&vm.globals);
 }
 
 void freeVM() {
     freeTable(&vm.globals);
+    freeModules();
     freeTable(&vm.strings);
     vm.initString = NULL;   // manually clear the pointer
     freeObjects();          // when free the vm, we need to free all objects in the linked-list of objects.
+    freeImages();           // the chunks of loaded images pointed into those
 }
 
 // push a value to our Value-Stack
@@ -299,10 +572,36 @@ static Value peek(int distance) {
     return vm.stackTop[-1-distance];
 }
 
+// the globals function reads and writes: the ones of its module (import) or the ones of the vm for the main script
+static inline Table* globalsOf(ObjFunction* function) {
+    return function->module == NULL ? &vm.globals : &function->module->globals;
+}
+
+// helper for call() and tailCall() - points the frame (its window on the stack already starts at the callee) at the closure's code
+static void enterFunction(CallFrame* frame, ObjClosure* closure) {
+    frame->closure = closure;                               //  in the new CallFrame we point to the function
+    frame->ip = closure->function->chunk.code;              //  initialize its ip to the beginning of the functions bytecode
+    if (IS_REGISTER_FUNCTION(closure->function)) {
+        // register functions own a fixed window of registers. The ones above the arguments start out nil (so the GC never sees garbage)
+        frame->ip = closure->function->regChunk.code;
+        Value* registersEnd = frame->slots + closure->function->maxRegisters;
+        for (Value* slot = vm.stackTop; slot < registersEnd; slot++) *slot = NIL_VAL;
+        vm.stackTop = registersEnd;
+    }
+}
+
 // initializes the next CallFrame on the stack
 // - stores pointer to the function beeing called and points the frame's ip to the beginning of that functions bytecode
 // - then it sets up slots pointer to give the frame it's window on the stack.
 static bool call(ObjClosure* closure, int argCount) {
+    // --lazy: the first call compiles the function's body
+    if (closure->function->lazy != NULL) {
+        if (!compileLazy(closure->function)) {
+            runtimeError("Could not compile function '%s'.", closure->function->name->chars);
+            return false;
+        }
+        if (closure->function->module != NULL) setFunctionModule(closure->function, closure->function->module);
+    }
     // ErrorChecking "fun do(a,b,c){} do(1,2)" -> called with wrong nr Parameters
     if (argCount != closure->function->arity) {
         runtimeError("Expected %d arguments but got %d.", closure->function->arity, argCount);
@@ -314,11 +613,35 @@ static bool call(ObjClosure* closure, int argCount) {
     }
     // Setup the Stack-Frame:
     CallFrame* frame = &vm.frames[vm.frameCount++];         //  prepare an initial CallFrame 
-    frame->closure = closure;                               //  in the new CallFrame we point to the function
-    frame->ip = closure->function->chunk.code;              //  initialize its ip to the beginning of the functions bytecode
     //                                                          and set up its stack window to start at the bottom of the VM's value stack 
     frame->slots = vm.stackTop - argCount -1;               // -1 because of the reserved 0-idx stack slot(reserved for methods-calls)
-                                                                
+    enterFunction(frame, closure);
+    return true;
+}
+
+// proper tail calls - "return f(x);" reuses the CallFrame of the function that returns, instead of pushing a new one.
+// So recursion in tail position runs in constant stack space (and never hits FRAMES_MAX).
+// - closes the upvalues of the returning function, slides callee and arguments down to the start of its window.
+// - returns false if the callee needs a normal call instead: natives, classes, wrong nr of arguments (call() reports that),
+//   functions that run on the other interpreter loop (--register) and ones that did not get compiled yet (--lazy)
+static bool tailCall(CallFrame* frame, Value callee, int argCount) {
+    ObjClosure* closure;
+    if (IS_CLOSURE(callee)) {
+        closure = AS_CLOSURE(callee);
+    } else if (IS_BOUND_METHOD(callee)) {
+        closure = AS_BOUND_METHOD(callee)->method;
+    } else {
+        return false;
+    }
+    if (closure->function->lazy != NULL || argCount != closure->function->arity) return false;
+    if (IS_REGISTER_FUNCTION(closure->function) != IS_REGISTER_FUNCTION(frame->closure->function)) return false;
+
+    Value* callSlots = vm.stackTop - argCount - 1;
+    if (IS_BOUND_METHOD(callee)) callSlots[0] = AS_BOUND_METHOD(callee)->receiver;   // the receiver goes into slot 0
+    closeUpvalues(frame->slots);
+    memmove(frame->slots, callSlots, sizeof(Value) * (argCount + 1));
+    vm.stackTop = frame->slots + argCount + 1;
+    enterFunction(frame, closure);
     return true;
 }
 
@@ -353,9 +676,9 @@ static bool callValue(Value callee, int argCount) {
                 // if the object being called is a native function -> invoke the C-Function right there
                 NativeFn native = AS_NATIVE(callee);
                 NativeResult result = native(argCount, vm.stackTop - argCount);
+                if (result.didError) return false;      // runtimeError() already reset the stack, nothing left to clean up
                 vm.stackTop -= argCount + 1;
                 push(result.value);   // we use the result from the C-Function and stuff it back in the stack
-                if (result.didError) return false;
                 return true;
             }
             default:
@@ -366,6 +689,59 @@ static bool callValue(Value callee, int argCount) {
     return false;
 }
 
+// runs the topmost CallFrame (and everything it calls) with the interpreter loop that fits its bytecode
+static InterpretResult execute(int baseFrame) {
+    ObjFunction* function = vm.frames[vm.frameCount - 1].closure->function;
+    return IS_REGISTER_FUNCTION(function) ? runRegister(baseFrame) : run(baseFrame);
+}
+
+// lets native functions call any lox-callable (ex. the compare function of sort()) and get back its return value
+// - pushes callee and args and runs the call to completion in a nested run() 
+// - returns false on a runtime error (that already got reported and the stack reset)
+static bool callFromNative(Value callee, int argCount, Value* args, Value* result) {
+    int baseFrame = vm.frameCount;
+    push(callee);
+    for (int i = 0; i < argCount; i++) {
+        push(args[i]);
+    }
+    if (!callValue(callee, argCount)) return false;
+    if (vm.frameCount > baseFrame) {                        // closures (and init() methods) got a new CallFrame we have to run first
+        if (execute(baseFrame) != INTERPRET_OK) return false;
+    }
+    *result = pop();
+    return true;
+}
+
+// runs the top level code of a module that just got imported (in a nested run like callFromNative() does)
+static bool runModule(Module* module) {
+    int baseFrame = vm.frameCount;
+    push(OBJ_VAL(module->function));
+    ObjClosure* closure = newClosure(module->function);
+    pop();
+    push(OBJ_VAL(closure));
+    if (!call(closure, 0)) return false;
+    if (execute(baseFrame) != INTERPRET_OK) return false;
+    pop();                                  // the nil its top level code returned
+    return true;
+}
+
+// helper for invokeFromClass() - the fast path for trivial getters and setters: reads/writes the field right away, without a CallFrame.
+// - returns false if the guard fails (wrong nr of arguments, the getter's field does not exist yet) -> we do a normal call
+static bool invokeAccessor(ObjFunction* function, int argCount) {
+    if (argCount != function->arity) return false;
+    ObjInstance* instance = AS_INSTANCE(vm.stackTop[-argCount - 1]);
+    if (function->accessor == ACCESSOR_GETTER) {
+        Value value;
+        if (!tableGet(&instance->fields, function->field, &value)) return false;
+        vm.stackTop[-1] = value;                // replaces the receiver
+    } else {
+        tableSet(&instance->fields, function->field, peek(0));
+        vm.stackTop--;
+        vm.stackTop[-1] = NIL_VAL;              // setters return nil
+    }
+    return true;
+}
+
 // helper for invoke() - combines logic for OP_GET_PROPERTY and OP_CALL, but with less lookups/stack ready -> faster
 // - lookup method by name in method-table. (error if not found)
 // - take the moethods closure and push a call to in on the CallFrame stack. (receiver and method arguments are already there)
@@ -375,9 +751,19 @@ static bool invokeFromClass(ObjClass* pClass, ObjString* name, int argCount) {
         runtimeError("Undefined property '%s'.", name->chars);
         return false;
     }
+    ObjFunction* function = AS_CLOSURE(method)->function;
+    if (function->accessor != ACCESSOR_NONE && invokeAccessor(function, argCount)) return true;
     return call(AS_CLOSURE(method), argCount);
 }
 
+// helper for OP_CLOSURE - a function without upvalues always gets the same closure, so they all share one (allocated the first time).
+// -> declaring such a function (ex. inside a loop) or a method does not allocate anymore
+static ObjClosure* makeClosure(ObjFunction* function) {
+    if (function->upvalueCount > 0) return newClosure(function);
+    if (function->closure == NULL) function->closure = newClosure(function);
+    return function->closure;
+}
+
 // helper for run() - read receiver Instance from stack and pass that down to invokeFromClass
 static bool invoke(ObjString* name, int argCount) {
     Value receiver = peek(argCount);                // read receiver from the stack (its below arguments on the stack)
@@ -465,21 +851,30 @@ static bool isFalsey(Value value) {
     return IS_NIL(value) || ( IS_BOOL(value) && !AS_BOOL(value) );
 }
 
+// helper for runRegister() - reads an RK operand: a register or (with the RK_CONSTANT bit set) a constant
+static inline Value rk(Value* slots, Value* constants, uint8_t operand) {
+    return (operand & RK_CONSTANT) ? constants[operand & ~RK_CONSTANT] : slots[operand];
+}
+
 // Concatenate two strings
 // - calculate length of result string
 // - allocate char-array for the result (with calculated length)
 // - copy into our result first a, then b, then the Nullterminator:'\0'
-static void concatenate() {
-    ObjString* b = AS_STRING(peek(0));  // we read and temporarily it but leave it on the stack
-    ObjString* a = AS_STRING(peek(1));  // to make sure GC can find it
-
+// - a and b have to be reachable for the GC (ex. on the stack) while we allocate
+static ObjString* concatenateStrings(ObjString* a, ObjString* b) {
     int length = a->length + b->length;
     char* chars = ALLOCATE(char, length + 1);
     memcpy(chars, a->chars, a->length);
     memcpy(chars + a->length, b->chars, b->length);
     chars[length] = '\0';
+    return takeString(chars, length);
+}
 
-    ObjString* result = takeString(chars, length);
+// helper for run() - concatenates the two strings on top of the stack
+static void concatenate() {
+    ObjString* b = AS_STRING(peek(0));  // we read and temporarily it but leave it on the stack
+    ObjString* a = AS_STRING(peek(1));  // to make sure GC can find it
+    ObjString* result = concatenateStrings(a, b);
     pop();                              // we pop the 2 string objects from the stack
     pop();                              // that we only left there for GC safety
     push(OBJ_VAL(result));
@@ -487,7 +882,9 @@ static void concatenate() {
 
 
 // helper function for interpret() that actually runs the current instruction
-static InterpretResult run() {
+// runs the bytecode of the topmost CallFrame(s).
+// - baseFrame: we return once the frameCount drops back to it. (0 for the script, higher when a native calls back into lox)
+static InterpretResult run(int baseFrame) {
     // instance of our CallFrame:
     CallFrame* frame = &vm.frames[vm.frameCount - 1];
 // macro-READ_BYTE reads the byte currently pointed at by the instruction-pointer(ip) then advances the ip.
@@ -514,6 +911,29 @@ static InterpretResult run() {
         double a = AS_NUMBER(pop()); \
         push(valueType(a op b)); \
     } while (false);
+// macro - quickening: rewrites the opcode of the instruction we are executing (it sits 'length' bytes behind ip) into a
+// version specialized for the operand types we just saw. The chunk is shared, so every later run of that function uses it.
+// - code mapped from a .loxc image stays as it is: it is read only, so its pages can be shared by every process running the image
+#define QUICKEN(length, op) \
+    do { \
+        if (!frame->closure->function->chunk.mapped) frame->ip[-(length)] = (op); \
+    } while (false)
+// macro - a specialized instruction whose guard failed turns back into the generic one -> we dispatch that one again
+// (never happens in mapped code, images hold only generic instructions)
+#define DESPECIALIZE(op) \
+    do { \
+        frame->ip--; \
+        *frame->ip = (op); \
+    } while (false)
+// macro - a call might have pushed the CallFrame of a register function (--register). That one runs in runRegister()
+// till it returns its result to us.
+#define RUN_REGISTER_CALLEE() \
+    do { \
+        if (IS_REGISTER_FUNCTION(frame->closure->function)) { \
+            if (runRegister(vm.frameCount - 1) != INTERPRET_OK) return INTERPRET_RUNTIME_ERROR; \
+            frame = &vm.frames[vm.frameCount - 1]; \
+        } \
+    } while (false)
 
     for(;;) {
         // support for the Debug-Flag to enable printing out diagnostics:
@@ -532,6 +952,10 @@ static InterpretResult run() {
             }
         #endif
 
+        #ifdef DEBUG_COUNT_INSTRUCTIONS
+            vm.instructionCount++;
+        #endif
+
         // first byte of each instruction is opcode so we decode/dispatch it:
         uint8_t instruction;
         switch (instruction = READ_BYTE()) {
@@ -557,11 +981,22 @@ static InterpretResult run() {
                 frame->slots[slot] = peek(0);
                 break;
             }
+            case OP_SET_LOCAL_POP: {                // (from the optimizer) like OP_SET_LOCAL followed by OP_POP
+                uint8_t slot = READ_BYTE();
+                frame->slots[slot] = pop();
+                break;
+            }
+            case OP_POP_BELOW: {                    // (from the optimizer) end of an inlined call: [callee, args..., result] -> [result]
+                Value result = peek(0);
+                vm.stackTop -= READ_BYTE();
+                vm.stackTop[-1] = result;
+                break;
+            }
             case OP_GET_GLOBAL: {                   // get value for named-variable and push it on stack.
                 ObjString* name = READ_STRING();
                 Value value;
                 // if key isnt present, that means the variable has not been defined -> runtime error:
-                if (!tableGet(&vm.globals, name, &value)) {
+                if (!tableGet(globalsOf(frame->closure->function), name, &value)) {
                     runtimeError("Undefined variable '%s'.", name->chars);
                     return INTERPRET_RUNTIME_ERROR;
                 }
@@ -570,20 +1005,35 @@ static InterpretResult run() {
             }
             case OP_DEFINE_GLOBAL: {                // pop the last val from stack and write it to our globals table
                 ObjString* name = READ_STRING();    // get var identifier from constant table
-                tableSet(&vm.globals, name, peek(0));
+                tableSet(globalsOf(frame->closure->function), name, peek(0));
                 pop();
                 break;
             }
             case OP_SET_GLOBAL: {                   // Try to write to existing global variable
                 ObjString* name = READ_STRING();
-                if (tableSet(&vm.globals, name, peek(0))) {
-                    tableDelete(&vm.globals, name); // delete zombie values from table (important for REPL)
+                Table* globals = globalsOf(frame->closure->function);
+                if (tableSet(globals, name, peek(0))) {
+                    tableDelete(globals, name);     // delete zombie values from table (important for REPL)
                     runtimeError("Undefined variable '%s'.", name->chars);
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 // no pop() from the stack, since the assignment could be nested in some larger expression
                 break;
             }
+            case OP_IMPORT: {                       // runs the module (the first time) then copies its globals into ours
+                ObjString* path = READ_STRING();
+                Module* module = importModule(frame->closure->function->module, path);
+                if (module == NULL) {
+                    runtimeError("Could not import \"%s\".", path->chars);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if (!module->ran) {
+                    module->ran = true;             // an import cycle back to it just gets the globals it has so far
+                    if (!runModule(module)) return INTERPRET_RUNTIME_ERROR;
+                }
+                tableAddAll(&module->globals, globalsOf(frame->closure->function));
+                break;
+            }
             case OP_SET_UPVALUE: {                  // we take the value on top of the stack and store it into the slot pointed by upvalue
                 uint8_t slot = READ_BYTE();
                 *frame->closure->upvalues[slot]->location = peek(0);
@@ -608,6 +1058,7 @@ static InterpretResult run() {
                 if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
                     concatenate();      // string + x -> contatenate together
                 } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
+                    QUICKEN(1, OP_ADD_NUM_NUM);
                     double b = AS_NUMBER(pop());
                     double a = AS_NUMBER(pop());
                     push(NUMBER_VAL(a + b));
@@ -648,6 +1099,11 @@ static InterpretResult run() {
                 if (isFalsey(peek(0))) frame->ip += offset;
                 break;
             }
+            case OP_JUMP_IF_TRUE: {         // (from the optimizer) jumps forward if the value on the stack is truthy.
+                uint16_t offset = READ_SHORT();
+                if (!isFalsey(peek(0))) frame->ip += offset;
+                break;
+            }
             case OP_LOOP: {                 // unconditionally jumps back to the 16-bit offset that follows in 2 8bit chunks afterwards
                 uint16_t offset = READ_SHORT();
                 frame->ip -= offset;
@@ -659,6 +1115,18 @@ static InterpretResult run() {
                     return INTERPRET_RUNTIME_ERROR;     // if callValue() -> false we know a runtime error happened
                 }
                 frame = &vm.frames[vm.frameCount - 1];  // there will be a new frame on the CallFrame stack for the called function, that we update
+                RUN_REGISTER_CALLEE();
+                break;
+            }
+            case OP_TAIL_CALL: {            // "return f(x);" - the callee takes over our CallFrame (the OP_RETURN after us only runs if it cant)
+                int argCount = READ_BYTE();
+                Value callee = peek(argCount);
+                if (tailCall(frame, callee, argCount)) break;
+                if (!callValue(callee, argCount)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                frame = &vm.frames[vm.frameCount - 1];
+                RUN_REGISTER_CALLEE();
                 break;
             }
             case OP_INVOKE: {               // Method calls got their special Invoke OpCode to make those lookups faster
@@ -668,11 +1136,12 @@ static InterpretResult run() {
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 frame = &vm.frames[vm.frameCount - 1];
+                RUN_REGISTER_CALLEE();
                 break;
             }
             case OP_CLOSURE: {                           
                 ObjFunction* function = AS_FUNCTION(READ_CONSTANT());   // load the compiled function from the const-table
-                ObjClosure* closure = newClosure(function);             // -> wrap it in ObjClosure
+                ObjClosure* closure = makeClosure(function);            // -> wrap it in ObjClosure
                 push(OBJ_VAL(closure));                                 // -> and push it to the stack
                 // we iterate over each upvalue the closure expects:
                 for (int i=0; i<closure->upvalueCount; i++) {
@@ -702,6 +1171,7 @@ static InterpretResult run() {
                 Value value;
                 //                              we read the field name from name-lookuptable:
                 if (tableGet(&instance->fields, name, &value)) {
+                    QUICKEN(2, OP_GET_FIELD);
                     pop();                      // if variable exists we pop it
                     push(value);                // and push the value of the variable
                     break;
@@ -742,6 +1212,7 @@ static InterpretResult run() {
                 } 
                 vm.stackTop = frame->slots;
                 push(result);   // we push that result of the finished function back on the stack. (one level lower)
+                if (vm.frameCount == baseFrame) return INTERPRET_OK;    // finished the function a native called -> back to callFromNative()
                 frame = &vm.frames[vm.frameCount - 1];
                 break;
             }   
@@ -780,6 +1251,7 @@ static InterpretResult run() {
                     return INTERPRET_RUNTIME_ERROR; // if method is not found we abort
                 }
                 frame = &vm.frames[vm.frameCount - 1];
+                RUN_REGISTER_CALLEE();
                 break;
             }
             case OP_METHOD:
@@ -833,6 +1305,7 @@ static InterpretResult run() {
                         runtimeError("Map key must be a string.");
                         return INTERPRET_RUNTIME_ERROR;
                     }
+                    QUICKEN(1, OP_INDEX_MAP_STR);
                     ObjString* key = AS_STRING(pop()); // should be ok to pop here, since no allocation
                     ObjMap* map = AS_MAP(pop());
                     Value result;
@@ -861,6 +1334,7 @@ static InterpretResult run() {
                         runtimeError("Array index=%d out of range. Current len()=%d.", idx, arrayGetLength(array));
                         return INTERPRET_RUNTIME_ERROR;
                     }
+                    QUICKEN(1, OP_INDEX_ARRAY_NUM);
                     Value result = arrayReadFromIdx(array, idx);
                     push(result);
                     break;
@@ -874,6 +1348,7 @@ static InterpretResult run() {
                         runtimeError("Map key must be a string.");
                         return INTERPRET_RUNTIME_ERROR;
                     }
+                    QUICKEN(1, OP_STORE_MAP_STR);
                     ObjString* key = AS_STRING(peek(1));
                     ObjMap* map = AS_MAP(peek(2));          // keeping value, key, map GC secure
                     // writing nil to a value == deleting in our implementation:
@@ -907,6 +1382,7 @@ static InterpretResult run() {
                         runtimeError("Invalid index to array.");
                         return INTERPRET_RUNTIME_ERROR;
                     }
+                    QUICKEN(1, OP_STORE_ARRAY_NUM);
                     arrayWriteTo(array, idx, item);
                     pop();      // we kept value on for GC
                     pop();
@@ -915,6 +1391,88 @@ static InterpretResult run() {
                     break;
                 }
             }
+
+            /* Quickened instructions - the generic ones above rewrite themselves into these once they saw the operand types.
+               Each one checks its guard first, and on a miss turns back into the generic instruction. */
+            case OP_ADD_NUM_NUM: {
+                if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
+                    DESPECIALIZE(OP_ADD);
+                    break;
+                }
+                double b = AS_NUMBER(pop());
+                double a = AS_NUMBER(pop());
+                push(NUMBER_VAL(a + b));
+                break;
+            }
+            case OP_INDEX_ARRAY_NUM: {
+                if (!IS_ARRAY(peek(1)) || !IS_NUMBER(peek(0))) {
+                    DESPECIALIZE(OP_LISTS_READ_IDX);
+                    break;
+                }
+                int idx = AS_NUMBER(pop());
+                ObjArray* array = AS_ARRAY(pop());
+                if (idx < 0 || idx >= array->count) {
+                    runtimeError("Array index=%d out of range. Current len()=%d.", idx, array->count);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                push(ARRAY_SLOT(array, idx));     // the hot path reads the ring buffer directly
+                break;
+            }
+            case OP_INDEX_MAP_STR: {
+                if (!IS_MAP(peek(1)) || !IS_STRING(peek(0))) {
+                    DESPECIALIZE(OP_LISTS_READ_IDX);
+                    break;
+                }
+                ObjString* key = AS_STRING(pop());
+                ObjMap* map = AS_MAP(pop());
+                Value result;
+                push(tableGet(&map->table, key, &result) ? result : NIL_VAL);   // strings are interned -> no need to compare chars
+                break;
+            }
+            case OP_STORE_ARRAY_NUM: {
+                if (!IS_ARRAY(peek(2)) || !IS_NUMBER(peek(1))) {
+                    DESPECIALIZE(OP_LISTS_WRITE_IDX);
+                    break;
+                }
+                Value item = peek(0);
+                int idx = AS_NUMBER(peek(1));
+                ObjArray* array = AS_ARRAY(peek(2));
+                if (!arrayIsValidIndex(array, idx)) {
+                    runtimeError("Invalid index to array.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                arrayWriteTo(array, idx, item);
+                vm.stackTop -= 3;
+                push(item);
+                break;
+            }
+            case OP_STORE_MAP_STR: {
+                if (!IS_MAP(peek(2)) || !IS_STRING(peek(1))) {
+                    DESPECIALIZE(OP_LISTS_WRITE_IDX);
+                    break;
+                }
+                Value value = peek(0);
+                ObjMap* map = AS_MAP(peek(2));
+                if (IS_NIL(value)) {
+                    tableDelete(&map->table, AS_STRING(peek(1)));
+                } else {
+                    tableSet(&map->table, AS_STRING(peek(1)), value);   // may allocate -> everything stays on the stack till here
+                }
+                vm.stackTop -= 3;
+                push(value);
+                break;
+            }
+            case OP_GET_FIELD: {
+                // only the field lookup: methods (bound on every access) go through the generic OP_GET_PROPERTY
+                Value value;
+                if (!IS_INSTANCE(peek(0)) || !tableGet(&AS_INSTANCE(peek(0))->fields, AS_STRING(frame->closure->function->chunk.constants.values[frame->ip[0]]), &value)) {
+                    DESPECIALIZE(OP_GET_PROPERTY);
+                    break;
+                }
+                frame->ip++;
+                vm.stackTop[-1] = value;
+                break;
+            }
             case OP_MODULO:{
                 if ( !IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1)) ) { 
                     runtimeError("Operands must be numbers."); 
@@ -934,18 +1492,281 @@ static InterpretResult run() {
 #undef READ_CONSTANT
 #undef READ_STRING
 #undef BINARY_OP
+#undef RUN_REGISTER_CALLEE
+#undef QUICKEN
+#undef DESPECIALIZE
 }
 
-// takes the source-code string (from file or repl) and interprets/runs it
-InterpretResult interpret(const char* source) {
-    ObjFunction* function = compile(source);                // pass SourceCode to compiler
+// helper for runRegister() - back in a register frame after a call: its registers above 'from' got used by the callee
+// (they might point to freed objects by now) -> reset them and give the stack back its window of registers.
+static void resumeRegisters(CallFrame* frame, Value* from) {
+    Value* registersEnd = frame->slots + frame->closure->function->maxRegisters;
+    for (Value* slot = from; slot < registersEnd; slot++) *slot = NIL_VAL;
+    vm.stackTop = registersEnd;
+}
+
+// the interpreter loop for register bytecode (--register). Works like run() but instead of pushing and popping
+// every instruction names its operands: registers are slots in the frame's window of the stack (or constants for RK operands)
+// - calls to functions that stay stack bytecode run in a nested run(), like calls from a native do.
+static InterpretResult runRegister(int baseFrame) {
+    CallFrame* frame = &vm.frames[vm.frameCount - 1];
+    Value* slots = frame->slots;
+    Value* constants = frame->closure->function->chunk.constants.values;
+#define READ_BYTE() (*frame->ip++)
+#define READ_SHORT() \
+    (frame->ip += 2, \
+    (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
+#define READ_STRING() AS_STRING(constants[READ_BYTE()])
+// an RK operand is either a register or (with the RK_CONSTANT bit set) an index into the constants
+#define READ_RK() rk(slots, constants, READ_BYTE())
+// after a call or return we continue in another frame:
+#define LOAD_FRAME() \
+    do { \
+        frame = &vm.frames[vm.frameCount - 1]; \
+        slots = frame->slots; \
+        constants = frame->closure->function->chunk.constants.values; \
+    } while (false)
+#define REGISTER_BINARY_OP(valueType, op) \
+    do { \
+        uint8_t dst = READ_BYTE(); \
+        Value a = READ_RK(); \
+        Value b = READ_RK(); \
+        if (!IS_NUMBER(a) || !IS_NUMBER(b)) { \
+            runtimeError("Operands must be numbers."); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+        slots[dst] = valueType(AS_NUMBER(a) op AS_NUMBER(b)); \
+    } while (false)
+
+    for(;;) {
+        #ifdef DEBUG_TRACE_EXECUTION
+            if (FLAG_TRACE_EXECUTION) {
+                printf("          ");
+                for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
+                    printf("[ ");
+                    printValue(*slot);
+                    printf(" ]");
+                }
+                printf("\n");
+                ObjFunction* function = frame->closure->function;
+                disassembleRegisterInstruction(function, (int)(frame->ip - function->regChunk.code));
+            }
+        #endif
+        #ifdef DEBUG_COUNT_INSTRUCTIONS
+            vm.instructionCount++;
+        #endif
+
+        switch (READ_BYTE()) {
+            case REG_MOVE: {
+                uint8_t dst = READ_BYTE();
+                slots[dst] = slots[READ_BYTE()];
+                break;
+            }
+            case REG_LOADK: {
+                uint8_t dst = READ_BYTE();
+                slots[dst] = constants[READ_BYTE()];
+                break;
+            }
+            case REG_NIL:       slots[READ_BYTE()] = NIL_VAL; break;
+            case REG_TRUE:      slots[READ_BYTE()] = BOOL_VAL(true); break;
+            case REG_FALSE:     slots[READ_BYTE()] = BOOL_VAL(false); break;
+            case REG_GET_GLOBAL: {
+                uint8_t dst = READ_BYTE();
+                ObjString* name = READ_STRING();
+                if (!tableGet(globalsOf(frame->closure->function), name, &slots[dst])) {
+                    runtimeError("Undefined variable '%s'.", name->chars);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            }
+            case REG_DEFINE_GLOBAL: {
+                ObjString* name = READ_STRING();
+                tableSet(globalsOf(frame->closure->function), name, READ_RK());
+                break;
+            }
+            case REG_SET_GLOBAL: {
+                ObjString* name = READ_STRING();
+                Table* globals = globalsOf(frame->closure->function);
+                if (tableSet(globals, name, READ_RK())) {
+                    tableDelete(globals, name);     // delete zombie values from table (important for REPL)
+                    runtimeError("Undefined variable '%s'.", name->chars);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            }
+            case REG_GET_UPVALUE: {
+                uint8_t dst = READ_BYTE();
+                slots[dst] = *frame->closure->upvalues[READ_BYTE()]->location;
+                break;
+            }
+            case REG_SET_UPVALUE: {
+                uint8_t slot = READ_BYTE();
+                *frame->closure->upvalues[slot]->location = READ_RK();
+                break;
+            }
+            case REG_EQUAL: {
+                uint8_t dst = READ_BYTE();
+                Value a = READ_RK();
+                Value b = READ_RK();
+                slots[dst] = BOOL_VAL(valuesEqual(a, b));
+                break;
+            }
+            case REG_GREATER:   REGISTER_BINARY_OP(BOOL_VAL, >); break;
+            case REG_LESS:      REGISTER_BINARY_OP(BOOL_VAL, <); break;
+            case REG_ADD: {
+                uint8_t dst = READ_BYTE();
+                Value a = READ_RK();
+                Value b = READ_RK();
+                if (IS_NUMBER(a) && IS_NUMBER(b)) {
+                    slots[dst] = NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b));
+                } else if (IS_STRING(a) && IS_STRING(b)) {
+                    slots[dst] = OBJ_VAL(concatenateStrings(AS_STRING(a), AS_STRING(b)));   // a and b are in registers or constants -> GC safe
+                } else {
+                    runtimeError("Operands must be two numbers or two strings.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            }
+            case REG_SUBTRACT:  REGISTER_BINARY_OP(NUMBER_VAL, -); break;
+            case REG_MULTIPLY:  REGISTER_BINARY_OP(NUMBER_VAL, *); break;
+            case REG_DIVIDE:    REGISTER_BINARY_OP(NUMBER_VAL, /); break;
+            case REG_MODULO: {
+                uint8_t dst = READ_BYTE();
+                Value a = READ_RK();
+                Value b = READ_RK();
+                if (!IS_NUMBER(a) || !IS_NUMBER(b)) {
+                    runtimeError("Operands must be numbers.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                slots[dst] = NUMBER_VAL(myFloatModulo(AS_NUMBER(a), AS_NUMBER(b)));
+                break;
+            }
+            case REG_NOT: {
+                uint8_t dst = READ_BYTE();
+                slots[dst] = BOOL_VAL(isFalsey(READ_RK()));
+                break;
+            }
+            case REG_NEGATE: {
+                uint8_t dst = READ_BYTE();
+                Value value = READ_RK();
+                if (!IS_NUMBER(value)) {
+                    runtimeError("Operand must be a number.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                slots[dst] = NUMBER_VAL(-AS_NUMBER(value));
+                break;
+            }
+            case REG_JUMP: {
+                uint16_t offset = READ_SHORT();
+                frame->ip += offset;
+                break;
+            }
+            case REG_LOOP: {
+                uint16_t offset = READ_SHORT();
+                frame->ip -= offset;
+                break;
+            }
+            case REG_JUMP_IF_FALSE: {
+                Value condition = READ_RK();
+                uint16_t offset = READ_SHORT();
+                if (isFalsey(condition)) frame->ip += offset;
+                break;
+            }
+            case REG_JUMP_IF_TRUE: {
+                Value condition = READ_RK();
+                uint16_t offset = READ_SHORT();
+                if (!isFalsey(condition)) frame->ip += offset;
+                break;
+            }
+            case REG_PRINT: {
+                printValue(READ_RK());
+                printf("\n");
+                break;
+            }
+            case REG_CALL:
+            case REG_TAIL_CALL: {
+                bool isTailCall = frame->ip[-1] == REG_TAIL_CALL;
+                uint8_t callee = READ_BYTE();
+                int argCount = READ_BYTE();
+                // callValue() expects the callee and its arguments on top of the stack
+                vm.stackTop = slots + callee + argCount + 1;
+                if (isTailCall && tailCall(frame, slots[callee], argCount)) {
+                    LOAD_FRAME();
+                    break;
+                }
+                int frameCount = vm.frameCount;
+                if (!callValue(slots[callee], argCount)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if (vm.frameCount > frameCount) {
+                    if (IS_REGISTER_FUNCTION(vm.frames[vm.frameCount - 1].closure->function)) {
+                        LOAD_FRAME();                   // we just continue in here with the callee
+                        break;
+                    }
+                    if (run(frameCount) != INTERPRET_OK) return INTERPRET_RUNTIME_ERROR;
+                }
+                resumeRegisters(frame, slots + callee + 1);     // the result landed in the callee's register
+                break;
+            }
+            case REG_CLOSURE: {
+                uint8_t dst = READ_BYTE();
+                ObjFunction* function = AS_FUNCTION(constants[READ_BYTE()]);
+                ObjClosure* closure = makeClosure(function);
+                slots[dst] = OBJ_VAL(closure);          // in its register before capturing the upvalues (that allocates -> GC)
+                for (int i = 0; i < closure->upvalueCount; i++) {
+                    uint8_t isLocal = READ_BYTE();
+                    uint8_t index = READ_BYTE();
+                    if (isLocal) {
+                        closure->upvalues[i] = captureUpvalue(slots + index);
+                    } else {
+                        closure->upvalues[i] = frame->closure->upvalues[index];
+                    }
+                }
+                break;
+            }
+            case REG_CLOSE_UPVALUE:
+                closeUpvalues(slots + READ_BYTE());
+                break;
+            case REG_RETURN: {
+                Value result = READ_RK();
+                closeUpvalues(slots);
+                vm.frameCount--;
+                if (vm.frameCount == 0) {
+                    vm.stackTop = vm.stack;         // the toplevel script finished -> the program is done
+                    return INTERPRET_OK;
+                }
+                vm.stackTop = slots;
+                push(result);                       // like the stack vm: the result replaces the callee
+                if (vm.frameCount == baseFrame) return INTERPRET_OK;
+                LOAD_FRAME();                       // only register functions return in here (we pushed their frames ourself)
+                resumeRegisters(frame, vm.stackTop);
+                break;
+            }
+        }
+    }
+#undef READ_BYTE
+#undef READ_SHORT
+#undef READ_STRING
+#undef READ_RK
+#undef LOAD_FRAME
+#undef REGISTER_BINARY_OP
+}
+
+// takes the source-code (from file or repl, length chars - no '\0' needed) and interprets/runs it
+InterpretResult interpret(const char* source, size_t length) {
+    ObjFunction* function = compile(source, length);        // pass SourceCode to compiler
     if (function == NULL) return INTERPRET_COMPILE_ERROR;   // NULL means we hit some kind of Compile-Error(that Compiler already reported)
+    return interpretFunction(function);
+}
 
+// runs an already compiled script (ex. one loaded from a .loxc image)
+InterpretResult interpretFunction(ObjFunction* function) {
     push(OBJ_VAL(function));                                // store the funcion on the stack
+    prefetchImports(NULL, function);                        // compiles what it imports on all cores, before it runs
     ObjClosure* closure = newClosure(function);             // wrap the function in its wrapper Closure (vm, only touches closures not functions)
     pop();                                                  // pop the created Function
     push(OBJ_VAL(closure));                                 // and push the closure (so its there instead the function) this happens for gc-reasons
     call(closure, 0);                                       // initializes the toplevel Stack-Frame
 
-    return run();
+    return execute(0);
 }
\ No newline at end of file
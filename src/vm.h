@@ -40,6 +40,11 @@ typedef struct {
     int grayCount;
     int grayCapacity;
     Obj** grayStack;                // array to keep track of gray-nodes (already visited) but not finished(=black-nodes)
+    int gcCount;                    // collections so far and the wall time they took (--timings)
+    double gcSeconds;
+#ifdef DEBUG_COUNT_INSTRUCTIONS
+    long instructionCount;          // how many instructions both interpreter loops dispatched (build with -DDEBUG_COUNT_INSTRUCTIONS, ex. the benchmarks)
+#endif
 } VM;
 
 // The VM runs the chunk and responds with a value from this enum:
@@ -59,8 +64,13 @@ extern VM vm;       // we expose the vm globally. (since the object-module needs
 
 void initVM();
 void freeVM();
-InterpretResult interpret(const char* source);
+InterpretResult interpret(const char* source, size_t length);
+InterpretResult interpretFunction(ObjFunction* function);
+int nativeIndex(NativeFn function);
+NativeFn nativeAt(int index);
+void defineNatives(Table* globals);
 void push(Value value);
 Value pop();
+float myFloatModulo(float a, float b);     // the compiler folds constant % with this, so it has to match the runtime exactly
 
 #endif
@@ -45,7 +45,7 @@ int runCompiler(char* sourceCode, bool isBytecode, bool isTrace, bool isGc) {
 
     // ido the compiling:
     initVM();
-	InterpretResult result = interpret(sourceCode);
+	InterpretResult result = interpret(sourceCode, strlen(sourceCode));
 	free(sourceCode);
     // free the VM
     freeVM();
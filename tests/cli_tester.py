@@ -0,0 +1,217 @@
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+# tests for the command line modes that tester.py cant cover (it only runs scripts and compares their output)
+# usage:
+#       python3 [pathTo/cli_tester.py] [pathTo/binary.out] [pathToLoxTestfiles/tests]
+#
+# - every check_* function is one test. It gets a fresh temporary directory to work in and returns an error message (None if it passed)
+
+
+class bcolors:
+    HEADER = '\033[95m'
+    OKGREEN = '\033[92m'
+    WARNING = '\033[93m'
+    FAIL = '\033[91m'
+    ENDC = '\033[0m'
+
+# runs the binary with args, returns (exit code, stdout, stderr)
+def run(*args):
+    result = subprocess.run([loxbinary, *args], capture_output=True, universal_newlines=True)
+    return result.returncode, result.stdout, result.stderr
+
+# copies the test scripts at paths (relative to the tests folder) into directory
+def copyScripts(directory, *paths):
+    for path in paths:
+        shutil.copy(os.path.join(testsPath, path), directory)
+
+## --check
+
+def check_check_valid(directory):
+    os.mkdir(os.path.join(directory, "sub"))
+    copyScripts(directory, "extended_files/array_queue.lox")
+    copyScripts(os.path.join(directory, "sub"), "extended_files/tail_calls.lox")
+    code, out, err = run("--check", directory)
+    if code != 0: return F"exit {code}, expected 0 {err}"
+    if "checked 2 scripts" not in out: return F"unexpected report: {out}"
+
+def check_check_compile_error(directory):
+    copyScripts(directory, "extended_files/array_queue.lox", "extended_files/tail_calls.lox")
+    broken = os.path.join(directory, "broken.lox")
+    with open(broken, "w") as f:
+        f.write("print 1;\nvar x = ;\n")
+    code, out, err = run("--check", directory)
+    if code != 65: return F"exit {code}, expected 65"
+    if F"{broken}: [line 2] Error at ';': Expect expression." not in err: return F"error not prefixed with its script: {err}"
+    if "2 compiled, 1 failed" not in out: return F"unexpected report: {out}"
+
+def check_check_missing_path(directory):
+    code, out, err = run("--check", os.path.join(directory, "missing"))
+    if code != 74: return F"exit {code}, expected 74"
+
+
+## .loxc images
+
+# every script of the suite that compiles gets written to an image, running the image has to do exactly what running the script does
+# (on both vms, the register bytecode is part of the image too)
+def check_images_of_suite(directory):
+    copy = os.path.join(directory, "tests")
+    shutil.copytree(testsPath, copy)
+    for flags in [[], ["--register"]]:
+        compiled = 0
+        for root, _, files in os.walk(copy):
+            for name in sorted(files):
+                if not name.endswith(".lox"): continue
+                script = os.path.join(root, name)
+                code, _, _ = run(*flags, "--compile-only", script)
+                if code == 65: continue             # scripts with compile errors have nothing to write
+                if code != 0: return F"--compile-only {script}: exit {code}"
+                compiled += 1
+                original = os.path.join(testsPath, os.path.relpath(script, copy))
+                expected = run(*flags, original)
+                got = run(*flags, script + "c")
+                if got != expected: return F"{' '.join(flags)} {script}c: got {got}, expected {expected}"
+        if compiled < 100: return F"only {compiled} scripts compiled"
+
+# helper for the broken image tests - compiles a script to an image and returns the path of the image
+def compileImage(directory):
+    copyScripts(directory, "extended_files/tail_calls.lox")
+    script = os.path.join(directory, "tail_calls.lox")
+    code, _, err = run("--compile-only", script)
+    if code != 0: raise Exception(F"--compile-only failed: {err}")
+    return script + "c"
+
+def check_image_truncated(directory):
+    image = compileImage(directory)
+    with open(image, "r+b") as f:
+        f.truncate(os.path.getsize(image) // 2)
+    code, out, err = run(image)
+    if code != 65: return F"exit {code}, expected 65"
+    if "Could not load image" not in err: return F"unexpected error: {err}"
+
+def check_image_corrupted(directory):
+    image = compileImage(directory)
+    with open(image, "rb") as f:
+        original = f.read()
+    for offset in [40, len(original) - 3]:      # a byte of the metadata, one of the code section -> checksum fails
+        data = bytearray(original)
+        data[offset] ^= 0xff
+        with open(image, "wb") as f:
+            f.write(data)
+        code, out, err = run(image)
+        if code != 65: return F"byte {offset} flipped: exit {code}, expected 65"
+    # next to its script a broken image just gets ignored, the script gets compiled instead
+    expected = run(os.path.join(testsPath, "extended_files/tail_calls.lox"))
+    got = run(image[:-1])
+    if got != expected: return F"script next to a broken image: got {got}, expected {expected}"
+
+
+## heap snapshots
+
+SNAPSHOT_PRELUDE = """
+class Shape {
+    init(name) { this.name = name; }
+    describe() { return this.name; }
+}
+class Square < Shape {
+    init(side) {
+        super.init("square");
+        this.side = side;
+    }
+    area() { return this.side * this.side; }
+}
+fun makeCounter(start) {
+    var count = start;
+    fun bump() {
+        count = count + 1;
+        return count;
+    }
+    return bump;
+}
+var counter = makeCounter(10);
+counter();
+var shapes = [Square(2), Square(3)];
+var names = {"one": 1, "two": [1, 2], "shape": shapes[0]};
+var shared = shapes;
+fun add(a, b) { return a + b; }
+fun get(items, key) { return items[key]; }
+for (var i = 0; i < 3; i = i + 1) { add(i, 1); get(shapes, 0); }    // quickened before the snapshot gets written
+"""
+
+SNAPSHOT_SCRIPT = """
+print counter();
+print counter();
+print makeCounter(0)();
+print shapes[1].describe();
+print shapes[1].area();
+print Square(4).area();
+print names["one"] + len(names["two"]);
+print names["shape"] == shapes[0];
+print shared == shapes;
+push(shared, Square(1));
+print len(shapes);
+print add("a", "b");
+print get({"key": "value"}, "key");
+"""
+
+SNAPSHOT_OUTPUT = "12\n13\n1\nsquare\n9\n16\n3\ntrue\ntrue\n3\nab\nvalue\n"
+
+# the prelude runs once and gets written to a snapshot, the script starts from that: closures keep their (closed) upvalues,
+# classes their superclass, arrays and maps their items and objects their identity
+def check_snapshot_roundtrip(directory):
+    prelude = os.path.join(directory, "prelude.lox")
+    script = os.path.join(directory, "script.lox")
+    snapshot = os.path.join(directory, "prelude.loxs")
+    with open(prelude, "w") as f:
+        f.write(SNAPSHOT_PRELUDE)
+    with open(script, "w") as f:
+        f.write(SNAPSHOT_SCRIPT)
+    with open(os.path.join(directory, "both.lox"), "w") as f:
+        f.write(SNAPSHOT_PRELUDE + SNAPSHOT_SCRIPT)
+    expected = run(os.path.join(directory, "both.lox"))
+    if expected != (0, SNAPSHOT_OUTPUT, ""): return F"running prelude and script together: {expected}"
+    code, out, err = run("--snapshot", snapshot, prelude)
+    if code != 0: return F"--snapshot: exit {code} {err}"
+    for flags in [[], ["--register"]]:
+        got = run(*flags, "--restore", snapshot, script)
+        if got != expected: return F"{' '.join(flags)} --restore: got {got}, expected {expected}"
+
+def check_snapshot_corrupted(directory):
+    prelude = os.path.join(directory, "prelude.lox")
+    snapshot = os.path.join(directory, "prelude.loxs")
+    with open(prelude, "w") as f:
+        f.write(SNAPSHOT_PRELUDE)
+    code, out, err = run("--snapshot", snapshot, prelude)
+    if code != 0: return F"--snapshot: exit {code} {err}"
+    with open(snapshot, "r+b") as f:
+        f.truncate(os.path.getsize(snapshot) - 1)
+    code, out, err = run("--restore", snapshot, prelude)
+    if code != 65: return F"exit {code}, expected 65"
+
+
+## our main process:
+if len(sys.argv) < 3:
+    print("lox-cli-test, usage:\n\tpython3 ./tests/cli_tester.py [pathToBinary] [pathToLoxTestfiles]")
+    exit(2)
+loxbinary = os.path.abspath(sys.argv[1])
+testsPath = sys.argv[2]
+
+checks = [(name, fn) for name, fn in list(globals().items()) if name.startswith("check_") and callable(fn)]
+print(F"Found {bcolors.WARNING}{len(checks)} command line tests.{bcolors.ENDC} Starting testing...")
+bad = 0
+for name, fn in checks:
+    with tempfile.TemporaryDirectory() as directory:
+        error = fn(directory)
+    if error is not None:
+        bad += 1
+        print(F"{bcolors.FAIL}FAILED:{bcolors.ENDC} {bcolors.WARNING}{name}{bcolors.ENDC} {error}")
+
+if bad != 0:
+    print(F"{bcolors.HEADER}Completed {len(checks)} tests: {bcolors.ENDC} {bcolors.OKGREEN}passed: {len(checks)-bad}{bcolors.ENDC}, {bcolors.FAIL}failed: {bad}{bcolors.ENDC}")
+    exit(1)
+else:
+    print(F"{bcolors.OKGREEN}Completed all {len(checks)} tests: passed: {len(checks)} failed: 0{bcolors.ENDC},")
+    exit(0)
@@ -4,11 +4,12 @@ import sys
 
 # quick and easy test-suite
 # usage:
-#       python3 [pathTo/tester.py] [pathTo/binary.out] [pathToLoxTestfiles/tests]
+#       python3 [pathTo/tester.py] [pathTo/binary.out] [pathToLoxTestfiles/tests] [flags for the binary...]
 #
 # - it just runs every *.lox file in the specified folder.
 # - "// expect: 1234" to expect 1234 as print output in that line (outputs get parsed one after the other)
 # - "// [line 22] Error message expected" errors can be written at any place in the file
+# - "// flags: --lazy" as first line runs that file with these flags added (on top of the ones of the whole run)
 
 
 class bcolors:
@@ -28,16 +29,24 @@ def getAllLoxFiles(loxbinary, pathToTests):
 def substring_after(s, delim):
      return s.partition(delim)[2]
 
+# the flags from a "// flags: ..." first line of the file (none if it has no such line)
+def fileFlags(filepath):
+    with open(filepath) as f:
+        first = f.readline()
+    if not first.startswith("// flags: "): return []
+    return substring_after(first, "// flags: ").split()
+
 # executes file and checks for expected output marked with "expect: ....."
 # for errors we just get them and search if they are referenced anywhere in the file -> then were fine
 def testFile(loxbinary, filepath):
-    result = subprocess.run([loxbinary, filepath], capture_output=True, universal_newlines = True )
+    flags = [*binaryFlags, *fileFlags(filepath)]
+    result = subprocess.run([loxbinary, *flags, filepath], capture_output=True, universal_newlines = True )
     outLines = result.stdout.splitlines()
     errLines = result.stderr.splitlines()
     with open(filepath) as f:
             idx = 0 # line-nr
             FAILED = F"{bcolors.FAIL}FAILED:{bcolors.ENDC}"
-            PATHTESTED = F"{bcolors.WARNING}{loxbinary} {filepath}{bcolors.ENDC}"
+            PATHTESTED = F"{bcolors.WARNING}{' '.join([loxbinary, *flags])} {filepath}{bcolors.ENDC}"
             for line in f:
                 idx+=1
                 for err in errLines:
@@ -60,8 +69,9 @@ def testFile(loxbinary, filepath):
 ## our main process:
 loxbinary = sys.argv[1] #"./binary.out"
 pathTestFiles = sys.argv[2].rstrip("/")+"/**/*.lox" #"./tests" + 
-if len(sys.argv) != 3:
-    print("lox-test, usage:\n\tlox-test [pathToBinary] [pathToLoxTestfiles]\n\tpython3 ./tests/unit.py ./binary.out ./tests")
+binaryFlags = sys.argv[3:]  # ex. "--register" to run every test on the register vm
+if len(sys.argv) < 3:
+    print("lox-test, usage:\n\tlox-test [pathToBinary] [pathToLoxTestfiles] [flags...]\n\tpython3 ./tests/unit.py ./binary.out ./tests")
     exit(2)
 files = getAllLoxFiles(loxbinary, pathTestFiles)
 print(F"Found {bcolors.WARNING}{len(files)} *.lox-files.{bcolors.ENDC} Starting testing...")